@@ -9,24 +9,25 @@
 
 #include "aes.h"
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif /* _WIN32 */
+
 /**
- * aes_128_cbc_encrypt - AES-128 CBC encryption
- * @key: Encryption key
+ * aes_cbc_encrypt - AES CBC encryption with an expanded key
+ * @key: Encryption key schedule from aes_encrypt_key_init()
  * @iv: Encryption IV for CBC mode (16 bytes)
  * @data: Data to encrypt in-place
  * @data_len: Length of data in bytes (must be divisible by 16)
  * Returns: 0 on success, -1 on failure
  */
-int aes_128_cbc_encrypt(const aes_uchar *key, const aes_uchar *iv, aes_uchar *data, size_t data_len)
+int aes_cbc_encrypt(const struct aes_key *key, const aes_uchar *iv, aes_uchar *data, size_t data_len)
 {
-	void *ctx;
+	void *ctx = (void *) key;
 	aes_uchar cbc[AES_BLOCK_SIZE];
 	aes_uchar *pos = data;
 	size_t i, j, blocks;
 
-	ctx = aes_encrypt_init(key, 16);
-	if (ctx == NULL)
-		return -1;
 	memcpy(cbc, iv, AES_BLOCK_SIZE);
 
 	blocks = data_len / AES_BLOCK_SIZE;
@@ -37,40 +38,259 @@ int aes_128_cbc_encrypt(const aes_uchar *key, const aes_uchar *iv, aes_uchar *da
 		memcpy(pos, cbc, AES_BLOCK_SIZE);
 		pos += AES_BLOCK_SIZE;
 	}
-	aes_encrypt_deinit(ctx);
 	return 0;
 }
 
 
 /**
- * aes_128_cbc_decrypt - AES-128 CBC decryption
- * @key: Decryption key
+ * aes_cbc_decrypt - AES CBC decryption with an expanded key
+ * @key_dec: Decryption key schedule from aes_decrypt_key_init()
  * @iv: Decryption IV for CBC mode (16 bytes)
  * @data: Data to decrypt in-place
  * @data_len: Length of data in bytes (must be divisible by 16)
  * Returns: 0 on success, -1 on failure
  */
-int aes_128_cbc_decrypt(const aes_uchar *key, const aes_uchar *iv, aes_uchar *data, size_t data_len)
+int aes_cbc_decrypt(const struct aes_key *key_dec, const aes_uchar *iv, aes_uchar *data,
+		    size_t data_len)
 {
-	void *ctx;
-	aes_uchar cbc[AES_BLOCK_SIZE], tmp[AES_BLOCK_SIZE];
-	aes_uchar *pos = data;
-	size_t i, j, blocks;
+	aes_uchar cbc[AES_BLOCK_SIZE];
 
-	ctx = aes_decrypt_init(key, 16);
-	if (ctx == NULL)
-		return -1;
 	memcpy(cbc, iv, AES_BLOCK_SIZE);
+	aes_decrypt_cbc((void *) key_dec, cbc, data, data_len / AES_BLOCK_SIZE, data);
+	return 0;
+}
 
-	blocks = data_len / AES_BLOCK_SIZE;
-	for (i = 0; i < blocks; i++) {
-		memcpy(tmp, pos, AES_BLOCK_SIZE);
-		aes_decrypt(ctx, pos, pos);
-		for (j = 0; j < AES_BLOCK_SIZE; j++)
-			pos[j] ^= cbc[j];
-		memcpy(cbc, tmp, AES_BLOCK_SIZE);
-		pos += AES_BLOCK_SIZE;
+
+#ifndef _WIN32
+
+struct aes_cbc_decrypt_part {
+	const struct aes_key *key_dec;
+	aes_uchar iv[AES_BLOCK_SIZE];
+	aes_uchar *data;
+	size_t nblocks;
+	pthread_t thread;
+};
+
+static void * aes_cbc_decrypt_thread(void *arg)
+{
+	struct aes_cbc_decrypt_part *part = arg;
+
+	aes_decrypt_cbc((void *) part->key_dec, part->iv, part->data, part->nblocks, part->data);
+	return NULL;
+}
+
+#endif /* _WIN32 */
+
+
+/**
+ * aes_cbc_decrypt_threads - AES CBC decryption split across threads
+ * @key_dec: Decryption key schedule from aes_decrypt_key_init()
+ * @iv: Decryption IV for CBC mode (16 bytes)
+ * @data: Data to decrypt in-place
+ * @data_len: Length of data in bytes (must be divisible by 16)
+ * @num_threads: Maximum number of threads, including the caller's
+ * Returns: 0 on success, -1 on failure
+ *
+ * The data is split into consecutive parts of at least 64 kB. The IV of each
+ * part is the last ciphertext block of the part before it, taken before any
+ * thread starts so that decrypting in place does not overwrite it. Parts are
+ * decrypted on the calling thread if a thread cannot be created, and always
+ * on Windows.
+ */
+int aes_cbc_decrypt_threads(const struct aes_key *key_dec, const aes_uchar *iv, aes_uchar *data,
+			    size_t data_len, int num_threads)
+{
+#ifndef _WIN32
+	struct aes_cbc_decrypt_part *parts;
+	size_t blocks = data_len / AES_BLOCK_SIZE, per, pos;
+	int i, n, *started;
+
+	n = num_threads;
+	if (n > (int) (blocks / 4096))
+		n = (int) (blocks / 4096);
+	if (n <= 1)
+		return aes_cbc_decrypt(key_dec, iv, data, data_len);
+
+	parts = malloc(n * (sizeof(*parts) + sizeof(*started)));
+	if (parts == NULL)
+		return -1;
+	started = (int *) (parts + n);
+
+	per = blocks / n;
+	for (i = 0, pos = 0; i < n; i++, pos += per) {
+		parts[i].key_dec = key_dec;
+		memcpy(parts[i].iv, i == 0 ? iv : data + AES_BLOCK_SIZE * (pos - 1), AES_BLOCK_SIZE);
+		parts[i].data = data + AES_BLOCK_SIZE * pos;
+		parts[i].nblocks = i == n - 1 ? blocks - pos : per;
+	}
+
+	/* detect the backend once, before the workers start using it */
+	aes_cpu_features();
+
+	for (i = 1; i < n; i++)
+		started[i] = pthread_create(&parts[i].thread, NULL, aes_cbc_decrypt_thread,
+					    &parts[i]) == 0;
+	aes_cbc_decrypt_thread(&parts[0]);
+	for (i = 1; i < n; i++) {
+		if (started[i])
+			pthread_join(parts[i].thread, NULL);
+		else
+			aes_cbc_decrypt_thread(&parts[i]);
 	}
-	aes_decrypt_deinit(ctx);
+
+	free(parts);
 	return 0;
+#else /* _WIN32 */
+	(void) num_threads;
+	return aes_cbc_decrypt(key_dec, iv, data, data_len);
+#endif /* _WIN32 */
+}
+
+
+/**
+ * aes_cbc_mb_init - Initialize a multi-buffer CBC job manager
+ * @mb: Job manager; holds no resources, so there is no deinit
+ *
+ * Up to AES_CBC_MB_LANES jobs are in flight. Jobs with the same key size
+ * are the ones interleaved without AES-NI.
+ */
+void aes_cbc_mb_init(struct aes_cbc_mb *mb)
+{
+	memset(mb, 0, sizeof(*mb));
+	mb->lanes = aes_cbc_mb_lanes();
+}
+
+
+/*
+ * Encrypt every occupied lane for as many blocks as the shortest of them has
+ * left and move the jobs that are complete to the finished list.
+ */
+static void aes_cbc_mb_process(struct aes_cbc_mb *mb)
+{
+	const aes_uint *rk[AES_CBC_MB_LANES];
+	const aes_uchar *in[AES_CBC_MB_LANES];
+	aes_uchar *iv[AES_CBC_MB_LANES], *data[AES_CBC_MB_LANES];
+	size_t left, nblocks = (size_t) -1;
+	int i, n = 0;
+
+	for (i = 0; i < mb->lanes; i++) {
+		if (mb->lane[i] == NULL)
+			continue;
+		left = (mb->lane[i]->data_len - mb->done[i]) / AES_BLOCK_SIZE;
+		if (left < nblocks)
+			nblocks = left;
+		rk[n] = mb->lane[i]->key->rk;
+		iv[n] = mb->lane[i]->iv;
+		data[n] = mb->lane[i]->data + mb->done[i];
+		in[n] = data[n];
+		n++;
+	}
+	if (n == 0)
+		return;
+
+	if (nblocks > 0)
+		aes_encrypt_cbc_mb(rk, iv, in, data, n, nblocks);
+
+	for (i = 0; i < mb->lanes; i++) {
+		if (mb->lane[i] == NULL)
+			continue;
+		mb->done[i] += AES_BLOCK_SIZE * nblocks;
+		if (mb->lane[i]->data_len - mb->done[i] < AES_BLOCK_SIZE) {
+			mb->finished[mb->num_finished++] = mb->lane[i];
+			mb->lane[i] = NULL;
+		}
+	}
+}
+
+
+/**
+ * aes_cbc_mb_submit - Submit a job to a multi-buffer CBC job manager
+ * @mb: Job manager from aes_cbc_mb_init()
+ * @job: Job to encrypt; owned by the manager until it is returned
+ * Returns: A completed job, or %NULL if none is complete yet
+ *
+ * Nothing is encrypted until all lanes are occupied, so a job may be
+ * returned from a later call to aes_cbc_mb_submit() or aes_cbc_mb_flush().
+ */
+struct aes_cbc_job * aes_cbc_mb_submit(struct aes_cbc_mb *mb, struct aes_cbc_job *job)
+{
+	int i, busy = 0;
+
+	for (i = 0; i < mb->lanes; i++) {
+		if (mb->lane[i] == NULL && job) {
+			mb->lane[i] = job;
+			mb->done[i] = 0;
+			job = NULL;
+		}
+		if (mb->lane[i])
+			busy++;
+	}
+
+	/* a lane is always left free for the next job */
+	if (busy == mb->lanes)
+		aes_cbc_mb_process(mb);
+
+	if (mb->num_finished > 0)
+		return mb->finished[--mb->num_finished];
+	return NULL;
+}
+
+
+/**
+ * aes_cbc_mb_flush - Complete the jobs held by a multi-buffer CBC job manager
+ * @mb: Job manager from aes_cbc_mb_init()
+ * Returns: A completed job, or %NULL once the manager is empty
+ *
+ * Call repeatedly until it returns %NULL; partially filled lanes are
+ * encrypted together.
+ */
+struct aes_cbc_job * aes_cbc_mb_flush(struct aes_cbc_mb *mb)
+{
+	if (mb->num_finished == 0)
+		aes_cbc_mb_process(mb);
+	if (mb->num_finished > 0)
+		return mb->finished[--mb->num_finished];
+	return NULL;
+}
+
+
+/**
+ * aes_128_cbc_encrypt - AES-128 CBC encryption
+ * @key: Encryption key
+ * @iv: Encryption IV for CBC mode (16 bytes)
+ * @data: Data to encrypt in-place
+ * @data_len: Length of data in bytes (must be divisible by 16)
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_128_cbc_encrypt(const aes_uchar *key, const aes_uchar *iv, aes_uchar *data, size_t data_len)
+{
+	struct aes_key ctx;
+	int ret;
+
+	if (aes_encrypt_key_init(&ctx, key, 16) < 0)
+		return -1;
+	ret = aes_cbc_encrypt(&ctx, iv, data, data_len);
+	aes_key_clear(&ctx);
+	return ret;
+}
+
+
+/**
+ * aes_128_cbc_decrypt - AES-128 CBC decryption
+ * @key: Decryption key
+ * @iv: Decryption IV for CBC mode (16 bytes)
+ * @data: Data to decrypt in-place
+ * @data_len: Length of data in bytes (must be divisible by 16)
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_128_cbc_decrypt(const aes_uchar *key, const aes_uchar *iv, aes_uchar *data, size_t data_len)
+{
+	struct aes_key ctx;
+	int ret;
+
+	if (aes_decrypt_key_init(&ctx, key, 16) < 0)
+		return -1;
+	ret = aes_cbc_decrypt(&ctx, iv, data, data_len);
+	aes_key_clear(&ctx);
+	return ret;
 }
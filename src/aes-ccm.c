@@ -10,14 +10,47 @@
 #include "aes.h"
 
 
-static void xor_aes_block(aes_uchar *dst, const aes_uchar *src)
+static void aes_ccm_auth(void *aes, const aes_uchar *data, size_t len, aes_uchar *x)
+{
+	size_t last = len % AES_BLOCK_SIZE;
+	size_t i;
+
+	for (i = 0; i < len / AES_BLOCK_SIZE; i++) {
+		/* X_i+1 = E(K, X_i XOR B_i) */
+		aes_xor_block(x, data);
+		data += AES_BLOCK_SIZE;
+		aes_encrypt(aes, x, x);
+	}
+	if (last) {
+		/* XOR zero-padded last block */
+		for (i = 0; i < last; i++)
+			x[i] ^= *data++;
+		aes_encrypt(aes, x, x);
+	}
+}
+
+
+/**
+ * aes_ccm_aad_hdr - Encode the AAD length l(a) at the start of B_1
+ * @b: B_1 (16 bytes)
+ * @aad_len: Length of the AAD in bytes (non-zero)
+ * Returns: Length of the encoding in bytes: 2, 6 (0xff 0xfe) or 10 (0xff 0xff)
+ */
+size_t aes_ccm_aad_hdr(aes_uchar *b, size_t aad_len)
 {
-	aes_uint *d = (aes_uint *) dst;
-	aes_uint *s = (aes_uint *) src;
-	*d++ ^= *s++;
-	*d++ ^= *s++;
-	*d++ ^= *s++;
-	*d++ ^= *s++;
+	if (aad_len < 0xff00) {
+		AES_PUT_BE16(b, aad_len);
+		return 2;
+	}
+	b[0] = 0xff;
+	if ((aes_ulong) aad_len >> 32 == 0) {
+		b[1] = 0xfe;
+		AES_PUT_BE32(b + 2, aad_len);
+		return 6;
+	}
+	b[1] = 0xff;
+	AES_PUT_BE64(b + 2, aad_len);
+	return 10;
 }
 
 
@@ -25,8 +58,8 @@ static void aes_ccm_auth_start(void *aes, size_t M, size_t L, const aes_uchar *n
 			       const aes_uchar *aad, size_t aad_len, size_t plain_len,
 			       aes_uchar *x)
 {
-	aes_uchar aad_buf[2 * AES_BLOCK_SIZE];
 	aes_uchar b[AES_BLOCK_SIZE];
+	size_t i, hdr, n;
 
 	/* Authentication */
 	/* B_0: Flags | Nonce N | l(m) */
@@ -34,7 +67,8 @@ static void aes_ccm_auth_start(void *aes, size_t M, size_t L, const aes_uchar *n
 	b[0] |= (((M - 2) / 2) /* M' */ << 3);
 	b[0] |= (L - 1) /* L' */;
 	memcpy(&b[1], nonce, 15 - L);
-	AES_PUT_BE16(&b[AES_BLOCK_SIZE - L], plain_len);
+	for (i = 0; i < L; i++)
+		b[AES_BLOCK_SIZE - 1 - i] = (aes_uchar) ((aes_ulong) plain_len >> (8 * i));
 
 	aes_hexdump_key(MSG_EXCESSIVE, "CCM B_0", b, AES_BLOCK_SIZE);
 	aes_encrypt(aes, b, x); /* X_1 = E(K, B_0) */
@@ -42,38 +76,15 @@ static void aes_ccm_auth_start(void *aes, size_t M, size_t L, const aes_uchar *n
 	if (!aad_len)
 		return;
 
-	AES_PUT_BE16(aad_buf, aad_len);
-	memcpy(aad_buf + 2, aad, aad_len);
-	memset(aad_buf + 2 + aad_len, 0, sizeof(aad_buf) - 2 - aad_len);
+	/* B_1: l(a) | a, continued in B_2, ... and zero padded */
+	memset(b, 0, sizeof(b));
+	hdr = aes_ccm_aad_hdr(b, aad_len);
+	n = aad_len < AES_BLOCK_SIZE - hdr ? aad_len : AES_BLOCK_SIZE - hdr;
+	memcpy(b + hdr, aad, n);
 
-	xor_aes_block(aad_buf, x);
-	aes_encrypt(aes, aad_buf, x); /* X_2 = E(K, X_1 XOR B_1) */
-
-	if (aad_len > AES_BLOCK_SIZE - 2) {
-		xor_aes_block(&aad_buf[AES_BLOCK_SIZE], x);
-		/* X_3 = E(K, X_2 XOR B_2) */
-		aes_encrypt(aes, &aad_buf[AES_BLOCK_SIZE], x);
-	}
-}
-
-
-static void aes_ccm_auth(void *aes, const aes_uchar *data, size_t len, aes_uchar *x)
-{
-	size_t last = len % AES_BLOCK_SIZE;
-	size_t i;
-
-	for (i = 0; i < len / AES_BLOCK_SIZE; i++) {
-		/* X_i+1 = E(K, X_i XOR B_i) */
-		xor_aes_block(x, data);
-		data += AES_BLOCK_SIZE;
-		aes_encrypt(aes, x, x);
-	}
-	if (last) {
-		/* XOR zero-padded last block */
-		for (i = 0; i < last; i++)
-			x[i] ^= *data++;
-		aes_encrypt(aes, x, x);
-	}
+	aes_xor_block(x, b);
+	aes_encrypt(aes, x, x); /* X_2 = E(K, X_1 XOR B_1) */
+	aes_ccm_auth(aes, aad + n, aad_len - n, x);
 }
 
 
@@ -82,42 +93,47 @@ static void aes_ccm_encr_start(size_t L, const aes_uchar *nonce, aes_uchar *a)
 	/* A_i = Flags | Nonce N | Counter i */
 	a[0] = L - 1; /* Flags = L' */
 	memcpy(&a[1], nonce, 15 - L);
+	memset(&a[16 - L], 0, L);
 }
 
 
-static void aes_ccm_encr(void *aes, size_t L, const aes_uchar *in, size_t len, aes_uchar *out,
-			 aes_uchar *a)
+/* CTR encryption with counters A_1, A_2, ... and the CBC-MAC over the plaintext in one pass */
+static void aes_ccm_crypt(void *aes, aes_uchar *x, aes_uchar *a, const aes_uchar *in, size_t len,
+			  aes_uchar *out, int encrypt)
 {
-	size_t last = len % AES_BLOCK_SIZE;
+	size_t blocks = len / AES_BLOCK_SIZE, last = len % AES_BLOCK_SIZE;
+	aes_uchar s[AES_BLOCK_SIZE];
 	size_t i;
 
-	/* crypt = msg XOR (S_1 | S_2 | ... | S_n) */
-	for (i = 1; i <= len / AES_BLOCK_SIZE; i++) {
-		AES_PUT_BE16(&a[AES_BLOCK_SIZE - 2], i);
-		/* S_i = E(K, A_i) */
-		aes_encrypt(aes, a, out);
-		xor_aes_block(out, in);
-		out += AES_BLOCK_SIZE;
-		in += AES_BLOCK_SIZE;
-	}
+	a[AES_BLOCK_SIZE - 1] = 1;
+	aes_encrypt_ctr_cbcmac(aes, NULL, x, a, in, blocks, out, encrypt);
+	in += AES_BLOCK_SIZE * blocks;
+	out += AES_BLOCK_SIZE * blocks;
+
 	if (last) {
-		AES_PUT_BE16(&a[AES_BLOCK_SIZE - 2], i);
-		aes_encrypt(aes, a, out);
-		/* XOR zero-padded last block */
-		for (i = 0; i < last; i++)
-			*out++ ^= *in++;
+		/* MAC and XOR the zero-padded last block */
+		aes_encrypt(aes, a, s);
+		for (i = 0; i < last; i++) {
+			if (encrypt)
+				x[i] ^= in[i];
+			out[i] = in[i] ^ s[i];
+			if (!encrypt)
+				x[i] ^= out[i];
+		}
+		aes_encrypt(aes, x, x);
 	}
 }
 
 
-static void aes_ccm_encr_auth(void *aes, size_t M, aes_uchar *x, aes_uchar *a, aes_uchar *auth)
+static void aes_ccm_encr_auth(void *aes, size_t M, size_t L, aes_uchar *x, aes_uchar *a,
+			      aes_uchar *auth)
 {
 	size_t i;
 	aes_uchar tmp[AES_BLOCK_SIZE];
 
 	aes_hexdump_key(MSG_EXCESSIVE, "CCM T", x, M);
 	/* U = T XOR S_0; S_0 = E(K, A_0) */
-	AES_PUT_BE16(&a[AES_BLOCK_SIZE - 2], 0);
+	memset(&a[AES_BLOCK_SIZE - L], 0, L);
 	aes_encrypt(aes, a, tmp);
 	for (i = 0; i < M; i++)
 		auth[i] = x[i] ^ tmp[i];
@@ -132,7 +148,6 @@ static void aes_ccm_decr_auth(void *aes, size_t M, aes_uchar *a, const aes_uchar
 
 	aes_hexdump_key(MSG_EXCESSIVE, "CCM U", auth, M);
 	/* U = T XOR S_0; S_0 = E(K, A_0) */
-	AES_PUT_BE16(&a[AES_BLOCK_SIZE - 2], 0);
 	aes_encrypt(aes, a, tmp);
 	for (i = 0; i < M; i++)
 		t[i] = auth[i] ^ tmp[i];
@@ -140,64 +155,89 @@ static void aes_ccm_decr_auth(void *aes, size_t M, aes_uchar *a, const aes_uchar
 }
 
 
-/* AES-CCM with fixed L=2 and aad_len <= 30 assumption */
-int aes_ccm_ae(const aes_uchar *key, size_t key_len, const aes_uchar *nonce,
-	       size_t M, const aes_uchar *plain, size_t plain_len,
-	       const aes_uchar *aad, size_t aad_len, aes_uchar *crypt, aes_uchar *auth)
+/* L = 15 - nonce_len; the message length has to fit in L bytes */
+static int aes_ccm_check(size_t nonce_len, size_t M, size_t len)
 {
-	const size_t L = 2;
-	void *aes;
-	aes_uchar x[AES_BLOCK_SIZE], a[AES_BLOCK_SIZE];
+	size_t L = 15 - nonce_len;
 
-	if (aad_len > 30 || M > AES_BLOCK_SIZE)
+	if (nonce_len < 7 || nonce_len > 13 || M > AES_BLOCK_SIZE)
 		return -1;
+	if (L < 8 && (aes_ulong) len >> (8 * L) != 0)
+		return -1;
+	return 0;
+}
+
+
+/**
+ * aes_ccm_seal - AES-CCM encryption with an expanded key
+ * @key: Encryption key schedule from aes_encrypt_key_init()
+ * @nonce: Nonce
+ * @nonce_len: Length of nonce in bytes, 7..13 (L = 15 - nonce_len)
+ * @M: Length of the authentication field in bytes (at most 16)
+ * @plain: Plaintext
+ * @plain_len: Length of plaintext in bytes (less than 2^(8L))
+ * @aad: Additional authenticated data
+ * @aad_len: Length of aad in bytes
+ * @crypt: Buffer for ciphertext (plain_len bytes)
+ * @auth: Buffer for the encrypted authentication value (M bytes)
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_ccm_seal(const struct aes_key *key, const aes_uchar *nonce, size_t nonce_len,
+		 size_t M, const aes_uchar *plain, size_t plain_len,
+		 const aes_uchar *aad, size_t aad_len, aes_uchar *crypt, aes_uchar *auth)
+{
+	const size_t L = 15 - nonce_len;
+	void *aes = (void *) key;
+	aes_uchar x[AES_BLOCK_SIZE], a[AES_BLOCK_SIZE];
 
-	aes = aes_encrypt_init(key, key_len);
-	if (aes == NULL)
+	if (aes_ccm_check(nonce_len, M, plain_len) < 0)
 		return -1;
 
 	aes_ccm_auth_start(aes, M, L, nonce, aad, aad_len, plain_len, x);
-	aes_ccm_auth(aes, plain, plain_len, x);
 
 	/* Encryption */
 	aes_ccm_encr_start(L, nonce, a);
-	aes_ccm_encr(aes, L, plain, plain_len, crypt, a);
-	aes_ccm_encr_auth(aes, M, x, a, auth);
-
-	aes_encrypt_deinit(aes);
+	aes_ccm_crypt(aes, x, a, plain, plain_len, crypt, 1);
+	aes_ccm_encr_auth(aes, M, L, x, a, auth);
 
 	return 0;
 }
 
 
-/* AES-CCM with fixed L=2 and aad_len <= 30 assumption */
-int aes_ccm_ad(const aes_uchar *key, size_t key_len, const aes_uchar *nonce,
-	       size_t M, const aes_uchar *crypt, size_t crypt_len,
-	       const aes_uchar *aad, size_t aad_len, const aes_uchar *auth, aes_uchar *plain)
+/**
+ * aes_ccm_open - AES-CCM decryption with an expanded key
+ * @key: Encryption key schedule from aes_encrypt_key_init()
+ * @nonce: Nonce
+ * @nonce_len: Length of nonce in bytes, 7..13 (L = 15 - nonce_len)
+ * @M: Length of the authentication field in bytes (at most 16)
+ * @crypt: Ciphertext
+ * @crypt_len: Length of ciphertext in bytes (less than 2^(8L))
+ * @aad: Additional authenticated data
+ * @aad_len: Length of aad in bytes
+ * @auth: Encrypted authentication value (M bytes)
+ * @plain: Buffer for plaintext (crypt_len bytes)
+ * Returns: 0 on success, -1 on failure or if the authentication value does
+ * not match
+ */
+int aes_ccm_open(const struct aes_key *key, const aes_uchar *nonce, size_t nonce_len,
+		 size_t M, const aes_uchar *crypt, size_t crypt_len,
+		 const aes_uchar *aad, size_t aad_len, const aes_uchar *auth, aes_uchar *plain)
 {
-	const size_t L = 2;
-	void *aes;
+	const size_t L = 15 - nonce_len;
+	void *aes = (void *) key;
 	aes_uchar x[AES_BLOCK_SIZE], a[AES_BLOCK_SIZE];
 	aes_uchar t[AES_BLOCK_SIZE];
 
-	if (aad_len > 30 || M > AES_BLOCK_SIZE)
-		return -1;
-
-	aes = aes_encrypt_init(key, key_len);
-	if (aes == NULL)
+	if (aes_ccm_check(nonce_len, M, crypt_len) < 0)
 		return -1;
 
 	/* Decryption */
 	aes_ccm_encr_start(L, nonce, a);
 	aes_ccm_decr_auth(aes, M, a, auth, t);
 
-	/* plaintext = msg XOR (S_1 | S_2 | ... | S_n) */
-	aes_ccm_encr(aes, L, crypt, crypt_len, plain, a);
-
+	/* plaintext = msg XOR (S_1 | S_2 | ... | S_n), authenticated as it is produced */
 	aes_ccm_auth_start(aes, M, L, nonce, aad, aad_len, crypt_len, x);
-	aes_ccm_auth(aes, plain, crypt_len, x);
-
-	aes_encrypt_deinit(aes);
+	aes_ccm_crypt(aes, x, a, crypt, crypt_len, plain, 0);
 
 	if (memcmp(x, t, M) != 0) {
 		aes_printf(MSG_EXCESSIVE, "CCM: Auth mismatch");
@@ -206,3 +246,35 @@ int aes_ccm_ad(const aes_uchar *key, size_t key_len, const aes_uchar *nonce,
 
 	return 0;
 }
+
+
+/* AES-CCM with a 13-byte nonce (L=2) */
+int aes_ccm_ae(const aes_uchar *key, size_t key_len, const aes_uchar *nonce,
+	       size_t M, const aes_uchar *plain, size_t plain_len,
+	       const aes_uchar *aad, size_t aad_len, aes_uchar *crypt, aes_uchar *auth)
+{
+	struct aes_key aes;
+	int ret;
+
+	if (aes_encrypt_key_init(&aes, key, key_len) < 0)
+		return -1;
+	ret = aes_ccm_seal(&aes, nonce, 13, M, plain, plain_len, aad, aad_len, crypt, auth);
+	aes_key_clear(&aes);
+	return ret;
+}
+
+
+/* AES-CCM with a 13-byte nonce (L=2) */
+int aes_ccm_ad(const aes_uchar *key, size_t key_len, const aes_uchar *nonce,
+	       size_t M, const aes_uchar *crypt, size_t crypt_len,
+	       const aes_uchar *aad, size_t aad_len, const aes_uchar *auth, aes_uchar *plain)
+{
+	struct aes_key aes;
+	int ret;
+
+	if (aes_encrypt_key_init(&aes, key, key_len) < 0)
+		return -1;
+	ret = aes_ccm_open(&aes, nonce, 13, M, crypt, crypt_len, aad, aad_len, auth, plain);
+	aes_key_clear(&aes);
+	return ret;
+}
@@ -255,4 +255,20 @@ static inline void AES_PUT_LE64(aes_uchar *a, aes_ulong val)
 #endif /* __GNUC__ */
 #endif /* AES_WARN_UNUSED_RESULT */
 
+#ifndef AES_ALIGNED
+#if defined __GNUC__
+#define AES_ALIGNED(n) __attribute__((__aligned__(n)))
+#else
+#define AES_ALIGNED(n)
+#endif /* __GNUC__ */
+#endif /* AES_ALIGNED */
+
+
+/* x86 intrinsics (enabled per function, selected at runtime via CPUID) */
+
+#if defined __GNUC__ && (defined(__x86_64__) || defined(__i386__))
+#define AES_HAVE_X86_INTRIN
+#define AES_TARGET(isa) __attribute__((__target__(isa)))
+#endif /* __GNUC__ && (__x86_64__ || __i386__) */
+
 #endif /* AES_COMMON_H */
@@ -0,0 +1,107 @@
+/*
+ * AES CPU feature detection
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "aes.h"
+
+#ifdef AES_HAVE_X86_INTRIN
+#include <cpuid.h>
+#endif /* AES_HAVE_X86_INTRIN */
+
+/*
+ * Detection may run in several threads at once; they all store the same
+ * value, so relaxed atomic accesses are enough to make that race benign.
+ */
+#if defined __GNUC__
+#define AES_CPU_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define AES_CPU_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else /* __GNUC__ */
+#define AES_CPU_LOAD(p) (*(volatile int *) (p))
+#define AES_CPU_STORE(p, v) (*(volatile int *) (p) = (v))
+#endif /* __GNUC__ */
+
+static int aes_cpu_detected = -1;
+#ifdef AES_NO_BITSLICE
+static int aes_cpu_mask = ~AES_CPU_BITSLICE;
+#else /* AES_NO_BITSLICE */
+static int aes_cpu_mask = ~0;
+#endif /* AES_NO_BITSLICE */
+
+
+#ifdef AES_HAVE_X86_INTRIN
+/* XCR0: SSE, AVX, opmask, ZMM_Hi256 and Hi16_ZMM state enabled by the OS */
+static int aes_cpu_avx512_os(void)
+{
+	unsigned int eax, edx;
+
+	__asm__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return (eax & 0xe6) == 0xe6;
+}
+#endif /* AES_HAVE_X86_INTRIN */
+
+
+static int aes_cpu_detect(void)
+{
+	int features = AES_CPU_BITSLICE;
+#ifdef AES_HAVE_X86_INTRIN
+	unsigned int eax, ebx, ecx, edx, osxsave;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return features;
+
+	/* CPUID.1:ECX.AES[bit 25], CPUID.1:ECX.SSSE3[bit 9] */
+	if ((ecx & (1 << 25)) && (ecx & (1 << 9)))
+		features |= AES_CPU_AESNI;
+	/* CPUID.1:ECX.PCLMULQDQ[bit 1] */
+	if ((ecx & (1 << 1)) && (ecx & (1 << 9)))
+		features |= AES_CPU_PCLMUL;
+	/* CPUID.1:ECX.OSXSAVE[bit 27] */
+	osxsave = ecx & (1 << 27);
+
+	/*
+	 * CPUID.(7,0):EBX.AVX512F[bit 16], EBX.AVX512BW[bit 30],
+	 * ECX.VAES[bit 9], ECX.VPCLMULQDQ[bit 10]
+	 */
+	if (osxsave && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+	    (ebx & (1 << 16)) && (ebx & (1 << 30)) &&
+	    (ecx & (1 << 9)) && (ecx & (1 << 10)) && aes_cpu_avx512_os())
+		features |= AES_CPU_VAES;
+#endif /* AES_HAVE_X86_INTRIN */
+	return features;
+}
+
+
+/**
+ * aes_cpu_features - Get the CPU features usable by the AES backends
+ * Returns: Bitmask of AES_CPU_* flags, limited by aes_cpu_set_features()
+ *
+ * The CPU is probed on the first call; this is safe from several threads.
+ */
+int aes_cpu_features(void)
+{
+	int detected = AES_CPU_LOAD(&aes_cpu_detected);
+
+	if (detected < 0) {
+		detected = aes_cpu_detect();
+		AES_CPU_STORE(&aes_cpu_detected, detected);
+	}
+	return detected & AES_CPU_LOAD(&aes_cpu_mask);
+}
+
+
+/**
+ * aes_cpu_set_features - Restrict the CPU features used by the AES backends
+ * @mask: Bitmask of AES_CPU_* flags that may be used (~0 for all detected)
+ *
+ * This is intended for testing and benchmarking the portable code paths on
+ * hardware that supports the accelerated ones. Key schedules share a single
+ * layout across backends, so keys set up before the call remain valid.
+ * Without AES_CPU_BITSLICE the portable counter mode uses the T-tables.
+ */
+void aes_cpu_set_features(int mask)
+{
+	AES_CPU_STORE(&aes_cpu_mask, mask);
+}
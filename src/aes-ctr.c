@@ -10,25 +10,22 @@
 #include "aes.h"
 
 /**
- * aes_128_ctr_encrypt - AES-128 CTR mode encryption
- * @key: Key for encryption (16 bytes)
+ * aes_ctr_encrypt - AES CTR mode encryption with an expanded key
+ * @key: Encryption key schedule from aes_encrypt_key_init()
  * @nonce: Nonce for counter mode (16 bytes)
  * @data: Data to encrypt in-place
  * @data_len: Length of data in bytes
  * Returns: 0 on success, -1 on failure
  */
-int aes_128_ctr_encrypt(const aes_uchar *key, const aes_uchar *nonce,
-			aes_uchar *data, size_t data_len)
+int aes_ctr_encrypt(const struct aes_key *key, const aes_uchar *nonce,
+		    aes_uchar *data, size_t data_len)
 {
-	void *ctx;
+	void *ctx = (void *) key;
 	size_t j, len, left = data_len;
 	int i;
 	aes_uchar *pos = data;
 	aes_uchar counter[AES_BLOCK_SIZE], buf[AES_BLOCK_SIZE];
 
-	ctx = aes_encrypt_init(key, 16);
-	if (ctx == NULL)
-		return -1;
 	memcpy(counter, nonce, AES_BLOCK_SIZE);
 
 	while (left > 0) {
@@ -46,6 +43,27 @@ int aes_128_ctr_encrypt(const aes_uchar *key, const aes_uchar *nonce,
 				break;
 		}
 	}
-	aes_encrypt_deinit(ctx);
 	return 0;
 }
+
+
+/**
+ * aes_128_ctr_encrypt - AES-128 CTR mode encryption
+ * @key: Key for encryption (16 bytes)
+ * @nonce: Nonce for counter mode (16 bytes)
+ * @data: Data to encrypt in-place
+ * @data_len: Length of data in bytes
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_128_ctr_encrypt(const aes_uchar *key, const aes_uchar *nonce,
+			aes_uchar *data, size_t data_len)
+{
+	struct aes_key ctx;
+	int ret;
+
+	if (aes_encrypt_key_init(&ctx, key, 16) < 0)
+		return -1;
+	ret = aes_ctr_encrypt(&ctx, nonce, data, data_len);
+	aes_key_clear(&ctx);
+	return ret;
+}
@@ -1,5 +1,5 @@
 /*
- * AES-128 EAX
+ * AES EAX
  *
  * Copyright (c) 2003-2007, Jouni Malinen <j@w1.fi>
  *
@@ -9,9 +9,159 @@
 
 #include "aes.h"
 
+/* X = E(K, X XOR B) for each full block B */
+static void aes_eax_omac_blocks(void *aes, aes_uchar *x, const aes_uchar *data, size_t nblocks)
+{
+	while (nblocks--) {
+		aes_xor_block(x, data);
+		aes_encrypt(aes, x, x);
+		data += AES_BLOCK_SIZE;
+	}
+}
+
+
+/* Last OMAC block (1..16 bytes): K1 if it is complete, otherwise 10* padding and K2 */
+static void aes_eax_omac_final(void *aes, const aes_uchar *k1, const aes_uchar *k2, aes_uchar *x,
+			       const aes_uchar *last, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		x[i] ^= last[i];
+	if (len < AES_BLOCK_SIZE) {
+		x[len] ^= 0x80;
+		aes_xor_block(x, k2);
+	} else {
+		aes_xor_block(x, k1);
+	}
+	aes_encrypt(aes, x, x);
+}
+
+
+/* OMAC^t_K(data) = OMAC_K([t]_16 || data) without copying data */
+static void aes_eax_omac(void *aes, const aes_uchar *k1, const aes_uchar *k2, aes_uchar t,
+			 const aes_uchar *data, size_t data_len, aes_uchar *mac)
+{
+	size_t n;
+
+	memset(mac, 0, AES_BLOCK_SIZE - 1);
+	mac[AES_BLOCK_SIZE - 1] = t;
+	if (data_len == 0) {
+		/* [t]_16 is the complete last block */
+		aes_xor_block(mac, k1);
+		aes_encrypt(aes, mac, mac);
+		return;
+	}
+
+	aes_encrypt(aes, mac, mac);
+	n = (data_len - 1) / AES_BLOCK_SIZE;
+	aes_eax_omac_blocks(aes, mac, data, n);
+	aes_eax_omac_final(aes, k1, k2, mac, data + AES_BLOCK_SIZE * n,
+			   data_len - AES_BLOCK_SIZE * n);
+}
+
+
+/*
+ * CTR encryption with counter N over data in place and C = OMAC^2_K(ciphertext)
+ * in a single pass; everything but the last (possibly partial) block goes
+ * through aes_encrypt_ctr_cbcmac()
+ */
+static void aes_eax_encrypt_mac(void *aes, const struct aes_bs_key *bk, const aes_uchar *k1,
+				const aes_uchar *k2, const aes_uchar *N,
+				aes_uchar *data, size_t data_len, aes_uchar *mac)
+{
+	aes_uchar ctr[AES_BLOCK_SIZE], s[AES_BLOCK_SIZE];
+	size_t i, n, last;
+
+	if (data_len == 0) {
+		aes_eax_omac(aes, k1, k2, 2, data, 0, mac);
+		return;
+	}
+
+	memset(mac, 0, AES_BLOCK_SIZE - 1);
+	mac[AES_BLOCK_SIZE - 1] = 2;
+	aes_encrypt(aes, mac, mac);
+
+	memcpy(ctr, N, AES_BLOCK_SIZE);
+	n = (data_len - 1) / AES_BLOCK_SIZE;
+	aes_encrypt_ctr_cbcmac(aes, bk, mac, ctr, data, n, data, 0);
+
+	data += AES_BLOCK_SIZE * n;
+	last = data_len - AES_BLOCK_SIZE * n;
+	aes_encrypt(aes, ctr, s);
+	for (i = 0; i < last; i++)
+		data[i] ^= s[i];
+	aes_eax_omac_final(aes, k1, k2, mac, data, last);
+}
+
+
+/* CTR decryption with counter N over data in place */
+static void aes_eax_decrypt_ctr(void *aes, const struct aes_bs_key *bk, const aes_uchar *N,
+				aes_uchar *data, size_t data_len)
+{
+	aes_uchar ctr[AES_BLOCK_SIZE], s[AES_BLOCK_SIZE];
+	size_t i, n = data_len / AES_BLOCK_SIZE, last = data_len % AES_BLOCK_SIZE;
+
+	memcpy(ctr, N, AES_BLOCK_SIZE);
+	aes_encrypt_ctr128_bs(aes, bk, ctr, data, n, data);
+	if (last) {
+		data += AES_BLOCK_SIZE * n;
+		aes_encrypt(aes, ctr, s);
+		for (i = 0; i < last; i++)
+			data[i] ^= s[i];
+	}
+}
+
+
+static void aes_eax_seal_key(const struct aes_key *key, const struct aes_bs_key *bk,
+			     const aes_uchar *k1, const aes_uchar *k2,
+			     const aes_uchar *nonce, size_t nonce_len,
+			     const aes_uchar *hdr, size_t hdr_len,
+			     aes_uchar *data, size_t data_len, aes_uchar *tag)
+{
+	void *aes = (void *) key;
+	aes_uchar nonce_mac[AES_BLOCK_SIZE], hdr_mac[AES_BLOCK_SIZE],
+		data_mac[AES_BLOCK_SIZE];
+	int i;
+
+	aes_eax_omac(aes, k1, k2, 0, nonce, nonce_len, nonce_mac);
+	aes_eax_omac(aes, k1, k2, 1, hdr, hdr_len, hdr_mac);
+	aes_eax_encrypt_mac(aes, bk, k1, k2, nonce_mac, data, data_len, data_mac);
+
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		tag[i] = nonce_mac[i] ^ data_mac[i] ^ hdr_mac[i];
+}
+
+
+static int aes_eax_open_key(const struct aes_key *key, const struct aes_bs_key *bk,
+			    const aes_uchar *k1, const aes_uchar *k2,
+			    const aes_uchar *nonce, size_t nonce_len,
+			    const aes_uchar *hdr, size_t hdr_len,
+			    aes_uchar *data, size_t data_len, const aes_uchar *tag)
+{
+	void *aes = (void *) key;
+	aes_uchar nonce_mac[AES_BLOCK_SIZE], hdr_mac[AES_BLOCK_SIZE],
+		data_mac[AES_BLOCK_SIZE], diff = 0;
+	int i;
+
+	/* authenticate the ciphertext first; data is only decrypted if it is genuine */
+	aes_eax_omac(aes, k1, k2, 0, nonce, nonce_len, nonce_mac);
+	aes_eax_omac(aes, k1, k2, 1, hdr, hdr_len, hdr_mac);
+	aes_eax_omac(aes, k1, k2, 2, data, data_len, data_mac);
+
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		diff |= tag[i] ^ nonce_mac[i] ^ data_mac[i] ^ hdr_mac[i];
+	if (diff)
+		return -2;
+
+	aes_eax_decrypt_ctr(aes, bk, nonce_mac, data, data_len);
+	return 0;
+}
+
+
 /**
- * aes_128_eax_encrypt - AES-128 EAX mode encryption
- * @key: Key for encryption (16 bytes)
+ * aes_eax_encrypt - AES EAX mode encryption with an expanded key
+ * @key: Encryption key schedule from aes_encrypt_key_init()
  * @nonce: Nonce for counter mode
  * @nonce_len: Nonce length in bytes
  * @hdr: Header data to be authenticity protected
@@ -20,55 +170,128 @@
  * @data_len: Length of data in bytes
  * @tag: 16-byte tag value
  * Returns: 0 on success, -1 on failure
+ *
+ * The OMAC subkeys are derived for each call; use aes_eax_seal() with an
+ * aes_eax_ctx to derive them once per key.
  */
-int aes_128_eax_encrypt(const aes_uchar *key, const aes_uchar *nonce, size_t nonce_len,
-			const aes_uchar *hdr, size_t hdr_len,
-			aes_uchar *data, size_t data_len, aes_uchar *tag)
+int aes_eax_encrypt(const struct aes_key *key, const aes_uchar *nonce, size_t nonce_len,
+		    const aes_uchar *hdr, size_t hdr_len,
+		    aes_uchar *data, size_t data_len, aes_uchar *tag)
 {
-	aes_uchar *buf;
-	size_t buf_len;
-	aes_uchar nonce_mac[AES_BLOCK_SIZE], hdr_mac[AES_BLOCK_SIZE],
-		data_mac[AES_BLOCK_SIZE];
-	int i, ret = -1;
-
-	if (nonce_len > data_len)
-		buf_len = nonce_len;
-	else
-		buf_len = data_len;
-	if (hdr_len > buf_len)
-		buf_len = hdr_len;
-	buf_len += 16;
-
-	buf = malloc(buf_len);
-	if (buf == NULL)
+	aes_uchar k1[AES_BLOCK_SIZE], k2[AES_BLOCK_SIZE];
+
+	aes_omac1_subkeys((void *) key, k1, k2);
+	aes_eax_seal_key(key, NULL, k1, k2, nonce, nonce_len, hdr, hdr_len, data, data_len, tag);
+	return 0;
+}
+
+
+/**
+ * aes_eax_decrypt - AES EAX mode decryption with an expanded key
+ * @key: Encryption key schedule from aes_encrypt_key_init()
+ * @nonce: Nonce for counter mode
+ * @nonce_len: Nonce length in bytes
+ * @hdr: Header data to be authenticity protected
+ * @hdr_len: Length of the header data bytes
+ * @data: Data to encrypt in-place
+ * @data_len: Length of data in bytes
+ * @tag: 16-byte tag value
+ * Returns: 0 on success, -1 on failure, -2 if tag does not match
+ *
+ * The ciphertext is authenticated before it is decrypted, so data is left
+ * unchanged if the tag does not match.
+ */
+int aes_eax_decrypt(const struct aes_key *key, const aes_uchar *nonce, size_t nonce_len,
+		    const aes_uchar *hdr, size_t hdr_len,
+		    aes_uchar *data, size_t data_len, const aes_uchar *tag)
+{
+	aes_uchar k1[AES_BLOCK_SIZE], k2[AES_BLOCK_SIZE];
+
+	aes_omac1_subkeys((void *) key, k1, k2);
+	return aes_eax_open_key(key, NULL, k1, k2, nonce, nonce_len, hdr, hdr_len,
+				data, data_len, tag);
+}
+
+
+/**
+ * aes_eax_ctx_init - Expand an AES-EAX key and derive its OMAC subkeys
+ * @ctx: Key context to initialize (e.g., on the stack)
+ * @key: AES key
+ * @key_len: Length of the key in bytes (16, 24 or 32)
+ * Returns: 0 on success, -1 on failure
+ *
+ * Clear the context with aes_eax_ctx_clear() when it is no longer needed.
+ */
+int aes_eax_ctx_init(struct aes_eax_ctx *ctx, const aes_uchar *key, size_t key_len)
+{
+	if (aes_encrypt_key_init(&ctx->key, key, key_len) < 0)
 		return -1;
+	aes_omac1_subkeys(&ctx->key, ctx->k1, ctx->k2);
+	aes_ctr_bs_key_init(&ctx->bk, ctx->key.rk);
+	return 0;
+}
 
-	memset(buf, 0, 15);
 
-	buf[15] = 0;
-	memcpy(buf + 16, nonce, nonce_len);
-	if (omac1_aes_128(key, buf, 16 + nonce_len, nonce_mac))
-		goto fail;
+void aes_eax_ctx_clear(struct aes_eax_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+}
 
-	buf[15] = 1;
-	memcpy(buf + 16, hdr, hdr_len);
-	if (omac1_aes_128(key, buf, 16 + hdr_len, hdr_mac))
-		goto fail;
 
-	if (aes_128_ctr_encrypt(key, nonce_mac, data, data_len))
-		goto fail;
-	buf[15] = 2;
-	memcpy(buf + 16, data, data_len);
-	if (omac1_aes_128(key, buf, 16 + data_len, data_mac))
-		goto fail;
+/**
+ * aes_eax_seal - AES EAX mode encryption with a precomputed key context
+ * @ctx: Key context from aes_eax_ctx_init()
+ *
+ * The other parameters and the return value are as for aes_eax_encrypt().
+ */
+int aes_eax_seal(const struct aes_eax_ctx *ctx, const aes_uchar *nonce, size_t nonce_len,
+		 const aes_uchar *hdr, size_t hdr_len,
+		 aes_uchar *data, size_t data_len, aes_uchar *tag)
+{
+	aes_eax_seal_key(&ctx->key, &ctx->bk, ctx->k1, ctx->k2, nonce, nonce_len,
+			 hdr, hdr_len, data, data_len, tag);
+	return 0;
+}
 
-	for (i = 0; i < AES_BLOCK_SIZE; i++)
-		tag[i] = nonce_mac[i] ^ data_mac[i] ^ hdr_mac[i];
 
-	ret = 0;
-fail:
-	free(buf);
+/**
+ * aes_eax_open - AES EAX mode decryption with a precomputed key context
+ * @ctx: Key context from aes_eax_ctx_init()
+ *
+ * The other parameters and the return value are as for aes_eax_decrypt().
+ */
+int aes_eax_open(const struct aes_eax_ctx *ctx, const aes_uchar *nonce, size_t nonce_len,
+		 const aes_uchar *hdr, size_t hdr_len,
+		 aes_uchar *data, size_t data_len, const aes_uchar *tag)
+{
+	return aes_eax_open_key(&ctx->key, &ctx->bk, ctx->k1, ctx->k2, nonce, nonce_len,
+				hdr, hdr_len, data, data_len, tag);
+}
+
 
+/**
+ * aes_128_eax_encrypt - AES-128 EAX mode encryption
+ * @key: Key for encryption (16 bytes)
+ * @nonce: Nonce for counter mode
+ * @nonce_len: Nonce length in bytes
+ * @hdr: Header data to be authenticity protected
+ * @hdr_len: Length of the header data bytes
+ * @data: Data to encrypt in-place
+ * @data_len: Length of data in bytes
+ * @tag: 16-byte tag value
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_128_eax_encrypt(const aes_uchar *key, const aes_uchar *nonce, size_t nonce_len,
+			const aes_uchar *hdr, size_t hdr_len,
+			aes_uchar *data, size_t data_len, aes_uchar *tag)
+{
+	struct aes_key ctx;
+	int ret;
+
+	if (aes_encrypt_key_init(&ctx, key, 16) < 0)
+		return -1;
+	ret = aes_eax_encrypt(&ctx, nonce, nonce_len, hdr, hdr_len, data, data_len, tag);
+	aes_key_clear(&ctx);
 	return ret;
 }
 
@@ -89,53 +312,12 @@ int aes_128_eax_decrypt(const aes_uchar *key, const aes_uchar *nonce, size_t non
 			const aes_uchar *hdr, size_t hdr_len,
 			aes_uchar *data, size_t data_len, const aes_uchar *tag)
 {
-	aes_uchar *buf;
-	size_t buf_len;
-	aes_uchar nonce_mac[AES_BLOCK_SIZE], hdr_mac[AES_BLOCK_SIZE],
-		data_mac[AES_BLOCK_SIZE];
-	int i;
-
-	if (nonce_len > data_len)
-		buf_len = nonce_len;
-	else
-		buf_len = data_len;
-	if (hdr_len > buf_len)
-		buf_len = hdr_len;
-	buf_len += 16;
-
-	buf = malloc(buf_len);
-	if (buf == NULL)
-		return -1;
-
-	memset(buf, 0, 15);
+	struct aes_key ctx;
+	int ret;
 
-	buf[15] = 0;
-	memcpy(buf + 16, nonce, nonce_len);
-	if (omac1_aes_128(key, buf, 16 + nonce_len, nonce_mac)) {
-		free(buf);
+	if (aes_encrypt_key_init(&ctx, key, 16) < 0)
 		return -1;
-	}
-
-	buf[15] = 1;
-	memcpy(buf + 16, hdr, hdr_len);
-	if (omac1_aes_128(key, buf, 16 + hdr_len, hdr_mac)) {
-		free(buf);
-		return -1;
-	}
-
-	buf[15] = 2;
-	memcpy(buf + 16, data, data_len);
-	if (omac1_aes_128(key, buf, 16 + data_len, data_mac)) {
-		free(buf);
-		return -1;
-	}
-
-	free(buf);
-
-	for (i = 0; i < AES_BLOCK_SIZE; i++) {
-		if (tag[i] != (nonce_mac[i] ^ data_mac[i] ^ hdr_mac[i]))
-			return -2;
-	}
-
-	return aes_128_ctr_encrypt(key, nonce_mac, data, data_len);
+	ret = aes_eax_decrypt(&ctx, nonce, nonce_len, hdr, hdr_len, data, data_len, tag);
+	aes_key_clear(&ctx);
+	return ret;
 }
@@ -18,11 +18,10 @@
  */
 int aes_128_encrypt_block(const aes_uchar *key, const aes_uchar *in, aes_uchar *out)
 {
-	void *ctx;
-	ctx = aes_encrypt_init(key, 16);
-	if (ctx == NULL)
+	struct aes_key ctx;
+	if (aes_encrypt_key_init(&ctx, key, 16) < 0)
 		return -1;
-	aes_encrypt(ctx, in, out);
-	aes_encrypt_deinit(ctx);
+	aes_encrypt(&ctx, in, out);
+	aes_key_clear(&ctx);
 	return 0;
 }
@@ -0,0 +1,163 @@
+/*
+ * GHASH with PCLMULQDQ carry-less multiplication and stitched AES-GCM
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "aes.h"
+#include "aes-internal.h"
+
+#include "aes-x86.h"
+
+#ifdef AES_HAVE_X86_INTRIN
+
+/* Blocks per reduction; 8 blocks and their powers of H fit in 16 registers */
+#define GHASH_CLMUL_BLOCKS 8
+
+/**
+ * aes_ghash_clmul - GHASH full blocks using PCLMULQDQ
+ * @hk: GHASH key with the powers of H
+ * @x: Input blocks
+ * @nblocks: Number of 16 byte blocks in x
+ * @y: GHASH accumulator (Y_i), updated in place
+ *
+ * Y = (Y XOR X_1) * H^n XOR X_2 * H^(n-1) XOR ... XOR X_n * H, computed
+ * for n = GHASH_CLMUL_BLOCKS blocks at a time with a single reduction.
+ */
+AES_CLMUL_TARGET void aes_ghash_clmul(const struct aes_ghash_key *hk, const aes_uchar *x,
+				      size_t nblocks, aes_uchar *y)
+{
+	const __m128i bswap = ghash_bswap_mask();
+	__m128i h[GHASH_CLMUL_BLOCKS], Y, lo, mid, hi;
+	size_t i, n;
+
+	for (i = 0; i < GHASH_CLMUL_BLOCKS; i++)
+		h[i] = ghash_load(hk->Hpow[i], bswap);
+	Y = ghash_load(y, bswap);
+
+	while (nblocks >= GHASH_CLMUL_BLOCKS) {
+		lo = mid = hi = _mm_setzero_si128();
+		ghash_clmul_acc(_mm_xor_si128(Y, ghash_load(x, bswap)),
+				h[GHASH_CLMUL_BLOCKS - 1], &lo, &mid, &hi);
+		for (i = 1; i < GHASH_CLMUL_BLOCKS; i++)
+			ghash_clmul_acc(ghash_load(x + 16 * i, bswap),
+					h[GHASH_CLMUL_BLOCKS - 1 - i], &lo, &mid, &hi);
+		Y = ghash_reduce(lo, mid, hi);
+		x += 16 * GHASH_CLMUL_BLOCKS;
+		nblocks -= GHASH_CLMUL_BLOCKS;
+	}
+
+	if (nblocks > 0) {
+		n = nblocks;
+		lo = mid = hi = _mm_setzero_si128();
+		ghash_clmul_acc(_mm_xor_si128(Y, ghash_load(x, bswap)),
+				h[n - 1], &lo, &mid, &hi);
+		for (i = 1; i < n; i++)
+			ghash_clmul_acc(ghash_load(x + 16 * i, bswap),
+					h[n - 1 - i], &lo, &mid, &hi);
+		Y = ghash_reduce(lo, mid, hi);
+	}
+
+	_mm_storeu_si128((__m128i *) y, _mm_shuffle_epi8(Y, bswap));
+}
+
+
+/*
+ * The counter block is kept byte reflected (i.e. as a little endian integer
+ * in the low lane) so that inc32 is a single 32-bit lane add. Up to
+ * GHASH_CLMUL_BLOCKS counter blocks are encrypted in parallel with the round
+ * keys held in registers, and the ciphertext is folded into GHASH straight
+ * from the registers with a single reduction per group.
+ */
+static inline AES_GCM_X86_TARGET void gcm_clmul_crypt_n(const __m128i *k, int Nr, const __m128i *h,
+							__m128i *ctr, __m128i *Y, const aes_uchar *in,
+							size_t n, aes_uchar *out, int encrypt)
+{
+	const __m128i bswap = ghash_bswap_mask();
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+	__m128i s[GHASH_CLMUL_BLOCKS], c, lo, mid, hi;
+	size_t i;
+	int r;
+
+	for (i = 0; i < n; i++) {
+		s[i] = _mm_xor_si128(_mm_shuffle_epi8(*ctr, bswap), k[0]);
+		*ctr = _mm_add_epi32(*ctr, one);
+	}
+
+	lo = mid = hi = _mm_setzero_si128();
+	if (!encrypt) {
+		/* GHASH over the ciphertext overlaps with the AES rounds */
+		for (i = 0; i < n; i++) {
+			c = ghash_load(in + 16 * i, bswap);
+			if (i == 0)
+				c = _mm_xor_si128(c, *Y);
+			ghash_clmul_acc(c, h[n - 1 - i], &lo, &mid, &hi);
+		}
+	}
+
+	for (r = 1; r < Nr; r++)
+		for (i = 0; i < n; i++)
+			s[i] = _mm_aesenc_si128(s[i], k[r]);
+
+	for (i = 0; i < n; i++) {
+		s[i] = _mm_aesenclast_si128(s[i], k[Nr]);
+		c = _mm_xor_si128(s[i], _mm_loadu_si128((const __m128i *) (in + 16 * i)));
+		_mm_storeu_si128((__m128i *) (out + 16 * i), c);
+		if (encrypt) {
+			c = _mm_shuffle_epi8(c, bswap);
+			if (i == 0)
+				c = _mm_xor_si128(c, *Y);
+			ghash_clmul_acc(c, h[n - 1 - i], &lo, &mid, &hi);
+		}
+	}
+
+	*Y = ghash_reduce(lo, mid, hi);
+}
+
+
+/**
+ * aes_gcm_clmul_crypt - Stitched GCTR and GHASH using AES-NI and PCLMULQDQ
+ * @rk: AES encryption key schedule
+ * @hk: GHASH key with the powers of H
+ * @cb: Counter block, advanced by nblocks
+ * @in: Input blocks
+ * @nblocks: Number of 16 byte blocks in in
+ * @out: Output blocks (may be the same buffer as in)
+ * @y: GHASH accumulator (Y_i), updated in place with the ciphertext
+ * @encrypt: 1 if in is plaintext, 0 if in is ciphertext
+ *
+ * Single pass over the data: each group of blocks is encrypted and hashed
+ * while it is still in registers.
+ */
+AES_GCM_X86_TARGET void aes_gcm_clmul_crypt(const aes_uint rk[], const struct aes_ghash_key *hk,
+					    aes_uchar *cb, const aes_uchar *in, size_t nblocks,
+					    aes_uchar *out, aes_uchar *y, int encrypt)
+{
+	const __m128i bswap = ghash_bswap_mask();
+	const __m128i rkswap = aes_ni_bswap32_mask();
+	const int Nr = rk[AES_PRIV_NR_POS];
+	__m128i k[15], h[GHASH_CLMUL_BLOCKS], ctr, Y;
+	int i;
+
+	for (i = 0; i <= Nr; i++)
+		k[i] = aes_ni_load_rk(rk + 4 * i, rkswap);
+	for (i = 0; i < GHASH_CLMUL_BLOCKS; i++)
+		h[i] = ghash_load(hk->Hpow[i], bswap);
+	ctr = ghash_load(cb, bswap);
+	Y = ghash_load(y, bswap);
+
+	while (nblocks >= GHASH_CLMUL_BLOCKS) {
+		gcm_clmul_crypt_n(k, Nr, h, &ctr, &Y, in, GHASH_CLMUL_BLOCKS, out, encrypt);
+		in += 16 * GHASH_CLMUL_BLOCKS;
+		out += 16 * GHASH_CLMUL_BLOCKS;
+		nblocks -= GHASH_CLMUL_BLOCKS;
+	}
+	if (nblocks > 0)
+		gcm_clmul_crypt_n(k, Nr, h, &ctr, &Y, in, nblocks, out, encrypt);
+
+	_mm_storeu_si128((__m128i *) y, _mm_shuffle_epi8(Y, bswap));
+	_mm_storeu_si128((__m128i *) cb, _mm_shuffle_epi8(ctr, bswap));
+}
+
+#endif /* AES_HAVE_X86_INTRIN */
@@ -29,7 +29,20 @@ const unsigned char t3_tag[] = {
     0x4d, 0x5c, 0x2a, 0xf3, 0x27, 0xcd, 0x64, 0xa6, 0x2c, 0xf3, 0x5a, 0xbd, 0x2b, 0xa6, 0xfa, 0xb4
 };
 
-int main(int argc, const char **argv)
+const unsigned char t4_aad[] = {
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xab, 0xad, 0xda, 0xd2
+};
+const unsigned char t4_tag[] = {
+    0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb, 0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47
+};
+#define t4_key t3_key
+#define t4_iv t3_iv
+#define t4_plain t3_plain
+#define t4_crypt t3_crypt
+#define t4_len 60
+
+static void test_t3(const char *backend)
 {
     int result;
     
@@ -47,11 +60,11 @@ int main(int argc, const char **argv)
                         t3_aad, sizeof(t3_aad),
                         crypt_buf, tag_buf);
     
-    aes_printf(MSG_INFO, "t3 aes_gcm encrypt result %s",
+    aes_printf(MSG_INFO, "t3 aes_gcm %s encrypt result %s", backend,
                result == 0 ? "PASS" : "FAIL");
-    aes_printf(MSG_INFO, "t3 aes_gcm encrypt crypt  %s",
+    aes_printf(MSG_INFO, "t3 aes_gcm %s encrypt crypt  %s", backend,
                (memcmp(t3_crypt, crypt_buf, sizeof(t3_crypt)) == 0) ? "PASS" : "FAIL");
-    aes_printf(MSG_INFO, "t3 aes_gcm encrypt tag    %s",
+    aes_printf(MSG_INFO, "t3 aes_gcm %s encrypt tag    %s", backend,
                (memcmp(t3_tag, tag_buf, sizeof(t3_tag)) == 0) ? "PASS" : "FAIL");
     
     result = aes_gcm_ad(t3_key, sizeof(t3_key),
@@ -60,14 +73,697 @@ int main(int argc, const char **argv)
                         t3_aad, sizeof(t3_aad),
                         tag_buf, plain_buf);
     
-    aes_printf(MSG_INFO, "t3 aes_gcm decrypt result %s",
+    aes_printf(MSG_INFO, "t3 aes_gcm %s decrypt result %s", backend,
                result == 0 ? "PASS" : "FAIL");
-    aes_printf(MSG_INFO, "t3 aes_gcm decrypt plain  %s",
+    aes_printf(MSG_INFO, "t3 aes_gcm %s decrypt plain  %s", backend,
                (memcmp(t3_plain, plain_buf, sizeof(t3_plain)) == 0) ? "PASS" : "FAIL");
     
     free(crypt_buf);
     free(plain_buf);
     free(tag_buf);
+}
+
+static void test_t3_ctx(const char *backend)
+{
+    int result;
+    struct aes_gcm_ctx *ctx;
+
+    unsigned char* crypt_buf = malloc(sizeof(t3_crypt));
+    unsigned char* plain_buf = malloc(sizeof(t3_plain));
+    unsigned char* tag_buf = malloc(sizeof(t3_tag));
+
+    memset(crypt_buf, 0, sizeof(t3_crypt));
+    memset(plain_buf, 0, sizeof(t3_plain));
+    memset(tag_buf, 0, sizeof(t3_tag));
+
+    ctx = aes_gcm_key_init(t3_key, sizeof(t3_key));
+    if (ctx == NULL) {
+        aes_printf(MSG_INFO, "t3 aes_gcm %s key     init   FAIL", backend);
+        free(crypt_buf);
+        free(plain_buf);
+        free(tag_buf);
+        return;
+    }
+
+    result = aes_gcm_seal(ctx, t3_iv, sizeof(t3_iv),
+                          t3_plain, sizeof(t3_plain),
+                          t3_aad, sizeof(t3_aad),
+                          crypt_buf, tag_buf);
+
+    aes_printf(MSG_INFO, "t3 aes_gcm %s seal    crypt  %s", backend,
+               (result == 0 && memcmp(t3_crypt, crypt_buf, sizeof(t3_crypt)) == 0) ? "PASS" : "FAIL");
+    aes_printf(MSG_INFO, "t3 aes_gcm %s seal    tag    %s", backend,
+               (memcmp(t3_tag, tag_buf, sizeof(t3_tag)) == 0) ? "PASS" : "FAIL");
+
+    result = aes_gcm_open(ctx, t3_iv, sizeof(t3_iv),
+                          t3_crypt, sizeof(t3_crypt),
+                          t3_aad, sizeof(t3_aad),
+                          tag_buf, plain_buf);
+
+    aes_printf(MSG_INFO, "t3 aes_gcm %s open    plain  %s", backend,
+               (result == 0 && memcmp(t3_plain, plain_buf, sizeof(t3_plain)) == 0) ? "PASS" : "FAIL");
+
+    tag_buf[0] ^= 0x01;
+    result = aes_gcm_open(ctx, t3_iv, sizeof(t3_iv),
+                          t3_crypt, sizeof(t3_crypt),
+                          t3_aad, sizeof(t3_aad),
+                          tag_buf, plain_buf);
+
+    aes_printf(MSG_INFO, "t3 aes_gcm %s open    badtag %s", backend,
+               result != 0 ? "PASS" : "FAIL");
+
+    aes_gcm_key_free(ctx);
+    free(crypt_buf);
+    free(plain_buf);
+    free(tag_buf);
+}
+
+static void test_t3_stack_ctx(const char *backend)
+{
+    int result;
+    struct aes_gcm_ctx ctx;
+    unsigned char crypt_buf[sizeof(t3_crypt)];
+    unsigned char plain_buf[sizeof(t3_plain)];
+    unsigned char tag_buf[sizeof(t3_tag)];
+
+    result = aes_gcm_ctx_init(&ctx, t3_key, sizeof(t3_key));
+    result |= aes_gcm_seal(&ctx, t3_iv, sizeof(t3_iv),
+                           t3_plain, sizeof(t3_plain),
+                           t3_aad, sizeof(t3_aad),
+                           crypt_buf, tag_buf);
+
+    aes_printf(MSG_INFO, "t3 aes_gcm %s stack   seal   %s", backend,
+               (result == 0 && memcmp(t3_crypt, crypt_buf, sizeof(t3_crypt)) == 0 &&
+                memcmp(t3_tag, tag_buf, sizeof(t3_tag)) == 0) ? "PASS" : "FAIL");
+
+    result = aes_gcm_open(&ctx, t3_iv, sizeof(t3_iv),
+                          t3_crypt, sizeof(t3_crypt),
+                          t3_aad, sizeof(t3_aad),
+                          tag_buf, plain_buf);
+
+    aes_printf(MSG_INFO, "t3 aes_gcm %s stack   open   %s", backend,
+               (result == 0 && memcmp(t3_plain, plain_buf, sizeof(t3_plain)) == 0) ? "PASS" : "FAIL");
+
+    aes_gcm_ctx_clear(&ctx);
+}
+
+static void test_t4_stream(const char *backend)
+{
+    static const size_t chunks[] = { 1, 7, 16, 3, 33 };
+    int result = 0;
+    size_t i, off, len;
+    struct aes_gcm_ctx *ctx;
+    struct aes_gcm_stream st;
+
+    unsigned char* crypt_buf = malloc(t4_len);
+    unsigned char* plain_buf = malloc(t4_len);
+    unsigned char* tag_buf = malloc(sizeof(t4_tag));
+
+    memset(crypt_buf, 0, t4_len);
+    memset(plain_buf, 0, t4_len);
+    memset(tag_buf, 0, sizeof(t4_tag));
+
+    ctx = aes_gcm_key_init(t4_key, sizeof(t4_key));
+
+    /* AAD in two parts, plaintext in uneven chunks */
+    result |= aes_gcm_stream_init(&st, ctx, t4_iv, sizeof(t4_iv));
+    result |= aes_gcm_aad_update(&st, t4_aad, 5);
+    result |= aes_gcm_aad_update(&st, t4_aad + 5, sizeof(t4_aad) - 5);
+    for (i = 0, off = 0; off < t4_len; i++, off += len) {
+        len = chunks[i % 5] < t4_len - off ? chunks[i % 5] : t4_len - off;
+        result |= aes_gcm_encrypt_update(&st, t4_plain + off, len, crypt_buf + off);
+    }
+    result |= aes_gcm_encrypt_final(&st, tag_buf);
+
+    aes_printf(MSG_INFO, "t4 aes_gcm %s stream  crypt  %s", backend,
+               (result == 0 && memcmp(t4_crypt, crypt_buf, t4_len) == 0) ? "PASS" : "FAIL");
+    aes_printf(MSG_INFO, "t4 aes_gcm %s stream  tag    %s", backend,
+               (memcmp(t4_tag, tag_buf, sizeof(t4_tag)) == 0) ? "PASS" : "FAIL");
+
+    result = aes_gcm_stream_init(&st, ctx, t4_iv, sizeof(t4_iv));
+    result |= aes_gcm_aad_update(&st, t4_aad, sizeof(t4_aad));
+    for (i = 0, off = 0; off < t4_len; i++, off += len) {
+        len = chunks[(i + 2) % 5] < t4_len - off ? chunks[(i + 2) % 5] : t4_len - off;
+        result |= aes_gcm_decrypt_update(&st, t4_crypt + off, len, plain_buf + off);
+    }
+    result |= aes_gcm_decrypt_final(&st, t4_tag);
+
+    aes_printf(MSG_INFO, "t4 aes_gcm %s stream  plain  %s", backend,
+               (result == 0 && memcmp(t4_plain, plain_buf, t4_len) == 0) ? "PASS" : "FAIL");
+
+    aes_gcm_key_free(ctx);
+    free(crypt_buf);
+    free(plain_buf);
+    free(tag_buf);
+}
+
+/*
+ * Long message (many 16 block groups plus a partial block) through every
+ * backend, checked against the portable code
+ */
+#define long_len 1357
+#define long_aad_len 301
+
+static void test_long_backends(void)
+{
+    static const int masks[] = {
+        AES_CPU_BITSLICE,
+        AES_CPU_AESNI,
+        AES_CPU_PCLMUL,
+        AES_CPU_AESNI | AES_CPU_PCLMUL,
+        ~0
+    };
+    int result;
+    size_t i, m;
+
+    unsigned char* plain = malloc(long_len);
+    unsigned char* aad = malloc(long_aad_len);
+    unsigned char* ref_crypt = malloc(long_len);
+    unsigned char* crypt_buf = malloc(long_len);
+    unsigned char ref_tag[16], tag_buf[16];
+
+    for (i = 0; i < long_len; i++)
+        plain[i] = (unsigned char) (i * 7 + 3);
+    for (i = 0; i < long_aad_len; i++)
+        aad[i] = (unsigned char) (i * 13 + 1);
+
+    aes_cpu_set_features(0);
+    result = aes_gcm_ae(t3_key, sizeof(t3_key), t3_iv, sizeof(t3_iv),
+                        plain, long_len, aad, long_aad_len, ref_crypt, ref_tag);
+
+    for (m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+        aes_cpu_set_features(masks[m]);
+        if (aes_cpu_features() == 0)
+            continue;
+
+        memcpy(crypt_buf, plain, long_len);
+        result |= aes_gcm_ae(t3_key, sizeof(t3_key), t3_iv, sizeof(t3_iv),
+                             crypt_buf, long_len, aad, long_aad_len, crypt_buf, tag_buf);
+        aes_printf(MSG_INFO, "long aes_gcm features %04x ae     %s", aes_cpu_features(),
+                   (result == 0 && memcmp(ref_crypt, crypt_buf, long_len) == 0 &&
+                    memcmp(ref_tag, tag_buf, 16) == 0) ? "PASS" : "FAIL");
+
+        result = aes_gcm_ad(t3_key, sizeof(t3_key), t3_iv, sizeof(t3_iv),
+                            crypt_buf, long_len, aad, long_aad_len, ref_tag, crypt_buf);
+        aes_printf(MSG_INFO, "long aes_gcm features %04x ad     %s", aes_cpu_features(),
+                   (result == 0 && memcmp(plain, crypt_buf, long_len) == 0) ? "PASS" : "FAIL");
+    }
+
+    aes_cpu_set_features(~0);
+    free(plain);
+    free(aad);
+    free(ref_crypt);
+    free(crypt_buf);
+}
+
+/* SP 800-38A F.2.2 CBC-AES128.Decrypt */
+const unsigned char cbc_key[] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+const unsigned char cbc_iv[] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+const unsigned char cbc_crypt[] = {
+    0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+    0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+    0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+    0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7
+};
+const unsigned char cbc_plain[] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+
+/* 1 MB plus a few blocks, enough to be split across threads */
+#define cbc_long_len (1024 * 1024 + 7 * 16)
+
+static void test_cbc(const char *backend)
+{
+    struct aes_key key;
+    unsigned char buf[sizeof(cbc_crypt)];
+    unsigned char* plain = malloc(cbc_long_len);
+    unsigned char* crypt_buf = malloc(cbc_long_len);
+    int result;
+    size_t i, len;
+
+    /* every length from 1 to 4 blocks, in place */
+    for (len = 16, result = 0; len <= sizeof(cbc_crypt); len += 16) {
+        memcpy(buf, cbc_crypt, len);
+        result |= aes_128_cbc_decrypt(cbc_key, cbc_iv, buf, len);
+        result |= memcmp(cbc_plain, buf, len) != 0;
+    }
+    aes_printf(MSG_INFO, "cbc %s decrypt        %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    for (i = 0; i < cbc_long_len; i++)
+        plain[i] = (unsigned char) (i * 7 + 3);
+    memcpy(crypt_buf, plain, cbc_long_len);
+    result = aes_128_cbc_encrypt(cbc_key, cbc_iv, crypt_buf, cbc_long_len);
+    result |= aes_decrypt_key_init(&key, cbc_key, sizeof(cbc_key));
+    result |= aes_cbc_decrypt_threads(&key, cbc_iv, crypt_buf, cbc_long_len, 4);
+    aes_printf(MSG_INFO, "cbc %s decrypt thread %s", backend,
+               (result == 0 && memcmp(plain, crypt_buf, cbc_long_len) == 0) ? "PASS" : "FAIL");
+
+    aes_key_clear(&key);
+    free(plain);
+    free(crypt_buf);
+}
+
+#define cbc_mb_jobs 20
+
+/* independent jobs with mixed key sizes and lengths against aes_cbc_encrypt */
+/*
+ * num_keys 1 gives every lane the same key size, 2 and 3 mix 128, 192 and
+ * 256 bit keys between the lanes
+ */
+static void test_cbc_mb(const char *backend, size_t num_keys)
+{
+    struct aes_key keys[3];
+    struct aes_cbc_job jobs[cbc_mb_jobs], *job;
+    struct aes_cbc_mb mb;
+    unsigned char key_bytes[32];
+    unsigned char* data[cbc_mb_jobs];
+    unsigned char* expect[cbc_mb_jobs];
+    int result = 0, done = 0;
+    size_t i, j;
+
+    for (i = 0; i < sizeof(key_bytes); i++)
+        key_bytes[i] = (unsigned char) (i * 13 + 1);
+    for (i = 0; i < num_keys; i++)
+        result |= aes_encrypt_key_init(&keys[i], key_bytes, 16 + 8 * i);
+
+    aes_cbc_mb_init(&mb);
+    for (i = 0; i < cbc_mb_jobs; i++) {
+        jobs[i].key = &keys[i % num_keys];
+        jobs[i].data_len = 16 * ((i * 37) % 23);
+        jobs[i].user_data = (void *) i;
+        data[i] = malloc(jobs[i].data_len + 1);
+        expect[i] = malloc(jobs[i].data_len + 1);
+        for (j = 0; j < jobs[i].data_len; j++)
+            data[i][j] = (unsigned char) (i * 31 + j);
+        for (j = 0; j < 16; j++)
+            jobs[i].iv[j] = (unsigned char) (i + j);
+        memcpy(expect[i], data[i], jobs[i].data_len);
+        result |= aes_cbc_encrypt(jobs[i].key, jobs[i].iv, expect[i], jobs[i].data_len);
+        jobs[i].data = data[i];
+
+        job = aes_cbc_mb_submit(&mb, &jobs[i]);
+        done += job != NULL;
+    }
+    while ((job = aes_cbc_mb_flush(&mb)) != NULL)
+        done++;
+
+    for (i = 0; i < cbc_mb_jobs; i++) {
+        result |= memcmp(data[i], expect[i], jobs[i].data_len) != 0;
+        if (jobs[i].data_len)
+            result |= memcmp(jobs[i].iv, expect[i] + jobs[i].data_len - 16, 16) != 0;
+        free(data[i]);
+        free(expect[i]);
+    }
+    aes_printf(MSG_INFO, "cbc %s multi-buffer %d key size%s %s", backend, (int) num_keys,
+               num_keys == 1 ? " " : "s", (result == 0 && done == cbc_mb_jobs) ? "PASS" : "FAIL");
+
+    for (i = 0; i < num_keys; i++)
+        aes_key_clear(&keys[i]);
+}
+
+/* RFC 3610 Packet Vector #1 */
+const unsigned char ccm_key[] = {
+    0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf
+};
+const unsigned char ccm_nonce[] = {
+    0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00, 0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5
+};
+const unsigned char ccm_aad[] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07
+};
+const unsigned char ccm_plain[] = {
+    0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+    0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e
+};
+const unsigned char ccm_crypt[] = {
+    0x58, 0x8c, 0x97, 0x9a, 0x61, 0xc6, 0x63, 0xd2, 0xf0, 0x66, 0xd0, 0xc2, 0xc0, 0xf9, 0x89, 0x80,
+    0x6d, 0x5f, 0x6b, 0x61, 0xda, 0xc3, 0x84
+};
+const unsigned char ccm_auth[] = {
+    0x17, 0xe8, 0xd1, 0x2c, 0xfd, 0xf9, 0x26, 0xe0
+};
+
+/* NIST SP 800-38C Example 4: K = 40..4f, N = 10..1c, A = 65536 bytes 00..ff repeated, P = 20..3f */
+const unsigned char ccm4_crypt[] = {
+    0x69, 0x91, 0x5d, 0xad, 0x1e, 0x84, 0xc6, 0x37, 0x6a, 0x68, 0xc2, 0x96, 0x7e, 0x4d, 0xab, 0x61,
+    0x5a, 0xe0, 0xfd, 0x1f, 0xae, 0xc4, 0x4c, 0xc4, 0x84, 0x82, 0x85, 0x29, 0x46, 0x3c, 0xcf, 0x72
+};
+const unsigned char ccm4_auth[] = {
+    0xb4, 0xac, 0x6b, 0xec, 0x93, 0xe8, 0x59, 0x8e, 0x7f, 0x0d, 0xad, 0xbc, 0xea, 0x5b
+};
+
+#define ccm_long_aad_len 70000
+#define ccm_long_len (4096 + 5)
+
+static void test_ccm(const char *backend)
+{
+    struct aes_key key;
+    unsigned char crypt_buf[sizeof(ccm4_crypt)], plain_buf[sizeof(ccm4_crypt)], auth[16];
+    unsigned char key4[16], nonce4[13], b[16];
+    unsigned char* aad = malloc(ccm_long_aad_len);
+    unsigned char* plain = malloc(ccm_long_len);
+    unsigned char* buf = malloc(ccm_long_len);
+    unsigned char* saved = malloc(ccm_long_len);
+    int result;
+    size_t i;
+
+    result = aes_ccm_ae(ccm_key, sizeof(ccm_key), ccm_nonce, sizeof(ccm_auth),
+                        ccm_plain, sizeof(ccm_plain), ccm_aad, sizeof(ccm_aad), crypt_buf, auth);
+    result |= memcmp(ccm_crypt, crypt_buf, sizeof(ccm_crypt)) != 0;
+    result |= memcmp(ccm_auth, auth, sizeof(ccm_auth)) != 0;
+    aes_printf(MSG_INFO, "ccm %s encrypt        %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    result = aes_ccm_ad(ccm_key, sizeof(ccm_key), ccm_nonce, sizeof(ccm_auth),
+                        ccm_crypt, sizeof(ccm_crypt), ccm_aad, sizeof(ccm_aad), ccm_auth, plain_buf);
+    result |= memcmp(ccm_plain, plain_buf, sizeof(ccm_plain)) != 0;
+    memcpy(auth, ccm_auth, sizeof(ccm_auth));
+    auth[0] ^= 1;
+    result |= aes_ccm_ad(ccm_key, sizeof(ccm_key), ccm_nonce, sizeof(ccm_auth),
+                         ccm_crypt, sizeof(ccm_crypt), ccm_aad, sizeof(ccm_aad), auth, plain_buf) == 0;
+    aes_printf(MSG_INFO, "ccm %s decrypt        %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    /* SP 800-38C Example 4: the 0xff 0xfe AAD length encoding */
+    for (i = 0; i < sizeof(key4); i++)
+        key4[i] = (unsigned char) (0x40 + i);
+    for (i = 0; i < sizeof(nonce4); i++)
+        nonce4[i] = (unsigned char) (0x10 + i);
+    for (i = 0; i < sizeof(plain_buf); i++)
+        plain_buf[i] = (unsigned char) (0x20 + i);
+    for (i = 0; i < 65536; i++)
+        aad[i] = (unsigned char) i;
+    result = aes_ccm_ae(key4, sizeof(key4), nonce4, sizeof(ccm4_auth),
+                        plain_buf, sizeof(plain_buf), aad, 65536, crypt_buf, auth);
+    result |= memcmp(ccm4_crypt, crypt_buf, sizeof(ccm4_crypt)) != 0;
+    result |= memcmp(ccm4_auth, auth, sizeof(ccm4_auth)) != 0;
+    memset(plain_buf, 0, sizeof(plain_buf));
+    result |= aes_ccm_ad(key4, sizeof(key4), nonce4, sizeof(ccm4_auth),
+                         ccm4_crypt, sizeof(ccm4_crypt), aad, 65536, ccm4_auth, plain_buf);
+    for (i = 0; i < sizeof(plain_buf); i++)
+        result |= plain_buf[i] != (unsigned char) (0x20 + i);
+    aes_printf(MSG_INFO, "ccm %s sp800-38c ex4  %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    /* l(a) encodings at their boundaries; 2^32 bytes of AAD is too much to MAC here */
+    result = aes_ccm_aad_hdr(b, 0xfeff) != 2 || b[0] != 0xfe || b[1] != 0xff;
+    result |= aes_ccm_aad_hdr(b, 0xff00) != 6 || memcmp(b, "\xff\xfe\x00\x00\xff\x00", 6) != 0;
+    result |= aes_ccm_aad_hdr(b, 0xffffffff) != 6 || memcmp(b, "\xff\xfe\xff\xff\xff\xff", 6) != 0;
+    if (sizeof(size_t) > 4)
+        result |= aes_ccm_aad_hdr(b, (size_t) 0xffffffff + 1) != 10 ||
+                  memcmp(b, "\xff\xff\x00\x00\x00\x01\x00\x00\x00\x00", 10) != 0;
+    aes_printf(MSG_INFO, "ccm %s aad length     %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    /* L=8 and an AAD length that needs the 0xff 0xfe encoding, in place */
+    for (i = 0; i < ccm_long_aad_len; i++)
+        aad[i] = (unsigned char) i;
+    for (i = 0; i < ccm_long_len; i++)
+        plain[i] = (unsigned char) (i * 5 + 1);
+    memcpy(buf, plain, ccm_long_len);
+    result = aes_encrypt_key_init(&key, cbc_key, sizeof(cbc_key));
+    result |= aes_ccm_seal(&key, ccm_nonce, 7, 16, buf, ccm_long_len, aad, ccm_long_aad_len, buf, auth);
+    memcpy(saved, buf, ccm_long_len);
+    result |= aes_ccm_open(&key, ccm_nonce, 7, 16, buf, ccm_long_len, aad, ccm_long_aad_len, auth, buf);
+    result |= memcmp(plain, buf, ccm_long_len) != 0;
+    /* the open decrypted buf in place: restore the ciphertext so that only the AAD differs */
+    memcpy(buf, saved, ccm_long_len);
+    aad[ccm_long_aad_len - 1] ^= 1;
+    result |= aes_ccm_open(&key, ccm_nonce, 7, 16, buf, ccm_long_len, aad, ccm_long_aad_len, auth, buf) == 0;
+    aes_printf(MSG_INFO, "ccm %s long aad       %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    aes_key_clear(&key);
+    free(aad);
+    free(plain);
+    free(buf);
+    free(saved);
+}
+
+/* EAX paper (Bellare, Rogaway, Wagner) test vectors 1, 3 and 10 */
+struct eax_vector {
+    size_t len;
+    unsigned char key[16], nonce[16], hdr[8];
+    unsigned char plain[18], crypt[18], tag[16];
+};
+
+const struct eax_vector eax_vectors[] = {
+    /* vector 1: no message */
+    { 0,
+      { 0x23, 0x39, 0x52, 0xde, 0xe4, 0xd5, 0xed, 0x5f, 0x9b, 0x9c, 0x6d, 0x6f, 0xf8, 0x0f, 0xf4, 0x78 },
+      { 0x62, 0xec, 0x67, 0xf9, 0xc3, 0xa4, 0xa4, 0x07, 0xfc, 0xb2, 0xa8, 0xc4, 0x90, 0x31, 0xa8, 0xb3 },
+      { 0x6b, 0xfb, 0x91, 0x4f, 0xd0, 0x7e, 0xae, 0x6b },
+      { 0 },
+      { 0 },
+      { 0xe0, 0x37, 0x83, 0x0e, 0x83, 0x89, 0xf2, 0x7b, 0x02, 0x5a, 0x2d, 0x65, 0x27, 0xe7, 0x9d, 0x01 } },
+    /* vector 3 */
+    { 5,
+      { 0x01, 0xf7, 0x4a, 0xd6, 0x40, 0x77, 0xf2, 0xe7, 0x04, 0xc0, 0xf6, 0x0a, 0xda, 0x3d, 0xd5, 0x23 },
+      { 0x70, 0xc3, 0xdb, 0x4f, 0x0d, 0x26, 0x36, 0x84, 0x00, 0xa1, 0x0e, 0xd0, 0x5d, 0x2b, 0xff, 0x5e },
+      { 0x23, 0x4a, 0x34, 0x63, 0xc1, 0x26, 0x4a, 0xc6 },
+      { 0x1a, 0x47, 0xcb, 0x49, 0x33 },
+      { 0xd8, 0x51, 0xd5, 0xba, 0xe0 },
+      { 0x3a, 0x59, 0xf2, 0x38, 0xa2, 0x3e, 0x39, 0x19, 0x9d, 0xc9, 0x26, 0x66, 0x26, 0xc4, 0x0f, 0x80 } },
+    /* vector 10: two blocks */
+    { 18,
+      { 0x5f, 0xff, 0x20, 0xca, 0xfa, 0xb1, 0x19, 0xca, 0x2f, 0xc7, 0x35, 0x49, 0xe2, 0x0f, 0x5b, 0x0d },
+      { 0xdd, 0xe5, 0x9b, 0x97, 0xd7, 0x22, 0x15, 0x6d, 0x4d, 0x9a, 0xff, 0x2b, 0xc7, 0x55, 0x98, 0x26 },
+      { 0x54, 0xb9, 0xf0, 0x4e, 0x6a, 0x09, 0x18, 0x9a },
+      { 0x1b, 0xda, 0x12, 0x2b, 0xce, 0x8a, 0x8d, 0xba, 0xf1, 0x87, 0x7d, 0x96, 0x2b, 0x85, 0x92, 0xdd, 0x2d, 0x56 },
+      { 0x2e, 0xc4, 0x7b, 0x2c, 0x49, 0x54, 0xa4, 0x89, 0xaf, 0xc7, 0xba, 0x48, 0x97, 0xed, 0xcd, 0xae, 0x8c, 0xc3 },
+      { 0x3b, 0x60, 0x45, 0x05, 0x99, 0xbd, 0x02, 0xc9, 0x63, 0x82, 0x90, 0x2a, 0xef, 0x7f, 0x83, 0x2a } }
+};
+
+/*
+ * Key 00..0f, a 33-byte nonce, a 40-byte header and a 67-byte message, all
+ * filled in by test_eax(); checked against OpenSSL CMAC and CTR
+ */
+const unsigned char eax_long_crypt[] = {
+    0x7a, 0x86, 0xf5, 0xf2, 0xff, 0x6d, 0x6a, 0xf2, 0xe0, 0x32, 0x2f, 0x4a, 0x54, 0x9b, 0xca, 0x95,
+    0x0c, 0x51, 0x89, 0x54, 0x5b, 0x15, 0xf3, 0xdb, 0x3c, 0x82, 0xa4, 0x87, 0x58, 0x02, 0x60, 0xe8,
+    0x45, 0xe2, 0xf1, 0x1b, 0xa9, 0x5a, 0x6d, 0x23, 0x8e, 0x39, 0x98, 0x57, 0x5f, 0x6a, 0x18, 0x4a,
+    0x06, 0x9a, 0x3b, 0x62, 0xbc, 0x9e, 0x31, 0x24, 0xdb, 0x15, 0x98, 0x81, 0x35, 0xec, 0xa4, 0x47,
+    0x19, 0x93, 0x98
+};
+const unsigned char eax_long_tag[] = {
+    0xd7, 0x76, 0xac, 0x6c, 0x1f, 0x4d, 0xe4, 0x16, 0x8d, 0xcc, 0x28, 0x33, 0x36, 0x07, 0xf5, 0xe9
+};
+
+static int test_eax_vector(const unsigned char *key, const unsigned char *nonce, size_t nonce_len,
+                           const unsigned char *hdr, size_t hdr_len, const unsigned char *plain,
+                           const unsigned char *crypt, size_t len, const unsigned char *expect_tag)
+{
+    unsigned char buf[128], tag[16];
+    int result;
+
+    memcpy(buf, plain, len);
+    result = aes_128_eax_encrypt(key, nonce, nonce_len, hdr, hdr_len, buf, len, tag);
+    result |= memcmp(crypt, buf, len) != 0;
+    result |= memcmp(expect_tag, tag, 16) != 0;
+    result |= aes_128_eax_decrypt(key, nonce, nonce_len, hdr, hdr_len, buf, len, tag);
+    result |= memcmp(plain, buf, len) != 0;
+    return result;
+}
+
+static void test_eax(const char *backend)
+{
+    const struct eax_vector *v;
+    struct aes_eax_ctx ctx;
+    unsigned char key[16], nonce[33], hdr[40], plain_buf[sizeof(eax_long_crypt)], tag[16];
+    unsigned char* plain = malloc(cbc_long_len);
+    unsigned char* crypt_buf = malloc(cbc_long_len);
+    unsigned char* saved = malloc(cbc_long_len);
+    int result = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(eax_vectors) / sizeof(eax_vectors[0]); i++) {
+        v = &eax_vectors[i];
+        result |= test_eax_vector(v->key, v->nonce, sizeof(v->nonce), v->hdr, sizeof(v->hdr),
+                                  v->plain, v->crypt, v->len, v->tag);
+    }
+    aes_printf(MSG_INFO, "eax %s encrypt        %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    /* nonce and header longer than a block, 5 block message */
+    for (i = 0; i < sizeof(key); i++)
+        key[i] = (unsigned char) i;
+    for (i = 0; i < sizeof(nonce); i++)
+        nonce[i] = (unsigned char) (i * 3);
+    for (i = 0; i < sizeof(hdr); i++)
+        hdr[i] = (unsigned char) (i * 7 + 1);
+    for (i = 0; i < sizeof(plain_buf); i++)
+        plain_buf[i] = (unsigned char) (i * 5 + 2);
+    result = test_eax_vector(key, nonce, sizeof(nonce), hdr, sizeof(hdr), plain_buf,
+                             eax_long_crypt, sizeof(eax_long_crypt), eax_long_tag);
+    aes_printf(MSG_INFO, "eax %s long nonce/hdr %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    /* key context; a bad tag leaves the ciphertext untouched */
+    for (i = 0; i < cbc_long_len; i++)
+        plain[i] = (unsigned char) (i * 11 + 5);
+    memcpy(crypt_buf, plain, cbc_long_len);
+    result = aes_eax_ctx_init(&ctx, cbc_key, sizeof(cbc_key));
+    result |= aes_eax_seal(&ctx, nonce, sizeof(nonce), hdr, sizeof(hdr),
+                           crypt_buf, cbc_long_len, tag);
+    memcpy(saved, crypt_buf, cbc_long_len);
+    tag[0] ^= 1;
+    result |= aes_eax_open(&ctx, nonce, sizeof(nonce), hdr, sizeof(hdr),
+                           crypt_buf, cbc_long_len, tag) != -2;
+    result |= memcmp(saved, crypt_buf, cbc_long_len) != 0;
+    tag[0] ^= 1;
+    result |= aes_eax_open(&ctx, nonce, sizeof(nonce), hdr, sizeof(hdr),
+                           crypt_buf, cbc_long_len, tag);
+    result |= memcmp(plain, crypt_buf, cbc_long_len) != 0;
+    /* no data: the tag covers only the nonce and header */
+    result |= aes_eax_seal(&ctx, nonce, sizeof(nonce), hdr, sizeof(hdr), crypt_buf, 0, tag);
+    result |= aes_eax_open(&ctx, nonce, sizeof(nonce), hdr, sizeof(hdr), crypt_buf, 0, tag);
+    tag[15] ^= 0x80;
+    result |= aes_eax_open(&ctx, nonce, sizeof(nonce), hdr, sizeof(hdr), crypt_buf, 0, tag) != -2;
+    aes_printf(MSG_INFO, "eax %s ctx            %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    aes_eax_ctx_clear(&ctx);
+    free(plain);
+    free(crypt_buf);
+    free(saved);
+}
+
+/* NIST SP 800-38B D.1 and D.3, messages are prefixes of cbc_plain */
+const unsigned char cmac_key256[] = {
+    0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae, 0xf0, 0x85, 0x7d, 0x77, 0x81,
+    0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61, 0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4
+};
+const unsigned char cmac_mac128[3][16] = {
+    { 0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28, 0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46 },
+    { 0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44, 0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c },
+    { 0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92, 0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe }
+};
+const unsigned char cmac_mac256[] = {
+    0xe1, 0x99, 0x21, 0x90, 0x54, 0x9f, 0x6e, 0xd5, 0x69, 0x6a, 0x2c, 0x05, 0x6c, 0x31, 0x54, 0x10
+};
+
+static void test_cmac(const char *backend)
+{
+    struct aes_cmac_ctx ctx128, ctx256;
+    struct aes_cmac_stream st;
+    const struct aes_cmac_ctx *ctx[4] = { &ctx128, &ctx128, &ctx128, &ctx256 };
+    const unsigned char *data[4] = { cbc_plain, cbc_plain, cbc_plain, cbc_plain };
+    const size_t len[4] = { 0, 16, 64, 64 };
+    unsigned char mac_buf[4][16], *mac[4];
+    const struct aes_cmac_ctx *multi_ctx[11];
+    const unsigned char *multi_data[11];
+    const size_t multi_lens[11] = { 0, 1, 15, 16, 17, 32, 33, 48, 47, 16, 53 };
+    size_t multi_len[11];
+    unsigned char multi_buf[11][16], *multi_mac[11];
+    int result;
+    size_t i;
+
+    result = aes_cmac_ctx_init(&ctx128, cbc_key, sizeof(cbc_key));
+    result |= aes_cmac_ctx_init(&ctx256, cmac_key256, sizeof(cmac_key256));
+    for (i = 0; i < 3; i++) {
+        result |= aes_cmac(&ctx128, cbc_plain, len[i], mac_buf[i]);
+        result |= memcmp(cmac_mac128[i], mac_buf[i], 16) != 0;
+    }
+    /* streamed in uneven chunks */
+    aes_cmac_init(&st, &ctx256);
+    aes_cmac_update(&st, cbc_plain, 5);
+    aes_cmac_update(&st, cbc_plain + 5, 27);
+    aes_cmac_update(&st, cbc_plain + 32, 32);
+    aes_cmac_final(&st, mac_buf[3]);
+    result |= memcmp(cmac_mac256, mac_buf[3], 16) != 0;
+    aes_printf(MSG_INFO, "cmac %s               %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    for (i = 0; i < 4; i++)
+        mac[i] = mac_buf[i];
+    memset(mac_buf, 0, sizeof(mac_buf));
+    aes_cmac_multi(ctx, 4, data, len, mac);
+    for (i = 0, result = 0; i < 3; i++)
+        result |= memcmp(cmac_mac128[i], mac_buf[i], 16) != 0;
+    result |= memcmp(cmac_mac256, mac_buf[3], 16) != 0;
+    aes_printf(MSG_INFO, "cmac %s multi         %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    /*
+     * 11 messages, so a full group and a partial one; the first group has
+     * more than 4 AES-128 lanes and the lengths end on and off block edges
+     */
+    for (i = 0; i < 11; i++) {
+        multi_ctx[i] = i == 3 || i == 9 ? &ctx256 : &ctx128;
+        multi_data[i] = cbc_plain + i;
+        multi_len[i] = multi_lens[i];
+        multi_mac[i] = multi_buf[i];
+    }
+    aes_cmac_multi(multi_ctx, 11, multi_data, multi_len, multi_mac);
+    for (i = 0, result = 0; i < 11; i++) {
+        result |= aes_cmac(multi_ctx[i], multi_data[i], multi_len[i], mac_buf[0]);
+        result |= memcmp(mac_buf[0], multi_buf[i], 16) != 0;
+    }
+    aes_printf(MSG_INFO, "cmac %s multi lanes   %s", backend, result == 0 ? "PASS" : "FAIL");
+
+    aes_cmac_ctx_clear(&ctx128);
+    aes_cmac_ctx_clear(&ctx256);
+}
+
+static void test_omac1(const char *backend)
+{
+    struct aes_key key;
+    /* cbc_plain split across block edges, with empty elements in between */
+    const unsigned char *addr[5] = { cbc_plain, cbc_plain + 5, cbc_plain + 5, cbc_plain + 32, cbc_plain + 64 };
+    const size_t len[5] = { 5, 0, 27, 32, 0 };
+    const unsigned char *addr16[3] = { cbc_plain, cbc_plain, cbc_plain + 16 };
+    const size_t len16[3] = { 0, 16, 0 }, len0[2] = { 0, 0 };
+    unsigned char mac[16];
+    int result;
+    size_t i;
+
+    result = 0;
+    for (i = 0; i < 3; i++) {
+        result |= omac1_aes_128(cbc_key, cbc_plain, i == 0 ? 0 : 16 << (2 * i - 2), mac);
+        result |= memcmp(cmac_mac128[i], mac, 16) != 0;
+    }
+    result |= omac1_aes_128_vector(cbc_key, 5, addr, len, mac);
+    result |= memcmp(cmac_mac128[2], mac, 16) != 0;
+    result |= omac1_aes_128_vector(cbc_key, 3, addr16, len16, mac);
+    result |= memcmp(cmac_mac128[1], mac, 16) != 0;
+    result |= omac1_aes_128_vector(cbc_key, 2, addr16, len0, mac);
+    result |= memcmp(cmac_mac128[0], mac, 16) != 0;
+
+    result |= aes_encrypt_key_init(&key, cmac_key256, sizeof(cmac_key256));
+    result |= omac1_aes_vector(&key, 5, addr, len, mac);
+    result |= memcmp(cmac_mac256, mac, 16) != 0;
+    result |= omac1_aes(&key, cbc_plain, sizeof(cbc_plain), mac);
+    result |= memcmp(cmac_mac256, mac, 16) != 0;
+    aes_key_clear(&key);
+    aes_printf(MSG_INFO, "omac1 %s              %s", backend, result == 0 ? "PASS" : "FAIL");
+}
+
+static void test_backend(const char *backend)
+{
+    test_t3(backend);
+    test_t3_ctx(backend);
+    test_t3_stack_ctx(backend);
+    test_t4_stream(backend);
+    test_cbc(backend);
+    test_cbc_mb(backend, 1);
+    test_cbc_mb(backend, 2);
+    test_cbc_mb(backend, 3);
+    test_ccm(backend);
+    test_eax(backend);
+    test_cmac(backend);
+    test_omac1(backend);
+}
+
+int main(int argc, const char **argv)
+{
+    aes_cpu_set_features(0);
+    test_backend("ttable");
+
+    aes_cpu_set_features(AES_CPU_BITSLICE);
+    test_backend("bitslice");
+
+    aes_cpu_set_features(~0);
+    if ((aes_cpu_features() & ~AES_CPU_BITSLICE) != 0)
+        test_backend("hardware");
+
+    test_long_backends();
 
     return 0;
 }
@@ -0,0 +1,199 @@
+/*
+ * AES-GCM with VAES and VPCLMULQDQ (AVX-512)
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "aes.h"
+#include "aes-internal.h"
+
+#include "aes-x86.h"
+
+#ifdef AES_HAVE_X86_INTRIN
+
+#include <immintrin.h>
+
+/*
+ * Each 512-bit vector holds four blocks, one per 128-bit lane. VAES runs the
+ * AES round on all four lanes and VPCLMULQDQ multiplies each lane by its own
+ * power of H, so 16 blocks are encrypted and hashed per iteration with a
+ * single reduction. Fewer than 16 remaining blocks go to the 128-bit code.
+ */
+
+#define AES_VAES_TARGET AES_TARGET("avx512f,avx512bw,vaes,vpclmulqdq,aes,pclmul,ssse3")
+
+#define GHASH_VAES_BLOCKS 16
+
+static inline AES_VAES_TARGET __m512i ghash_vbswap_mask(void)
+{
+	return _mm512_broadcast_i32x4(ghash_bswap_mask());
+}
+
+
+/*
+ * hv[j] lane l = H^(16 - 4j - l), so that block i of the group is multiplied
+ * by H^(16 - i)
+ */
+static inline AES_VAES_TARGET void ghash_vload_powers(const struct aes_ghash_key *hk,
+						      __m512i bswap, __m512i *hv)
+{
+	__m512i t;
+	int j;
+
+	for (j = 0; j < 4; j++) {
+		t = _mm512_loadu_si512((const void *) hk->Hpow[GHASH_VAES_BLOCKS - 4 - 4 * j]);
+		t = _mm512_shuffle_i64x2(t, t, 0x1b);
+		hv[j] = _mm512_shuffle_epi8(t, bswap);
+	}
+}
+
+
+/* lo:mid:hi += a * b, lane by lane */
+static inline AES_VAES_TARGET void ghash_vclmul_acc(__m512i a, __m512i b,
+						    __m512i *lo, __m512i *mid, __m512i *hi)
+{
+	*lo = _mm512_xor_si512(*lo, _mm512_clmulepi64_epi128(a, b, 0x00));
+	*hi = _mm512_xor_si512(*hi, _mm512_clmulepi64_epi128(a, b, 0x11));
+	*mid = _mm512_ternarylogic_epi64(*mid, _mm512_clmulepi64_epi128(a, b, 0x10),
+					 _mm512_clmulepi64_epi128(a, b, 0x01), 0x96);
+}
+
+
+/* XOR of the four lanes */
+static inline AES_VAES_TARGET __m128i ghash_vsum(__m512i v)
+{
+	__m256i t = _mm256_xor_si256(_mm512_castsi512_si256(v), _mm512_extracti64x4_epi64(v, 1));
+	return _mm_xor_si128(_mm256_castsi256_si128(t), _mm256_extracti128_si256(t, 1));
+}
+
+
+/* Y = (Y XOR X_1) * H^16 XOR X_2 * H^15 XOR ... XOR X_16 * H */
+static inline AES_VAES_TARGET __m128i ghash_vfold(__m128i Y, const __m512i *x, const __m512i *hv)
+{
+	__m512i lo, mid, hi;
+	int j;
+
+	lo = mid = hi = _mm512_setzero_si512();
+	ghash_vclmul_acc(_mm512_xor_si512(x[0], _mm512_zextsi128_si512(Y)), hv[0], &lo, &mid, &hi);
+	for (j = 1; j < 4; j++)
+		ghash_vclmul_acc(x[j], hv[j], &lo, &mid, &hi);
+
+	return ghash_reduce(ghash_vsum(lo), ghash_vsum(mid), ghash_vsum(hi));
+}
+
+
+/**
+ * aes_ghash_vpclmul - GHASH full blocks using VPCLMULQDQ
+ * @hk: GHASH key with the powers of H
+ * @x: Input blocks
+ * @nblocks: Number of 16 byte blocks in x
+ * @y: GHASH accumulator (Y_i), updated in place
+ */
+AES_VAES_TARGET void aes_ghash_vpclmul(const struct aes_ghash_key *hk, const aes_uchar *x,
+				       size_t nblocks, aes_uchar *y)
+{
+	const __m512i bswap = ghash_vbswap_mask();
+	__m512i hv[4], v[4];
+	__m128i Y;
+	int j;
+
+	if (nblocks >= GHASH_VAES_BLOCKS) {
+		ghash_vload_powers(hk, bswap, hv);
+		Y = ghash_load(y, ghash_bswap_mask());
+
+		while (nblocks >= GHASH_VAES_BLOCKS) {
+			for (j = 0; j < 4; j++)
+				v[j] = _mm512_shuffle_epi8(_mm512_loadu_si512((const void *) (x + 64 * j)),
+							   bswap);
+			Y = ghash_vfold(Y, v, hv);
+			x += 16 * GHASH_VAES_BLOCKS;
+			nblocks -= GHASH_VAES_BLOCKS;
+		}
+
+		_mm_storeu_si128((__m128i *) y, _mm_shuffle_epi8(Y, ghash_bswap_mask()));
+	}
+
+	if (nblocks > 0)
+		aes_ghash_clmul(hk, x, nblocks, y);
+}
+
+
+/**
+ * aes_gcm_vaes_crypt - Stitched GCTR and GHASH using VAES and VPCLMULQDQ
+ * @rk: AES encryption key schedule
+ * @hk: GHASH key with the powers of H
+ * @cb: Counter block, advanced by nblocks
+ * @in: Input blocks
+ * @nblocks: Number of 16 byte blocks in in
+ * @out: Output blocks (may be the same buffer as in)
+ * @y: GHASH accumulator (Y_i), updated in place with the ciphertext
+ * @encrypt: 1 if in is plaintext, 0 if in is ciphertext
+ */
+AES_VAES_TARGET void aes_gcm_vaes_crypt(const aes_uint rk[], const struct aes_ghash_key *hk,
+					aes_uchar *cb, const aes_uchar *in, size_t nblocks,
+					aes_uchar *out, aes_uchar *y, int encrypt)
+{
+	const __m512i bswap = ghash_vbswap_mask();
+	const __m512i four = _mm512_broadcast_i32x4(_mm_set_epi32(0, 0, 0, 4));
+	const __m128i rkswap = aes_ni_bswap32_mask();
+	const int Nr = rk[AES_PRIV_NR_POS];
+	__m512i k[15], hv[4], s[4], x[4], c, ctr;
+	__m128i Y;
+	int i, j;
+
+	if (nblocks >= GHASH_VAES_BLOCKS) {
+		for (i = 0; i <= Nr; i++)
+			k[i] = _mm512_broadcast_i32x4(aes_ni_load_rk(rk + 4 * i, rkswap));
+		ghash_vload_powers(hk, bswap, hv);
+		Y = ghash_load(y, ghash_bswap_mask());
+
+		/* byte reflected counters cb + 0, cb + 1, cb + 2, cb + 3 */
+		ctr = _mm512_broadcast_i32x4(ghash_load(cb, ghash_bswap_mask()));
+		ctr = _mm512_add_epi32(ctr, _mm512_set_epi32(0, 0, 0, 3, 0, 0, 0, 2,
+							     0, 0, 0, 1, 0, 0, 0, 0));
+
+		while (nblocks >= GHASH_VAES_BLOCKS) {
+			for (j = 0; j < 4; j++) {
+				s[j] = _mm512_xor_si512(_mm512_shuffle_epi8(ctr, bswap), k[0]);
+				ctr = _mm512_add_epi32(ctr, four);
+			}
+
+			if (!encrypt) {
+				/* GHASH over the ciphertext overlaps with the AES rounds */
+				for (j = 0; j < 4; j++)
+					x[j] = _mm512_shuffle_epi8(
+						_mm512_loadu_si512((const void *) (in + 64 * j)), bswap);
+				Y = ghash_vfold(Y, x, hv);
+			}
+
+			for (i = 1; i < Nr; i++)
+				for (j = 0; j < 4; j++)
+					s[j] = _mm512_aesenc_epi128(s[j], k[i]);
+
+			for (j = 0; j < 4; j++) {
+				s[j] = _mm512_aesenclast_epi128(s[j], k[Nr]);
+				c = _mm512_xor_si512(s[j], _mm512_loadu_si512((const void *) (in + 64 * j)));
+				_mm512_storeu_si512((void *) (out + 64 * j), c);
+				if (encrypt)
+					x[j] = _mm512_shuffle_epi8(c, bswap);
+			}
+
+			if (encrypt)
+				Y = ghash_vfold(Y, x, hv);
+
+			in += 16 * GHASH_VAES_BLOCKS;
+			out += 16 * GHASH_VAES_BLOCKS;
+			nblocks -= GHASH_VAES_BLOCKS;
+		}
+
+		_mm_storeu_si128((__m128i *) y, _mm_shuffle_epi8(Y, ghash_bswap_mask()));
+		_mm_storeu_si128((__m128i *) cb, _mm_shuffle_epi8(_mm512_castsi512_si128(ctr),
+								  ghash_bswap_mask()));
+	}
+
+	if (nblocks > 0)
+		aes_gcm_clmul_crypt(rk, hk, cb, in, nblocks, out, y, encrypt);
+}
+
+#endif /* AES_HAVE_X86_INTRIN */
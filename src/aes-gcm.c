@@ -29,62 +29,128 @@ static void xor_block(aes_uchar *dst, const aes_uchar *src)
 }
 
 
-static void shift_right_block(aes_uchar *v)
+/*
+ * Reduction of the four bits shifted out of Z by gf_mult_4bit(), i.e.
+ * last4[i] = i * R >> 48 for R = 11100001 || 0^120 (bit reflected)
+ */
+static const aes_ulong last4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460,
+	0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560,
+	0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+
+/*
+ * Precompute the 4-bit (Shoup) table M[i] = i * H in GF(2^128), where the
+ * four bit index uses the GCM bit order, so HL[8]/HH[8] hold H itself.
+ */
+static void ghash_init_key(struct aes_ghash_key *hk)
 {
-	aes_uint val;
+	aes_ulong vh, vl, t;
+	int i, j;
 
-	val = AES_GET_BE32(v + 12);
-	val >>= 1;
-	if (v[11] & 0x01)
-		val |= 0x80000000;
-	AES_PUT_BE32(v + 12, val);
+	vh = AES_GET_BE64(hk->H);
+	vl = AES_GET_BE64(hk->H + 8);
+
+	hk->HH[0] = 0;
+	hk->HL[0] = 0;
+	hk->HH[8] = vh;
+	hk->HL[8] = vl;
+
+	/* M[4], M[2], M[1] = H * x, H * x^2, H * x^3 */
+	for (i = 4; i > 0; i >>= 1) {
+		t = (vl & 1) * 0xe1000000;
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ (t << 32);
+		hk->HH[i] = vh;
+		hk->HL[i] = vl;
+	}
+
+	/* M[i + j] = M[i] XOR M[j] */
+	for (i = 2; i <= 8; i *= 2) {
+		vh = hk->HH[i];
+		vl = hk->HL[i];
+		for (j = 1; j < i; j++) {
+			hk->HH[i + j] = vh ^ hk->HH[j];
+			hk->HL[i + j] = vl ^ hk->HL[j];
+		}
+	}
+}
 
-	val = AES_GET_BE32(v + 8);
-	val >>= 1;
-	if (v[7] & 0x01)
-		val |= 0x80000000;
-	AES_PUT_BE32(v + 8, val);
 
-	val = AES_GET_BE32(v + 4);
-	val >>= 1;
-	if (v[3] & 0x01)
-		val |= 0x80000000;
-	AES_PUT_BE32(v + 4, val);
+/* Multiplication in GF(2^128): z = x dot H, four bits at a time */
+static void gf_mult_4bit(const struct aes_ghash_key *hk, const aes_uchar *x, aes_uchar *z)
+{
+	aes_ulong zh, zl;
+	aes_uchar lo, hi, rem;
+	int i;
+
+	lo = x[15] & 0x0f;
+	zh = hk->HH[lo];
+	zl = hk->HL[lo];
+
+	for (i = 15; i >= 0; i--) {
+		lo = x[i] & 0x0f;
+		hi = x[i] >> 4;
+
+		if (i != 15) {
+			rem = zl & 0x0f;
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4) ^ (last4[rem] << 48);
+			zh ^= hk->HH[lo];
+			zl ^= hk->HL[lo];
+		}
 
-	val = AES_GET_BE32(v);
-	val >>= 1;
-	AES_PUT_BE32(v, val);
+		rem = zl & 0x0f;
+		zl = (zh << 60) | (zl >> 4);
+		zh = (zh >> 4) ^ (last4[rem] << 48);
+		zh ^= hk->HH[hi];
+		zl ^= hk->HL[hi];
+	}
+
+	AES_PUT_BE64(z, zh);
+	AES_PUT_BE64(z + 8, zl);
 }
 
 
-/* Multiplication in GF(2^128) */
-static void gf_mult(const aes_uchar *x, const aes_uchar *y, aes_uchar *z)
+/* Precompute H^1..H^16 for the aggregated (PCLMULQDQ/VPCLMULQDQ) GHASH */
+static void ghash_init_powers(struct aes_ghash_key *hk)
 {
-	aes_uchar v[16];
-	int i, j;
+	int i;
 
-	memset(z, 0, 16); /* Z_0 = 0^128 */
-	memcpy(v, y, 16); /* V_0 = Y */
-
-	for (i = 0; i < 16; i++) {
-		for (j = 0; j < 8; j++) {
-			if (x[i] & 1 << (7 - j)) {
-				/* Z_(i + 1) = Z_i XOR V_i */
-				xor_block(z, v);
-			} else {
-				/* Z_(i + 1) = Z_i */
-			}
-
-			if (v[15] & 0x01) {
-				/* V_(i + 1) = (V_i >> 1) XOR R */
-				shift_right_block(v);
-				/* R = 11100001 || 0^120 */
-				v[0] ^= 0xe1;
-			} else {
-				/* V_(i + 1) = V_i >> 1 */
-				shift_right_block(v);
-			}
-		}
+	memcpy(hk->Hpow[0], hk->H, 16);
+	for (i = 1; i < AES_GHASH_POWERS; i++)
+		gf_mult_4bit(hk, hk->Hpow[i - 1], hk->Hpow[i]);
+}
+
+
+static void ghash_blocks(const struct aes_ghash_key *hk, const aes_uchar *x, size_t nblocks,
+			 aes_uchar *y)
+{
+#ifdef AES_HAVE_X86_INTRIN
+	const int vector = AES_CPU_VAES | AES_CPU_PCLMUL;
+	int features = aes_cpu_features();
+
+	if ((features & vector) == vector) {
+		aes_ghash_vpclmul(hk, x, nblocks, y);
+		return;
+	}
+	if (features & AES_CPU_PCLMUL) {
+		aes_ghash_clmul(hk, x, nblocks, y);
+		return;
+	}
+#endif /* AES_HAVE_X86_INTRIN */
+
+	while (nblocks--) {
+		/* Y_i = (Y^(i-1) XOR X_i) dot H */
+		xor_block(y, x);
+		x += 16;
+
+		/* dot operation:
+		 * multiplication operation for binary Galois (finite) field of
+		 * 2^128 elements */
+		gf_mult_4bit(hk, y, y);
 	}
 }
 
@@ -96,25 +162,16 @@ static void ghash_start(aes_uchar *y)
 }
 
 
-static void ghash(const aes_uchar *h, const aes_uchar *x, size_t xlen, aes_uchar *y)
+static void ghash(const struct aes_ghash_key *hk, const aes_uchar *x, size_t xlen, aes_uchar *y)
 {
-	size_t m, i;
+	size_t m;
 	const aes_uchar *xpos = x;
 	aes_uchar tmp[16];
 
 	m = xlen / 16;
 
-	for (i = 0; i < m; i++) {
-		/* Y_i = (Y^(i-1) XOR X_i) dot H */
-		xor_block(y, xpos);
-		xpos += 16;
-
-		/* dot operation:
-		 * multiplication operation for binary Galois (finite) field of
-		 * 2^128 elements */
-		gf_mult(y, h, tmp);
-		memcpy(y, tmp, 16);
-	}
+	ghash_blocks(hk, xpos, m, y);
+	xpos += m * 16;
 
 	if (x + xlen > xpos) {
 		/* Add zero padded last block */
@@ -122,21 +179,26 @@ static void ghash(const aes_uchar *h, const aes_uchar *x, size_t xlen, aes_uchar
 		memcpy(tmp, xpos, last);
 		memset(tmp + last, 0, sizeof(tmp) - last);
 
-		/* Y_i = (Y^(i-1) XOR X_i) dot H */
-		xor_block(y, tmp);
-
-		/* dot operation:
-		 * multiplication operation for binary Galois (finite) field of
-		 * 2^128 elements */
-		gf_mult(y, h, tmp);
-		memcpy(y, tmp, 16);
+		ghash_blocks(hk, tmp, 1, y);
 	}
 
 	/* Return Y_m */
 }
 
 
-static void aes_gctr(void *aes, const aes_uchar *icb, const aes_uchar *x, size_t xlen, aes_uchar *y)
+/*
+ * Key stream block E_K(CB) for a partial block; advances cb. This goes
+ * through the counter mode code, which is constant time with AES_CPU_BITSLICE.
+ */
+static void aes_gcm_keystream(const struct aes_gcm_ctx *ctx, aes_uchar *cb, aes_uchar *ks)
+{
+	memset(ks, 0, AES_BLOCK_SIZE);
+	aes_encrypt_ctr32_bs((void *) &ctx->key, &ctx->bk, cb, ks, 1, ks);
+}
+
+
+static void aes_gctr(const struct aes_gcm_ctx *ctx, const aes_uchar *icb, const aes_uchar *x,
+		     size_t xlen, aes_uchar *y)
 {
 	size_t i, n, last;
 	aes_uchar cb[AES_BLOCK_SIZE], tmp[AES_BLOCK_SIZE];
@@ -149,42 +211,51 @@ static void aes_gctr(void *aes, const aes_uchar *icb, const aes_uchar *x, size_t
 	n = xlen / 16;
 
 	memcpy(cb, icb, AES_BLOCK_SIZE);
-	/* Full blocks */
-	for (i = 0; i < n; i++) {
-		aes_encrypt(aes, cb, ypos);
-		xor_block(ypos, xpos);
-		xpos += AES_BLOCK_SIZE;
-		ypos += AES_BLOCK_SIZE;
-		inc32(cb);
-	}
+	/* Full blocks, several counter blocks in flight */
+	aes_encrypt_ctr32_bs((void *) &ctx->key, &ctx->bk, cb, xpos, n, ypos);
+	xpos += n * AES_BLOCK_SIZE;
+	ypos += n * AES_BLOCK_SIZE;
 
 	last = x + xlen - xpos;
 	if (last) {
 		/* Last, partial block */
-		aes_encrypt(aes, cb, tmp);
+		aes_gcm_keystream(ctx, cb, tmp);
 		for (i = 0; i < last; i++)
 			*ypos++ = *xpos++ ^ tmp[i];
 	}
 }
 
 
-static void * aes_gcm_init_hash_subkey(const aes_uchar *key, size_t key_len, aes_uchar *H)
+/**
+ * aes_gcm_ctx_init - Expand an AES-GCM key into caller provided memory
+ * @ctx: Key context to initialize (e.g., on the stack)
+ * @key: AES key
+ * @key_len: Length of the key in bytes (16, 24 or 32)
+ * Returns: 0 on success, -1 on failure
+ *
+ * Clear the context with aes_gcm_ctx_clear() when it is no longer needed.
+ */
+int aes_gcm_ctx_init(struct aes_gcm_ctx *ctx, const aes_uchar *key, size_t key_len)
 {
-	void *aes;
+	struct aes_ghash_key *hk = &ctx->hk;
+	aes_uchar zero[AES_BLOCK_SIZE];
 
-	aes = aes_encrypt_init(key, key_len);
-	if (aes == NULL)
-		return NULL;
+	if (aes_encrypt_key_init(&ctx->key, key, key_len) < 0)
+		return -1;
+	aes_ctr_bs_key_init(&ctx->bk, ctx->key.rk);
 
 	/* Generate hash subkey H = AES_K(0^128) */
-	memset(H, 0, AES_BLOCK_SIZE);
-	aes_encrypt(aes, H, H);
-	aes_hexdump_key(MSG_EXCESSIVE, "Hash subkey H for GHASH", H, AES_BLOCK_SIZE);
-	return aes;
+	memset(zero, 0, AES_BLOCK_SIZE);
+	aes_gcm_keystream(ctx, zero, hk->H);
+	aes_hexdump_key(MSG_EXCESSIVE, "Hash subkey H for GHASH", hk->H, AES_BLOCK_SIZE);
+	ghash_init_key(hk);
+	ghash_init_powers(hk);
+	return 0;
 }
 
 
-static void aes_gcm_prepare_j0(const aes_uchar *iv, size_t iv_len, const aes_uchar *H, aes_uchar *J0)
+static void aes_gcm_prepare_j0(const aes_uchar *iv, size_t iv_len, const struct aes_ghash_key *hk,
+			       aes_uchar *J0)
 {
 	aes_uchar len_buf[16];
 
@@ -199,33 +270,162 @@ static void aes_gcm_prepare_j0(const aes_uchar *iv, size_t iv_len, const aes_uch
 		 * J_0 = GHASH_H(IV || 0^(s+64) || [len(IV)]_64)
 		 */
 		ghash_start(J0);
-		ghash(H, iv, iv_len, J0);
+		ghash(hk, iv, iv_len, J0);
 		AES_PUT_BE64(len_buf, 0);
 		AES_PUT_BE64(len_buf + 8, iv_len * 8);
-		ghash(H, len_buf, sizeof(len_buf), J0);
+		ghash(hk, len_buf, sizeof(len_buf), J0);
 	}
 }
 
 
-static void aes_gcm_gctr(void *aes, const aes_uchar *J0, const aes_uchar *in, size_t len,
-			 aes_uchar *out)
+/*
+ * Encrypt or decrypt full blocks with counter cb and add the ciphertext to the
+ * GHASH accumulator S in the same pass over the data; advances cb by nblocks.
+ */
+static void aes_gcm_crypt_blocks(const struct aes_gcm_ctx *ctx, aes_uchar *cb,
+				 const aes_uchar *in, size_t nblocks, aes_uchar *out,
+				 aes_uchar *S, int encrypt)
 {
-	aes_uchar J0inc[AES_BLOCK_SIZE];
+	void *aes = (void *) &ctx->key;
+	size_t n;
+
+#ifdef AES_HAVE_X86_INTRIN
+	const int stitched = AES_CPU_AESNI | AES_CPU_PCLMUL;
+	int features = aes_cpu_features();
 
-	if (len == 0)
+	if ((features & (stitched | AES_CPU_VAES)) == (stitched | AES_CPU_VAES)) {
+		aes_gcm_vaes_crypt(ctx->key.rk, &ctx->hk, cb, in, nblocks, out, S, encrypt);
 		return;
+	}
+	if ((features & stitched) == stitched) {
+		aes_gcm_clmul_crypt(ctx->key.rk, &ctx->hk, cb, in, nblocks, out, S, encrypt);
+		return;
+	}
+#endif /* AES_HAVE_X86_INTRIN */
+
+	/*
+	 * GHASH each group of AES_GHASH_POWERS blocks (16, matching the VAES
+	 * path) while it is still in cache
+	 */
+	while (nblocks) {
+		n = nblocks < AES_GHASH_POWERS ? nblocks : AES_GHASH_POWERS;
+		if (!encrypt)
+			ghash_blocks(&ctx->hk, in, n, S);
+		aes_encrypt_ctr32_bs(aes, &ctx->bk, cb, in, n, out);
+		if (encrypt)
+			ghash_blocks(&ctx->hk, out, n, S);
+		in += n * AES_BLOCK_SIZE;
+		out += n * AES_BLOCK_SIZE;
+		nblocks -= n;
+	}
+}
+
 
-	memcpy(J0inc, J0, AES_BLOCK_SIZE);
-	inc32(J0inc);
-	aes_gctr(aes, J0inc, in, len, out);
+/*
+ * Encrypt or decrypt up to one block with key stream ks and copy the
+ * ciphertext to buf (in and out may be the same buffer).
+ */
+static void aes_gcm_crypt_partial(const aes_uchar *ks, const aes_uchar *in, size_t len,
+				  aes_uchar *out, aes_uchar *buf, int encrypt)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		aes_uchar c = encrypt ? in[i] ^ ks[i] : in[i];
+		out[i] = in[i] ^ ks[i];
+		buf[i] = c;
+	}
 }
 
 
-static void aes_gcm_ghash(const aes_uchar *H, const aes_uchar *aad, size_t aad_len,
-			  const aes_uchar *crypt, size_t crypt_len, aes_uchar *S)
+/* out = GCTR_K(inc_32(J_0), in) and S = GHASH_H(S || C || 0^u) */
+static void aes_gcm_crypt(const struct aes_gcm_ctx *ctx, const aes_uchar *J0,
+			  const aes_uchar *in, size_t len, aes_uchar *out, aes_uchar *S,
+			  int encrypt)
+{
+	aes_uchar cb[AES_BLOCK_SIZE], ks[AES_BLOCK_SIZE], buf[AES_BLOCK_SIZE];
+	size_t n = len / AES_BLOCK_SIZE, last = len % AES_BLOCK_SIZE;
+
+	memcpy(cb, J0, AES_BLOCK_SIZE);
+	inc32(cb);
+	aes_gcm_crypt_blocks(ctx, cb, in, n, out, S, encrypt);
+
+	if (last) {
+		/* Last, partial block */
+		aes_gcm_keystream(ctx, cb, ks);
+		aes_gcm_crypt_partial(ks, in + n * AES_BLOCK_SIZE, last,
+				      out + n * AES_BLOCK_SIZE, buf, encrypt);
+		ghash(&ctx->hk, buf, last, S);
+	}
+}
+
+
+/* S = GHASH_H(S || [len(A)]64 || [len(C)]64) and T = GCTR_K(J_0, S) */
+static void aes_gcm_tag(const struct aes_gcm_ctx *ctx, const aes_uchar *J0,
+			aes_ulong aad_len, aes_ulong crypt_len, aes_uchar *S, aes_uchar *T)
 {
 	aes_uchar len_buf[16];
 
+	AES_PUT_BE64(len_buf, aad_len * 8);
+	AES_PUT_BE64(len_buf + 8, crypt_len * 8);
+	ghash(&ctx->hk, len_buf, sizeof(len_buf), S);
+
+	aes_hexdump_key(MSG_EXCESSIVE, "S = GHASH_H(...)", S, 16);
+
+	/* T = MSB_t(GCTR_K(J_0, S)) */
+	aes_gctr(ctx, J0, S, 16, T);
+}
+
+
+/**
+ * aes_gcm_key_init - Expand an AES-GCM key and precompute the GHASH key
+ * @key: AES key
+ * @key_len: Length of the key in bytes (16, 24 or 32)
+ * Returns: Key context for aes_gcm_seal()/aes_gcm_open() or %NULL on failure
+ *
+ * The context is read-only after initialization and may be shared by any
+ * number of messages (and threads) using the same key.
+ */
+struct aes_gcm_ctx * aes_gcm_key_init(const aes_uchar *key, size_t key_len)
+{
+	struct aes_gcm_ctx *ctx;
+
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL)
+		return NULL;
+	if (aes_gcm_ctx_init(ctx, key, key_len) < 0) {
+		aes_gcm_key_free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+
+void aes_gcm_key_free(struct aes_gcm_ctx *ctx)
+{
+	aes_gcm_ctx_clear(ctx);
+	free(ctx);
+}
+
+
+void aes_gcm_ctx_clear(struct aes_gcm_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+
+/**
+ * aes_gcm_seal - GCM-AE_K(IV, P, A) with a precomputed key context
+ */
+int aes_gcm_seal(const struct aes_gcm_ctx *ctx, const aes_uchar *iv, size_t iv_len,
+		 const aes_uchar *plain, size_t plain_len,
+		 const aes_uchar *aad, size_t aad_len, aes_uchar *crypt, aes_uchar *tag)
+{
+	aes_uchar J0[AES_BLOCK_SIZE];
+	aes_uchar S[16];
+
+	aes_gcm_prepare_j0(iv, iv_len, &ctx->hk, J0);
+
 	/*
 	 * u = 128 * ceil[len(C)/128] - len(C)
 	 * v = 128 * ceil[len(A)/128] - len(A)
@@ -233,77 +433,254 @@ static void aes_gcm_ghash(const aes_uchar *H, const aes_uchar *aad, size_t aad_l
 	 * (i.e., zero padded to block size A || C and lengths of each in bits)
 	 */
 	ghash_start(S);
-	ghash(H, aad, aad_len, S);
-	ghash(H, crypt, crypt_len, S);
-	AES_PUT_BE64(len_buf, aad_len * 8);
-	AES_PUT_BE64(len_buf + 8, crypt_len * 8);
-	ghash(H, len_buf, sizeof(len_buf), S);
+	ghash(&ctx->hk, aad, aad_len, S);
 
-	aes_hexdump_key(MSG_EXCESSIVE, "S = GHASH_H(...)", S, 16);
+	/* C = GCTR_K(inc_32(J_0), P), hashed in the same pass */
+	aes_gcm_crypt(ctx, J0, plain, plain_len, crypt, S, 1);
+
+	aes_gcm_tag(ctx, J0, aad_len, plain_len, S, tag);
+
+	/* Return (C, T) */
+
+	return 0;
 }
 
 
 /**
- * aes_gcm_ae - GCM-AE_K(IV, P, A)
+ * aes_gcm_open - GCM-AD_K(IV, C, A, T) with a precomputed key context
  */
-int aes_gcm_ae(const aes_uchar *key, size_t key_len, const aes_uchar *iv, size_t iv_len,
-	       const aes_uchar *plain, size_t plain_len,
-	       const aes_uchar *aad, size_t aad_len, aes_uchar *crypt, aes_uchar *tag)
+int aes_gcm_open(const struct aes_gcm_ctx *ctx, const aes_uchar *iv, size_t iv_len,
+		 const aes_uchar *crypt, size_t crypt_len,
+		 const aes_uchar *aad, size_t aad_len, const aes_uchar *tag, aes_uchar *plain)
 {
-	aes_uchar H[AES_BLOCK_SIZE];
 	aes_uchar J0[AES_BLOCK_SIZE];
-	aes_uchar S[16];
-	void *aes;
+	aes_uchar S[16], T[16];
+
+	aes_gcm_prepare_j0(iv, iv_len, &ctx->hk, J0);
+
+	ghash_start(S);
+	ghash(&ctx->hk, aad, aad_len, S);
+
+	/* P = GCTR_K(inc_32(J_0), C), hashed in the same pass */
+	aes_gcm_crypt(ctx, J0, crypt, crypt_len, plain, S, 0);
+
+	/* T' = MSB_t(GCTR_K(J_0, S)) */
+	aes_gcm_tag(ctx, J0, aad_len, crypt_len, S, T);
 
-	aes = aes_gcm_init_hash_subkey(key, key_len, H);
-	if (aes == NULL)
+	if (memcmp(tag, T, 16) != 0) {
+		aes_printf(MSG_EXCESSIVE, "GCM: Tag mismatch");
 		return -1;
+	}
 
-	aes_gcm_prepare_j0(iv, iv_len, H, J0);
+	return 0;
+}
 
-	/* C = GCTR_K(inc_32(J_0), P) */
-	aes_gcm_gctr(aes, J0, plain, plain_len, crypt);
 
-	aes_gcm_ghash(H, aad, aad_len, crypt, plain_len, S);
+/* Streaming GCM: AAD first, then data, then the tag */
 
-	/* T = MSB_t(GCTR_K(J_0, S)) */
-	aes_gctr(aes, J0, S, sizeof(S), tag);
+#define AES_GCM_STREAM_AAD	0
+#define AES_GCM_STREAM_DATA	1
 
-	/* Return (C, T) */
+/* len(P) <= 2^39 - 256 bits, i.e. the 32-bit counter must not wrap */
+#define AES_GCM_MAX_CRYPT_LEN	((((aes_ulong) 1 << 32) - 2) * AES_BLOCK_SIZE)
 
-	aes_encrypt_deinit(aes);
+
+/**
+ * aes_gcm_stream_init - Start an incremental GCM message
+ * @st: Message state
+ * @ctx: Key context from aes_gcm_key_init(); must outlive the message
+ * @iv: Initialization vector
+ * @iv_len: Length of the IV in bytes
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_gcm_stream_init(struct aes_gcm_stream *st, const struct aes_gcm_ctx *ctx,
+			const aes_uchar *iv, size_t iv_len)
+{
+	if (iv_len == 0)
+		return -1;
+
+	memset(st, 0, sizeof(*st));
+	st->ctx = ctx;
+	aes_gcm_prepare_j0(iv, iv_len, &ctx->hk, st->J0);
+	memcpy(st->cb, st->J0, AES_BLOCK_SIZE);
+	inc32(st->cb);
+	ghash_start(st->S);
+	st->state = AES_GCM_STREAM_AAD;
 
 	return 0;
 }
 
 
 /**
- * aes_gcm_ad - GCM-AD_K(IV, C, A, T)
+ * aes_gcm_aad_update - Add additional authenticated data
+ * Returns: 0 on success, -1 if data has already been processed
+ *
+ * May be called any number of times with arbitrary lengths before the first
+ * call to aes_gcm_encrypt_update()/aes_gcm_decrypt_update().
  */
-int aes_gcm_ad(const aes_uchar *key, size_t key_len, const aes_uchar *iv, size_t iv_len,
-	       const aes_uchar *crypt, size_t crypt_len,
-	       const aes_uchar *aad, size_t aad_len, const aes_uchar *tag, aes_uchar *plain)
+int aes_gcm_aad_update(struct aes_gcm_stream *st, const aes_uchar *aad, size_t aad_len)
 {
-	aes_uchar H[AES_BLOCK_SIZE];
-	aes_uchar J0[AES_BLOCK_SIZE];
-	aes_uchar S[16], T[16];
-	void *aes;
+	const struct aes_ghash_key *hk = &st->ctx->hk;
+	size_t n;
 
-	aes = aes_gcm_init_hash_subkey(key, key_len, H);
-	if (aes == NULL)
+	if (st->state != AES_GCM_STREAM_AAD)
 		return -1;
 
-	aes_gcm_prepare_j0(iv, iv_len, H, J0);
+	st->aad_len += aad_len;
+
+	if (st->buf_len) {
+		n = AES_BLOCK_SIZE - st->buf_len;
+		if (n > aad_len)
+			n = aad_len;
+		memcpy(st->buf + st->buf_len, aad, n);
+		st->buf_len += n;
+		aad += n;
+		aad_len -= n;
+		if (st->buf_len < AES_BLOCK_SIZE)
+			return 0;
+		ghash_blocks(hk, st->buf, 1, st->S);
+		st->buf_len = 0;
+	}
 
-	/* P = GCTR_K(inc_32(J_0), C) */
-	aes_gcm_gctr(aes, J0, crypt, crypt_len, plain);
+	n = aad_len / AES_BLOCK_SIZE;
+	ghash_blocks(hk, aad, n, st->S);
+	aad += n * AES_BLOCK_SIZE;
+	aad_len -= n * AES_BLOCK_SIZE;
 
-	aes_gcm_ghash(H, aad, aad_len, crypt, crypt_len, S);
+	memcpy(st->buf, aad, aad_len);
+	st->buf_len = aad_len;
 
-	/* T' = MSB_t(GCTR_K(J_0, S)) */
-	aes_gctr(aes, J0, S, sizeof(S), T);
+	return 0;
+}
+
+
+static void aes_gcm_stream_start_data(struct aes_gcm_stream *st)
+{
+	if (st->state != AES_GCM_STREAM_AAD)
+		return;
+
+	/* A || 0^v */
+	if (st->buf_len)
+		ghash(&st->ctx->hk, st->buf, st->buf_len, st->S);
+	st->buf_len = 0;
+	st->state = AES_GCM_STREAM_DATA;
+}
 
-	aes_encrypt_deinit(aes);
+
+static int aes_gcm_stream_crypt(struct aes_gcm_stream *st, const aes_uchar *in, size_t len,
+				aes_uchar *out, int encrypt)
+{
+	const struct aes_ghash_key *hk = &st->ctx->hk;
+	size_t n;
+
+	if (len > AES_GCM_MAX_CRYPT_LEN - st->crypt_len)
+		return -1;
+
+	aes_gcm_stream_start_data(st);
+	st->crypt_len += len;
+
+	/* Finish the partial block left by the previous call */
+	if (st->buf_len) {
+		n = AES_BLOCK_SIZE - st->buf_len;
+		if (n > len)
+			n = len;
+		aes_gcm_crypt_partial(st->ks + st->buf_len, in, n, out, st->buf + st->buf_len,
+				      encrypt);
+		st->buf_len += n;
+		in += n;
+		out += n;
+		len -= n;
+		if (st->buf_len < AES_BLOCK_SIZE)
+			return 0;
+		ghash_blocks(hk, st->buf, 1, st->S);
+		st->buf_len = 0;
+	}
+
+	/* Full blocks; GHASH is always over the ciphertext */
+	n = len / AES_BLOCK_SIZE;
+	if (n) {
+		aes_gcm_crypt_blocks(st->ctx, st->cb, in, n, out, st->S, encrypt);
+		in += n * AES_BLOCK_SIZE;
+		out += n * AES_BLOCK_SIZE;
+		len -= n * AES_BLOCK_SIZE;
+	}
+
+	/* Start of a new partial block; keep the key stream for the next call */
+	if (len) {
+		aes_gcm_keystream(st->ctx, st->cb, st->ks);
+		aes_gcm_crypt_partial(st->ks, in, len, out, st->buf, encrypt);
+		st->buf_len = len;
+	}
+
+	return 0;
+}
+
+
+/**
+ * aes_gcm_encrypt_update - Encrypt the next part of the plaintext
+ * Returns: 0 on success, -1 on failure
+ *
+ * May be called any number of times with arbitrary lengths; crypt may be the
+ * same buffer as plain.
+ */
+int aes_gcm_encrypt_update(struct aes_gcm_stream *st, const aes_uchar *plain, size_t plain_len,
+			   aes_uchar *crypt)
+{
+	return aes_gcm_stream_crypt(st, plain, plain_len, crypt, 1);
+}
+
+
+/**
+ * aes_gcm_decrypt_update - Decrypt the next part of the ciphertext
+ * Returns: 0 on success, -1 on failure
+ *
+ * The plaintext is released before the tag is verified; callers must not act
+ * on it until aes_gcm_decrypt_final() has succeeded.
+ */
+int aes_gcm_decrypt_update(struct aes_gcm_stream *st, const aes_uchar *crypt, size_t crypt_len,
+			   aes_uchar *plain)
+{
+	return aes_gcm_stream_crypt(st, crypt, crypt_len, plain, 0);
+}
+
+
+static void aes_gcm_stream_tag(struct aes_gcm_stream *st, aes_uchar *T)
+{
+	aes_gcm_stream_start_data(st);
+
+	/* C || 0^u */
+	if (st->buf_len)
+		ghash(&st->ctx->hk, st->buf, st->buf_len, st->S);
+
+	aes_gcm_tag(st->ctx, st->J0, st->aad_len, st->crypt_len, st->S, T);
+}
+
+
+/**
+ * aes_gcm_encrypt_final - Finish an incremental encryption
+ * @tag: Buffer for the 16 byte tag
+ * Returns: 0 on success
+ */
+int aes_gcm_encrypt_final(struct aes_gcm_stream *st, aes_uchar *tag)
+{
+	aes_gcm_stream_tag(st, tag);
+	memset(st, 0, sizeof(*st));
+
+	return 0;
+}
+
+
+/**
+ * aes_gcm_decrypt_final - Finish an incremental decryption
+ * @tag: Expected 16 byte tag
+ * Returns: 0 on success, -1 on tag mismatch
+ */
+int aes_gcm_decrypt_final(struct aes_gcm_stream *st, const aes_uchar *tag)
+{
+	aes_uchar T[16];
+
+	aes_gcm_stream_tag(st, T);
+	memset(st, 0, sizeof(*st));
 
 	if (memcmp(tag, T, 16) != 0) {
 		aes_printf(MSG_EXCESSIVE, "GCM: Tag mismatch");
@@ -314,6 +691,48 @@ int aes_gcm_ad(const aes_uchar *key, size_t key_len, const aes_uchar *iv, size_t
 }
 
 
+/**
+ * aes_gcm_ae - GCM-AE_K(IV, P, A)
+ */
+int aes_gcm_ae(const aes_uchar *key, size_t key_len, const aes_uchar *iv, size_t iv_len,
+	       const aes_uchar *plain, size_t plain_len,
+	       const aes_uchar *aad, size_t aad_len, aes_uchar *crypt, aes_uchar *tag)
+{
+	struct aes_gcm_ctx ctx;
+	int ret;
+
+	if (aes_gcm_ctx_init(&ctx, key, key_len) < 0)
+		return -1;
+
+	ret = aes_gcm_seal(&ctx, iv, iv_len, plain, plain_len, aad, aad_len, crypt, tag);
+
+	aes_gcm_ctx_clear(&ctx);
+
+	return ret;
+}
+
+
+/**
+ * aes_gcm_ad - GCM-AD_K(IV, C, A, T)
+ */
+int aes_gcm_ad(const aes_uchar *key, size_t key_len, const aes_uchar *iv, size_t iv_len,
+	       const aes_uchar *crypt, size_t crypt_len,
+	       const aes_uchar *aad, size_t aad_len, const aes_uchar *tag, aes_uchar *plain)
+{
+	struct aes_gcm_ctx ctx;
+	int ret;
+
+	if (aes_gcm_ctx_init(&ctx, key, key_len) < 0)
+		return -1;
+
+	ret = aes_gcm_open(&ctx, iv, iv_len, crypt, crypt_len, aad, aad_len, tag, plain);
+
+	aes_gcm_ctx_clear(&ctx);
+
+	return ret;
+}
+
+
 int aes_gmac(const aes_uchar *key, size_t key_len, const aes_uchar *iv, size_t iv_len,
 	     const aes_uchar *aad, size_t aad_len, aes_uchar *tag)
 {
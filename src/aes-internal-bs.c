@@ -0,0 +1,500 @@
+/*
+ * AES (Rijndael) cipher - constant-time bitsliced encryption
+ *
+ * Based on the "ct64" implementation in BearSSL, with the S-box circuit
+ * by Boyar and Peralta. The BearSSL code is covered by this notice:
+ *
+ * Copyright (c) 2016 Thomas Pornin <pornin@bolet.org>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Changes for this library may be distributed under the terms of the
+ * BSD license. See README for more details.
+ */
+
+#include "aes.h"
+#include "aes-internal.h"
+
+/*
+ * Eight 64-bit words hold one bit of every byte of four blocks, so the
+ * cipher runs on four blocks at once using only logical operations and
+ * fixed shifts: there are no table lookups indexed by secret data. With
+ * GCC vector extensions each word is a pair of 64-bit lanes (one SSE2
+ * register on x86) and eight blocks are processed at once.
+ */
+
+#if defined __GNUC__
+typedef aes_ulong aes_bs_word __attribute__((__vector_size__(16)));
+#define AES_BS_LANES 2
+#define AES_BS_LANE(v, l) ((v)[l])
+#define AES_BS_SPLAT(x) ((aes_bs_word) { (x), (x) })
+#else
+typedef aes_ulong aes_bs_word;
+#define AES_BS_LANES 1
+#define AES_BS_LANE(v, l) (v)
+#define AES_BS_SPLAT(x) (x)
+#endif /* __GNUC__ */
+
+#define AES_BS_BLOCKS (4 * AES_BS_LANES)
+
+
+static void bs_sbox(aes_bs_word *q)
+{
+	aes_bs_word x0, x1, x2, x3, x4, x5, x6, x7;
+	aes_bs_word y1, y2, y3, y4, y5, y6, y7, y8, y9;
+	aes_bs_word y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+	aes_bs_word y20, y21;
+	aes_bs_word z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	aes_bs_word z10, z11, z12, z13, z14, z15, z16, z17;
+	aes_bs_word t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	aes_bs_word t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	aes_bs_word t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	aes_bs_word t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	aes_bs_word t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	aes_bs_word t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	aes_bs_word t60, t61, t62, t63, t64, t65, t66, t67;
+	aes_bs_word s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* top linear transformation */
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* non-linear section */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* bottom linear transformation */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+
+/* Transpose between byte-interleaved and bitsliced representations */
+static void bs_ortho(aes_bs_word *q)
+{
+#define SWAPN(cl, ch, s, x, y) do { \
+		aes_bs_word a = (x), b = (y); \
+		(x) = (a & (cl)) | ((b & (cl)) << (s)); \
+		(y) = ((a & (ch)) >> (s)) | (b & (ch)); \
+	} while (0)
+#define SWAP2(x, y) SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define SWAP4(x, y) SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define SWAP8(x, y) SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+	SWAP2(q[0], q[1]);
+	SWAP2(q[2], q[3]);
+	SWAP2(q[4], q[5]);
+	SWAP2(q[6], q[7]);
+
+	SWAP4(q[0], q[2]);
+	SWAP4(q[1], q[3]);
+	SWAP4(q[4], q[6]);
+	SWAP4(q[5], q[7]);
+
+	SWAP8(q[0], q[4]);
+	SWAP8(q[1], q[5]);
+	SWAP8(q[2], q[6]);
+	SWAP8(q[3], q[7]);
+
+#undef SWAP8
+#undef SWAP4
+#undef SWAP2
+#undef SWAPN
+}
+
+
+/* Spread the four little endian words of a block over two 64-bit words */
+static void bs_interleave_in(aes_ulong *q0, aes_ulong *q1, const aes_uint *w)
+{
+	aes_ulong x0, x1, x2, x3;
+
+	x0 = w[0];
+	x1 = w[1];
+	x2 = w[2];
+	x3 = w[3];
+	x0 |= (x0 << 16);
+	x1 |= (x1 << 16);
+	x2 |= (x2 << 16);
+	x3 |= (x3 << 16);
+	x0 &= 0x0000FFFF0000FFFFULL;
+	x1 &= 0x0000FFFF0000FFFFULL;
+	x2 &= 0x0000FFFF0000FFFFULL;
+	x3 &= 0x0000FFFF0000FFFFULL;
+	x0 |= (x0 << 8);
+	x1 |= (x1 << 8);
+	x2 |= (x2 << 8);
+	x3 |= (x3 << 8);
+	x0 &= 0x00FF00FF00FF00FFULL;
+	x1 &= 0x00FF00FF00FF00FFULL;
+	x2 &= 0x00FF00FF00FF00FFULL;
+	x3 &= 0x00FF00FF00FF00FFULL;
+	*q0 = x0 | (x2 << 8);
+	*q1 = x1 | (x3 << 8);
+}
+
+
+static void bs_interleave_out(aes_uint *w, aes_ulong q0, aes_ulong q1)
+{
+	aes_ulong x0, x1, x2, x3;
+
+	x0 = q0 & 0x00FF00FF00FF00FFULL;
+	x1 = q1 & 0x00FF00FF00FF00FFULL;
+	x2 = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+	x3 = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+	x0 |= (x0 >> 8);
+	x1 |= (x1 >> 8);
+	x2 |= (x2 >> 8);
+	x3 |= (x3 >> 8);
+	x0 &= 0x0000FFFF0000FFFFULL;
+	x1 &= 0x0000FFFF0000FFFFULL;
+	x2 &= 0x0000FFFF0000FFFFULL;
+	x3 &= 0x0000FFFF0000FFFFULL;
+	w[0] = (aes_uint) x0 | (aes_uint) (x0 >> 16);
+	w[1] = (aes_uint) x1 | (aes_uint) (x1 >> 16);
+	w[2] = (aes_uint) x2 | (aes_uint) (x2 >> 16);
+	w[3] = (aes_uint) x3 | (aes_uint) (x3 >> 16);
+}
+
+
+/* Load AES_BS_BLOCKS blocks into bitsliced form */
+static void bs_load(aes_bs_word *q, const aes_uchar *in)
+{
+	aes_uint w[16];
+	aes_ulong t[8];
+	int i, l;
+
+	for (l = 0; l < AES_BS_LANES; l++) {
+		for (i = 0; i < 16; i++)
+			w[i] = AES_GET_LE32(in + 64 * l + 4 * i);
+		for (i = 0; i < 4; i++)
+			bs_interleave_in(&t[i], &t[i + 4], w + 4 * i);
+		for (i = 0; i < 8; i++)
+			AES_BS_LANE(q[i], l) = t[i];
+	}
+	bs_ortho(q);
+}
+
+
+static void bs_store(aes_uchar *out, aes_bs_word *q)
+{
+	aes_uint w[16];
+	int i, l;
+
+	bs_ortho(q);
+	for (l = 0; l < AES_BS_LANES; l++) {
+		for (i = 0; i < 4; i++)
+			bs_interleave_out(w + 4 * i, AES_BS_LANE(q[i], l), AES_BS_LANE(q[i + 4], l));
+		for (i = 0; i < 16; i++)
+			AES_PUT_LE32(out + 64 * l + 4 * i, w[i]);
+	}
+}
+
+
+/*
+ * Bitslice the expanded key schedule: every round key is replicated into
+ * all block positions
+ */
+static void bs_key_setup(aes_bs_word *sk, const aes_uint rk[], int Nr)
+{
+	aes_uint w[4];
+	aes_ulong q0, q1;
+	int i, r;
+
+	for (r = 0; r <= Nr; r++) {
+		for (i = 0; i < 4; i++)
+			w[i] = bswap_32(rk[4 * r + i]);
+		bs_interleave_in(&q0, &q1, w);
+		for (i = 0; i < 4; i++) {
+			sk[8 * r + i] = AES_BS_SPLAT(q0);
+			sk[8 * r + i + 4] = AES_BS_SPLAT(q1);
+		}
+		bs_ortho(sk + 8 * r);
+	}
+}
+
+
+static inline void bs_add_round_key(aes_bs_word *q, const aes_bs_word *sk)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		q[i] ^= sk[i];
+}
+
+
+static inline void bs_shift_rows(aes_bs_word *q)
+{
+	aes_bs_word x;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		x = q[i];
+		q[i] = (x & 0x000000000000FFFFULL)
+			| ((x & 0x00000000FFF00000ULL) >> 4)
+			| ((x & 0x00000000000F0000ULL) << 12)
+			| ((x & 0x0000FF0000000000ULL) >> 8)
+			| ((x & 0x000000FF00000000ULL) << 8)
+			| ((x & 0xF000000000000000ULL) >> 12)
+			| ((x & 0x0FFF000000000000ULL) << 4);
+	}
+}
+
+
+static inline aes_bs_word bs_rotr32(aes_bs_word x)
+{
+	return (x << 32) | (x >> 32);
+}
+
+
+static inline void bs_mix_columns(aes_bs_word *q)
+{
+	aes_bs_word q0, q1, q2, q3, q4, q5, q6, q7;
+	aes_bs_word r0, r1, r2, r3, r4, r5, r6, r7;
+
+	q0 = q[0];
+	q1 = q[1];
+	q2 = q[2];
+	q3 = q[3];
+	q4 = q[4];
+	q5 = q[5];
+	q6 = q[6];
+	q7 = q[7];
+	r0 = (q0 >> 16) | (q0 << 48);
+	r1 = (q1 >> 16) | (q1 << 48);
+	r2 = (q2 >> 16) | (q2 << 48);
+	r3 = (q3 >> 16) | (q3 << 48);
+	r4 = (q4 >> 16) | (q4 << 48);
+	r5 = (q5 >> 16) | (q5 << 48);
+	r6 = (q6 >> 16) | (q6 << 48);
+	r7 = (q7 >> 16) | (q7 << 48);
+
+	q[0] = q7 ^ r7 ^ r0 ^ bs_rotr32(q0 ^ r0);
+	q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ bs_rotr32(q1 ^ r1);
+	q[2] = q1 ^ r1 ^ r2 ^ bs_rotr32(q2 ^ r2);
+	q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ bs_rotr32(q3 ^ r3);
+	q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ bs_rotr32(q4 ^ r4);
+	q[5] = q4 ^ r4 ^ r5 ^ bs_rotr32(q5 ^ r5);
+	q[6] = q5 ^ r5 ^ r6 ^ bs_rotr32(q6 ^ r6);
+	q[7] = q6 ^ r6 ^ r7 ^ bs_rotr32(q7 ^ r7);
+}
+
+
+static void bs_encrypt(const aes_bs_word *sk, int Nr, aes_bs_word *q)
+{
+	int r;
+
+	bs_add_round_key(q, sk);
+	for (r = 1; r < Nr; r++) {
+		bs_sbox(q);
+		bs_shift_rows(q);
+		bs_mix_columns(q);
+		bs_add_round_key(q, sk + 8 * r);
+	}
+	bs_sbox(q);
+	bs_shift_rows(q);
+	bs_add_round_key(q, sk + 8 * Nr);
+}
+
+
+/**
+ * aes_bitslice_key_setup - Bitslice an expanded key for aes_bitslice_ctr32()
+ * @bk: Bitsliced key schedule to fill in
+ * @rk: Encryption key schedule (aes_rijndael_key_setup_enc() layout)
+ */
+void aes_bitslice_key_setup(struct aes_bs_key *bk, const aes_uint rk[])
+{
+	bk->Nr = rk[AES_PRIV_NR_POS];
+	bs_key_setup((aes_bs_word *) bk->sk, rk, bk->Nr);
+}
+
+
+/**
+ * aes_bitslice_ctr32 - Constant-time counter mode over full blocks
+ * @bk: Bitsliced key schedule from aes_bitslice_key_setup()
+ * @cb: Counter block; advanced by nblocks with inc32
+ * @in: Input blocks
+ * @nblocks: Number of 16 byte blocks in in
+ * @out: Output blocks (may be the same buffer as in)
+ *
+ * A short final group is padded with unused counter blocks so that every
+ * block takes the same constant-time path.
+ */
+void aes_bitslice_ctr32(const struct aes_bs_key *bk, aes_uchar *cb, const aes_uchar *in,
+			size_t nblocks, aes_uchar *out)
+{
+	const aes_bs_word *sk = (const aes_bs_word *) bk->sk;
+	aes_bs_word q[8];
+	aes_uchar ctr[16 * AES_BS_BLOCKS];
+	aes_uint c;
+	size_t i, n;
+
+	c = AES_GET_BE32(cb + 12);
+	while (nblocks) {
+		n = nblocks < AES_BS_BLOCKS ? nblocks : AES_BS_BLOCKS;
+		for (i = 0; i < AES_BS_BLOCKS; i++) {
+			memcpy(ctr + 16 * i, cb, 12);
+			AES_PUT_BE32(ctr + 16 * i + 12, c + (aes_uint) i);
+		}
+		c += (aes_uint) n;
+
+		bs_load(q, ctr);
+		bs_encrypt(sk, bk->Nr, q);
+		bs_store(ctr, q);
+
+		for (i = 0; i < 16 * n; i++)
+			out[i] = in[i] ^ ctr[i];
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+	AES_PUT_BE32(cb + 12, c);
+
+	memset(ctr, 0, sizeof(ctr));
+}
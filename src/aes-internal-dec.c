@@ -128,34 +128,210 @@ d##3 = TD0(s##3) ^ TD1(s##2) ^ TD2(s##1) ^ TD3(s##0) ^ rk[4 * i + 3]
 }
 
 
+/*
+ * Decrypt four independent blocks with their rounds interleaved, so that the
+ * table lookups of one block overlap with the latency of the others.
+ */
+void aes_rijndael_decrypt4(const aes_uint rk[], int Nr, const aes_uchar ct[64], aes_uchar pt[64])
+{
+	aes_uint s00, s01, s02, s03, s10, s11, s12, s13;
+	aes_uint s20, s21, s22, s23, s30, s31, s32, s33;
+	aes_uint t00, t01, t02, t03, t10, t11, t12, t13;
+	aes_uint t20, t21, t22, t23, t30, t31, t32, t33;
+#ifndef AES_FULL_UNROLL
+	int r;
+#endif /* AES_FULL_UNROLL */
+
+#define LOAD(l) \
+s##l##0 = GETU32(ct + 16 * l     ) ^ rk[0]; \
+s##l##1 = GETU32(ct + 16 * l +  4) ^ rk[1]; \
+s##l##2 = GETU32(ct + 16 * l +  8) ^ rk[2]; \
+s##l##3 = GETU32(ct + 16 * l + 12) ^ rk[3]
+
+	LOAD(0); LOAD(1); LOAD(2); LOAD(3);
+
+#undef LOAD
+
+#define ROUND(i,d,s,l) \
+d##l##0 = TD0(s##l##0) ^ TD1(s##l##3) ^ TD2(s##l##2) ^ TD3(s##l##1) ^ rk[4 * i]; \
+d##l##1 = TD0(s##l##1) ^ TD1(s##l##0) ^ TD2(s##l##3) ^ TD3(s##l##2) ^ rk[4 * i + 1]; \
+d##l##2 = TD0(s##l##2) ^ TD1(s##l##1) ^ TD2(s##l##0) ^ TD3(s##l##3) ^ rk[4 * i + 2]; \
+d##l##3 = TD0(s##l##3) ^ TD1(s##l##2) ^ TD2(s##l##1) ^ TD3(s##l##0) ^ rk[4 * i + 3]
+#define ROUND4(i,d,s) \
+ROUND(i,d,s,0); ROUND(i,d,s,1); ROUND(i,d,s,2); ROUND(i,d,s,3)
+
+#ifdef AES_FULL_UNROLL
+
+	ROUND4(1,t,s);
+	ROUND4(2,s,t);
+	ROUND4(3,t,s);
+	ROUND4(4,s,t);
+	ROUND4(5,t,s);
+	ROUND4(6,s,t);
+	ROUND4(7,t,s);
+	ROUND4(8,s,t);
+	ROUND4(9,t,s);
+	if (Nr > 10) {
+		ROUND4(10,s,t);
+		ROUND4(11,t,s);
+		if (Nr > 12) {
+			ROUND4(12,s,t);
+			ROUND4(13,t,s);
+		}
+	}
+
+	rk += Nr << 2;
+
+#else
+
+	/* Nr - 1 full rounds: */
+	r = Nr >> 1;
+	for (;;) {
+		ROUND4(1,t,s);
+		rk += 8;
+		if (--r == 0)
+			break;
+		ROUND4(0,s,t);
+	}
+
+#endif /* AES_FULL_UNROLL */
+
+#undef ROUND4
+#undef ROUND
+
+#define FINAL(l) \
+s##l##0 = TD41(t##l##0) ^ TD42(t##l##3) ^ TD43(t##l##2) ^ TD44(t##l##1) ^ rk[0]; \
+PUTU32(pt + 16 * l     , s##l##0); \
+s##l##1 = TD41(t##l##1) ^ TD42(t##l##0) ^ TD43(t##l##3) ^ TD44(t##l##2) ^ rk[1]; \
+PUTU32(pt + 16 * l +  4, s##l##1); \
+s##l##2 = TD41(t##l##2) ^ TD42(t##l##1) ^ TD43(t##l##0) ^ TD44(t##l##3) ^ rk[2]; \
+PUTU32(pt + 16 * l +  8, s##l##2); \
+s##l##3 = TD41(t##l##3) ^ TD42(t##l##2) ^ TD43(t##l##1) ^ TD44(t##l##0) ^ rk[3]; \
+PUTU32(pt + 16 * l + 12, s##l##3)
+
+	/*
+	 * apply last round and
+	 * map cipher state to byte array block:
+	 */
+	FINAL(0); FINAL(1); FINAL(2); FINAL(3);
+
+#undef FINAL
+}
+
+
+/*
+ * CBC decryption four blocks at a time. The ciphertext of each group is
+ * copied behind the previous chaining block before it is decrypted, so in
+ * may be the same buffer as out.
+ */
+static void aes_rijndael_cbc_decrypt(const aes_uint rk[], int Nr, aes_uchar *iv, const aes_uchar *in,
+				     size_t nblocks, aes_uchar *out)
+{
+	aes_uchar chain[16 * 5];
+	size_t i, n;
+
+	memcpy(chain, iv, 16);
+	while (nblocks) {
+		n = nblocks < 4 ? nblocks : 4;
+		memcpy(chain + 16, in, 16 * n);
+		if (n == 4)
+			aes_rijndael_decrypt4(rk, Nr, chain + 16, out);
+		else
+			for (i = 0; i < n; i++)
+				aes_rijndael_decrypt(rk, Nr, chain + 16 * (i + 1), out + 16 * i);
+		for (i = 0; i < n; i++)
+			aes_xor_block(out + 16 * i, chain + 16 * i);
+		memcpy(chain, chain + 16 * n, 16);
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+	memcpy(iv, chain, 16);
+}
+
+
 /* AES decrypt interface */
 
-void * aes_decrypt_init(const aes_uchar *key, size_t len)
+/**
+ * aes_decrypt_key_init - Expand a decryption key into caller provided memory
+ * @key: Key schedule to initialize (e.g., on the stack)
+ * @k: AES key
+ * @len: Length of the key in bytes (16, 24 or 32)
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_decrypt_key_init(struct aes_key *key, const aes_uchar *k, size_t len)
 {
-	aes_uint *rk;
+	aes_uint *rk = key->rk;
 	int res;
-	rk = malloc(AES_PRIV_SIZE);
-	if (rk == NULL)
+#ifdef AES_HAVE_X86_INTRIN
+	if (aes_cpu_features() & AES_CPU_AESNI)
+		res = aes_ni_key_setup_dec(rk, k, len * 8);
+	else
+#endif /* AES_HAVE_X86_INTRIN */
+	res = aes_rijndael_key_setup_dec(rk, k, len * 8);
+	if (res < 0)
+		return -1;
+	rk[AES_PRIV_NR_POS] = res;
+	return 0;
+}
+
+
+void * aes_decrypt_init(const aes_uchar *key, size_t len)
+{
+	struct aes_key *ctx;
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL)
 		return NULL;
-	res = aes_rijndael_key_setup_dec(rk, key, len * 8);
-	if (res < 0) {
-		free(rk);
+	if (aes_decrypt_key_init(ctx, key, len) < 0) {
+		free(ctx);
 		return NULL;
 	}
-	rk[AES_PRIV_NR_POS] = res;
-	return rk;
+	return ctx;
 }
 
 
 void aes_decrypt(void *ctx, const aes_uchar *crypt, aes_uchar *plain)
 {
 	aes_uint *rk = ctx;
+#ifdef AES_HAVE_X86_INTRIN
+	if (aes_cpu_features() & AES_CPU_AESNI) {
+		aes_ni_decrypt(rk, rk[AES_PRIV_NR_POS], crypt, plain);
+		return;
+	}
+#endif /* AES_HAVE_X86_INTRIN */
 	aes_rijndael_decrypt(ctx, rk[AES_PRIV_NR_POS], crypt, plain);
 }
 
 
+/**
+ * aes_decrypt_cbc - Decrypt full blocks in CBC mode
+ * @ctx: Context pointer from aes_decrypt_init()
+ * @iv: Chaining block; replaced by the last ciphertext block
+ * @in: Input blocks
+ * @nblocks: Number of 16 byte blocks in in
+ * @out: Output blocks (may be the same buffer as in)
+ *
+ * Unlike encryption, CBC decryption of each block only depends on the
+ * ciphertext, so blocks are decrypted several at a time with their rounds
+ * interleaved: 8 with AES-NI, otherwise 4 with the T-table code.
+ */
+void aes_decrypt_cbc(void *ctx, aes_uchar *iv, const aes_uchar *in, size_t nblocks,
+		     aes_uchar *out)
+{
+	aes_uint *rk = ctx;
+
+#ifdef AES_HAVE_X86_INTRIN
+	if (aes_cpu_features() & AES_CPU_AESNI) {
+		aes_ni_cbc_decrypt(rk, rk[AES_PRIV_NR_POS], iv, in, nblocks, out);
+		return;
+	}
+#endif /* AES_HAVE_X86_INTRIN */
+	aes_rijndael_cbc_decrypt(rk, rk[AES_PRIV_NR_POS], iv, in, nblocks, out);
+}
+
+
 void aes_decrypt_deinit(void *ctx)
 {
-	memset(ctx, 0, AES_PRIV_SIZE);
+	aes_key_clear(ctx);
 	free(ctx);
 }
@@ -165,35 +165,557 @@ d##3 = TE0(s##3) ^ TE1(s##0) ^ TE2(s##1) ^ TE3(s##2) ^ rk[4 * i + 3]
 }
 
 
+/*
+ * Encrypt four independent blocks with their rounds interleaved, so that the
+ * table lookups of one block overlap with the latency of the others.
+ */
+void aes_rijndael_encrypt4(const aes_uint rk[], int Nr, const aes_uchar pt[64], aes_uchar ct[64])
+{
+	aes_uint s00, s01, s02, s03, s10, s11, s12, s13;
+	aes_uint s20, s21, s22, s23, s30, s31, s32, s33;
+	aes_uint t00, t01, t02, t03, t10, t11, t12, t13;
+	aes_uint t20, t21, t22, t23, t30, t31, t32, t33;
+#ifndef AES_FULL_UNROLL
+	int r;
+#endif /* AES_FULL_UNROLL */
+
+#define LOAD(l) \
+s##l##0 = GETU32(pt + 16 * l     ) ^ rk[0]; \
+s##l##1 = GETU32(pt + 16 * l +  4) ^ rk[1]; \
+s##l##2 = GETU32(pt + 16 * l +  8) ^ rk[2]; \
+s##l##3 = GETU32(pt + 16 * l + 12) ^ rk[3]
+
+	LOAD(0); LOAD(1); LOAD(2); LOAD(3);
+
+#undef LOAD
+
+#define ROUND(i,d,s,l) \
+d##l##0 = TE0(s##l##0) ^ TE1(s##l##1) ^ TE2(s##l##2) ^ TE3(s##l##3) ^ rk[4 * i]; \
+d##l##1 = TE0(s##l##1) ^ TE1(s##l##2) ^ TE2(s##l##3) ^ TE3(s##l##0) ^ rk[4 * i + 1]; \
+d##l##2 = TE0(s##l##2) ^ TE1(s##l##3) ^ TE2(s##l##0) ^ TE3(s##l##1) ^ rk[4 * i + 2]; \
+d##l##3 = TE0(s##l##3) ^ TE1(s##l##0) ^ TE2(s##l##1) ^ TE3(s##l##2) ^ rk[4 * i + 3]
+#define ROUND4(i,d,s) \
+ROUND(i,d,s,0); ROUND(i,d,s,1); ROUND(i,d,s,2); ROUND(i,d,s,3)
+
+#ifdef AES_FULL_UNROLL
+
+	ROUND4(1,t,s);
+	ROUND4(2,s,t);
+	ROUND4(3,t,s);
+	ROUND4(4,s,t);
+	ROUND4(5,t,s);
+	ROUND4(6,s,t);
+	ROUND4(7,t,s);
+	ROUND4(8,s,t);
+	ROUND4(9,t,s);
+	if (Nr > 10) {
+		ROUND4(10,s,t);
+		ROUND4(11,t,s);
+		if (Nr > 12) {
+			ROUND4(12,s,t);
+			ROUND4(13,t,s);
+		}
+	}
+
+	rk += Nr << 2;
+
+#else
+
+	/* Nr - 1 full rounds: */
+	r = Nr >> 1;
+	for (;;) {
+		ROUND4(1,t,s);
+		rk += 8;
+		if (--r == 0)
+			break;
+		ROUND4(0,s,t);
+	}
+
+#endif /* AES_FULL_UNROLL */
+
+#undef ROUND4
+#undef ROUND
+
+#define FINAL(l) \
+s##l##0 = TE41(t##l##0) ^ TE42(t##l##1) ^ TE43(t##l##2) ^ TE44(t##l##3) ^ rk[0]; \
+PUTU32(ct + 16 * l     , s##l##0); \
+s##l##1 = TE41(t##l##1) ^ TE42(t##l##2) ^ TE43(t##l##3) ^ TE44(t##l##0) ^ rk[1]; \
+PUTU32(ct + 16 * l +  4, s##l##1); \
+s##l##2 = TE41(t##l##2) ^ TE42(t##l##3) ^ TE43(t##l##0) ^ TE44(t##l##1) ^ rk[2]; \
+PUTU32(ct + 16 * l +  8, s##l##2); \
+s##l##3 = TE41(t##l##3) ^ TE42(t##l##0) ^ TE43(t##l##1) ^ TE44(t##l##2) ^ rk[3]; \
+PUTU32(ct + 16 * l + 12, s##l##3)
+
+	/*
+	 * apply last round and
+	 * map cipher state to byte array block:
+	 */
+	FINAL(0); FINAL(1); FINAL(2); FINAL(3);
+
+#undef FINAL
+}
+
+
+/*
+ * As aes_rijndael_encrypt4(), but each block has its own key schedule (all
+ * with Nr rounds), for interleaving independent streams.
+ */
+void aes_rijndael_encrypt4_keys(const aes_uint *rk[4], int Nr, const aes_uchar pt[64], aes_uchar ct[64])
+{
+	const aes_uint *rk0 = rk[0], *rk1 = rk[1], *rk2 = rk[2], *rk3 = rk[3];
+	aes_uint s00, s01, s02, s03, s10, s11, s12, s13;
+	aes_uint s20, s21, s22, s23, s30, s31, s32, s33;
+	aes_uint t00, t01, t02, t03, t10, t11, t12, t13;
+	aes_uint t20, t21, t22, t23, t30, t31, t32, t33;
+	int r;
+
+#define LOAD(l) \
+s##l##0 = GETU32(pt + 16 * l     ) ^ rk##l[0]; \
+s##l##1 = GETU32(pt + 16 * l +  4) ^ rk##l[1]; \
+s##l##2 = GETU32(pt + 16 * l +  8) ^ rk##l[2]; \
+s##l##3 = GETU32(pt + 16 * l + 12) ^ rk##l[3]
+
+	LOAD(0); LOAD(1); LOAD(2); LOAD(3);
+
+#undef LOAD
+
+#define ROUND(i,d,s,l) \
+d##l##0 = TE0(s##l##0) ^ TE1(s##l##1) ^ TE2(s##l##2) ^ TE3(s##l##3) ^ rk##l[4 * i]; \
+d##l##1 = TE0(s##l##1) ^ TE1(s##l##2) ^ TE2(s##l##3) ^ TE3(s##l##0) ^ rk##l[4 * i + 1]; \
+d##l##2 = TE0(s##l##2) ^ TE1(s##l##3) ^ TE2(s##l##0) ^ TE3(s##l##1) ^ rk##l[4 * i + 2]; \
+d##l##3 = TE0(s##l##3) ^ TE1(s##l##0) ^ TE2(s##l##1) ^ TE3(s##l##2) ^ rk##l[4 * i + 3]
+#define ROUND4(i,d,s) \
+ROUND(i,d,s,0); ROUND(i,d,s,1); ROUND(i,d,s,2); ROUND(i,d,s,3)
+
+	/* Nr - 1 full rounds: */
+	r = Nr >> 1;
+	for (;;) {
+		ROUND4(1,t,s);
+		rk0 += 8; rk1 += 8; rk2 += 8; rk3 += 8;
+		if (--r == 0)
+			break;
+		ROUND4(0,s,t);
+	}
+
+#undef ROUND4
+#undef ROUND
+
+#define FINAL(l) \
+s##l##0 = TE41(t##l##0) ^ TE42(t##l##1) ^ TE43(t##l##2) ^ TE44(t##l##3) ^ rk##l[0]; \
+PUTU32(ct + 16 * l     , s##l##0); \
+s##l##1 = TE41(t##l##1) ^ TE42(t##l##2) ^ TE43(t##l##3) ^ TE44(t##l##0) ^ rk##l[1]; \
+PUTU32(ct + 16 * l +  4, s##l##1); \
+s##l##2 = TE41(t##l##2) ^ TE42(t##l##3) ^ TE43(t##l##0) ^ TE44(t##l##1) ^ rk##l[2]; \
+PUTU32(ct + 16 * l +  8, s##l##2); \
+s##l##3 = TE41(t##l##3) ^ TE42(t##l##0) ^ TE43(t##l##1) ^ TE44(t##l##2) ^ rk##l[3]; \
+PUTU32(ct + 16 * l + 12, s##l##3)
+
+	/*
+	 * apply last round and
+	 * map cipher state to byte array block:
+	 */
+	FINAL(0); FINAL(1); FINAL(2); FINAL(3);
+
+#undef FINAL
+}
+
+
+/*
+ * Multi-buffer CBC encryption. Each window of up to AES_CBC_MB_LANES lanes
+ * is ordered by number of rounds, so that every four lanes with the same key
+ * size are interleaved with aes_rijndael_encrypt4_keys() whatever order
+ * they were submitted in; the lanes left over are encrypted one at a time.
+ */
+static void aes_rijndael_cbc_encrypt_mb(const aes_uint *rk[], aes_uchar *iv[], const aes_uchar *in[],
+					aes_uchar *out[], size_t nlanes, size_t nblocks)
+{
+	const aes_uint *keys[4];
+	aes_uchar buf[64];
+	size_t lane[AES_CBC_MB_LANES], b, i, j, l, m, n;
+	int Nr;
+
+	for (l = 0; l < nlanes; l += m) {
+		m = nlanes - l < AES_CBC_MB_LANES ? nlanes - l : AES_CBC_MB_LANES;
+		for (i = 0; i < m; i++) {
+			for (j = i; j > 0 && rk[lane[j - 1]][AES_PRIV_NR_POS] > rk[l + i][AES_PRIV_NR_POS]; j--)
+				lane[j] = lane[j - 1];
+			lane[j] = l + i;
+		}
+
+		for (i = 0; i < m; i += n) {
+			Nr = rk[lane[i]][AES_PRIV_NR_POS];
+			for (n = 1; n < 4 && i + n < m && (int) rk[lane[i + n]][AES_PRIV_NR_POS] == Nr; n++)
+				;
+
+			if (n < 4) {
+				for (j = i; j < i + n; j++)
+					for (b = 0; b < nblocks; b++) {
+						memcpy(buf, in[lane[j]] + 16 * b, 16);
+						aes_xor_block(buf, iv[lane[j]]);
+						aes_rijndael_encrypt(rk[lane[j]], Nr, buf, iv[lane[j]]);
+						if (out)
+							memcpy(out[lane[j]] + 16 * b, iv[lane[j]], 16);
+					}
+				continue;
+			}
+
+			for (j = 0; j < 4; j++)
+				keys[j] = rk[lane[i + j]];
+			for (b = 0; b < nblocks; b++) {
+				for (j = 0; j < 4; j++) {
+					memcpy(buf + 16 * j, in[lane[i + j]] + 16 * b, 16);
+					aes_xor_block(buf + 16 * j, iv[lane[i + j]]);
+				}
+				aes_rijndael_encrypt4_keys(keys, Nr, buf, buf);
+				for (j = 0; j < 4; j++) {
+					if (out)
+						memcpy(out[lane[i + j]] + 16 * b, buf + 16 * j, 16);
+					memcpy(iv[lane[i + j]], buf + 16 * j, 16);
+				}
+			}
+		}
+	}
+}
+
+
 /* AES encrypt interface */
 
-void * aes_encrypt_init(const aes_uchar *key, size_t len)
+int aes_encrypt_setup(aes_uint rk[], const aes_uchar *key, size_t len)
 {
-	aes_uint *rk;
 	int res;
-	rk = malloc(AES_PRIV_SIZE);
-	if (rk == NULL)
-		return NULL;
+#ifdef AES_HAVE_X86_INTRIN
+	if (aes_cpu_features() & AES_CPU_AESNI)
+		res = aes_ni_key_setup_enc(rk, key, len * 8);
+	else
+#endif /* AES_HAVE_X86_INTRIN */
 	res = aes_rijndael_key_setup_enc(rk, key, len * 8);
-	if (res < 0) {
-		free(rk);
+	if (res < 0)
+		return -1;
+	rk[AES_PRIV_NR_POS] = res;
+	return 0;
+}
+
+
+/**
+ * aes_encrypt_key_init - Expand an encryption key into caller provided memory
+ * @key: Key schedule to initialize (e.g., on the stack)
+ * @k: AES key
+ * @len: Length of the key in bytes (16, 24 or 32)
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_encrypt_key_init(struct aes_key *key, const aes_uchar *k, size_t len)
+{
+	return aes_encrypt_setup(key->rk, k, len);
+}
+
+
+/**
+ * aes_key_clear - Clear an expanded key
+ * @key: Key schedule from aes_encrypt_key_init() or aes_decrypt_key_init()
+ */
+void aes_key_clear(struct aes_key *key)
+{
+	memset(key, 0, sizeof(*key));
+}
+
+
+void * aes_encrypt_init(const aes_uchar *key, size_t len)
+{
+	struct aes_key *ctx;
+	ctx = malloc(sizeof(*ctx));
+	if (ctx == NULL)
+		return NULL;
+	if (aes_encrypt_key_init(ctx, key, len) < 0) {
+		free(ctx);
 		return NULL;
 	}
-	rk[AES_PRIV_NR_POS] = res;
-	return rk;
+	return ctx;
 }
 
 
 void aes_encrypt(void *ctx, const aes_uchar *plain, aes_uchar *crypt)
 {
 	aes_uint *rk = ctx;
+#ifdef AES_HAVE_X86_INTRIN
+	if (aes_cpu_features() & AES_CPU_AESNI) {
+		aes_ni_encrypt(rk, rk[AES_PRIV_NR_POS], plain, crypt);
+		return;
+	}
+#endif /* AES_HAVE_X86_INTRIN */
 	aes_rijndael_encrypt(ctx, rk[AES_PRIV_NR_POS], plain, crypt);
 }
 
 
+static void aes_rijndael_ctr32(const aes_uint rk[], int Nr, aes_uchar *cb, const aes_uchar *in,
+			       size_t nblocks, aes_uchar *out)
+{
+	aes_uchar ctr[64], ks[64];
+	aes_uint c;
+	size_t i, n;
+
+	c = AES_GET_BE32(cb + 12);
+	while (nblocks) {
+		n = nblocks < 4 ? nblocks : 4;
+		for (i = 0; i < n; i++) {
+			memcpy(ctr + 16 * i, cb, 12);
+			AES_PUT_BE32(ctr + 16 * i + 12, c++);
+		}
+		if (n == 4)
+			aes_rijndael_encrypt4(rk, Nr, ctr, ks);
+		else
+			for (i = 0; i < n; i++)
+				aes_rijndael_encrypt(rk, Nr, ctr + 16 * i, ks + 16 * i);
+		for (i = 0; i < 16 * n; i++)
+			out[i] = in[i] ^ ks[i];
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+	AES_PUT_BE32(cb + 12, c);
+}
+
+
+/**
+ * aes_encrypt_ctr32 - Encrypt full blocks in counter mode
+ * @ctx: Context pointer from aes_encrypt_init()
+ * @cb: Counter block; advanced by nblocks with inc32 (last 32 bits wrap)
+ * @in: Input blocks
+ * @nblocks: Number of 16 byte blocks in in
+ * @out: Output blocks (may be the same buffer as in)
+ *
+ * Counter blocks are encrypted several at a time with their rounds
+ * interleaved: 8 with AES-NI, otherwise 8 with the constant-time bitsliced
+ * code (AES_CPU_BITSLICE) or 4 with the T-table code.
+ */
+void aes_encrypt_ctr32(void *ctx, aes_uchar *cb, const aes_uchar *in, size_t nblocks,
+		       aes_uchar *out)
+{
+	aes_encrypt_ctr32_bs(ctx, NULL, cb, in, nblocks, out);
+}
+
+
+/**
+ * aes_ctr_bs_key_init - Prepare a cached key schedule for aes_encrypt_ctr32_bs()
+ * @bk: Bitsliced key schedule to fill in
+ * @rk: Encryption key schedule (aes_rijndael_key_setup_enc() layout)
+ *
+ * The schedule is only bitsliced when the bitsliced backend is the one
+ * aes_encrypt_ctr32() uses; otherwise bk->Nr is left 0.
+ */
+void aes_ctr_bs_key_init(struct aes_bs_key *bk, const aes_uint rk[])
+{
+	int features = aes_cpu_features();
+
+	memset(bk, 0, sizeof(*bk));
+	if ((features & (AES_CPU_AESNI | AES_CPU_BITSLICE)) == AES_CPU_BITSLICE)
+		aes_bitslice_key_setup(bk, rk);
+}
+
+
+/**
+ * aes_encrypt_ctr32_bs - aes_encrypt_ctr32() with a cached bitsliced key
+ * @ctx: Context pointer from aes_encrypt_init()
+ * @bk: Key schedule from aes_ctr_bs_key_init() for the same key, or %NULL
+ * @cb: Counter block; advanced by nblocks with inc32 (last 32 bits wrap)
+ * @in: Input blocks
+ * @nblocks: Number of 16 byte blocks in in
+ * @out: Output blocks (may be the same buffer as in)
+ *
+ * Without a set up bk the bitsliced backend converts the key schedule on
+ * every call, which costs about as much as encrypting a few blocks.
+ */
+void aes_encrypt_ctr32_bs(void *ctx, const struct aes_bs_key *bk, aes_uchar *cb,
+			  const aes_uchar *in, size_t nblocks, aes_uchar *out)
+{
+	aes_uint *rk = ctx;
+	int features = aes_cpu_features();
+	struct aes_bs_key tmp;
+
+#ifdef AES_HAVE_X86_INTRIN
+	if (features & AES_CPU_AESNI) {
+		aes_ni_ctr32(rk, rk[AES_PRIV_NR_POS], cb, in, nblocks, out);
+		return;
+	}
+#endif /* AES_HAVE_X86_INTRIN */
+
+	if (!(features & AES_CPU_BITSLICE)) {
+		aes_rijndael_ctr32(rk, rk[AES_PRIV_NR_POS], cb, in, nblocks, out);
+		return;
+	}
+	if (nblocks == 0)
+		return;
+	if (bk && bk->Nr) {
+		aes_bitslice_ctr32(bk, cb, in, nblocks, out);
+		return;
+	}
+	aes_bitslice_key_setup(&tmp, rk);
+	aes_bitslice_ctr32(&tmp, cb, in, nblocks, out);
+	memset(&tmp, 0, sizeof(tmp));
+}
+
+
+/**
+ * aes_encrypt_ctr128_bs - Counter mode over full blocks with a 128-bit counter
+ * @ctx: Context pointer from aes_encrypt_init()
+ * @bk: Key schedule from aes_ctr_bs_key_init() for the same key, or %NULL
+ * @cb: Counter block; advanced by nblocks as a 128-bit big endian integer
+ * @in: Input blocks
+ * @nblocks: Number of 16 byte blocks in in
+ * @out: Output blocks (may be the same buffer as in)
+ */
+void aes_encrypt_ctr128_bs(void *ctx, const struct aes_bs_key *bk, aes_uchar *cb,
+			   const aes_uchar *in, size_t nblocks, aes_uchar *out)
+{
+	aes_ulong room;
+	size_t n;
+	int i;
+
+	/* the backends use inc32, so split where the low 32 bits wrap */
+	while (nblocks) {
+		room = 0x100000000ULL - AES_GET_BE32(cb + 12);
+		n = room < nblocks ? (size_t) room : nblocks;
+		aes_encrypt_ctr32_bs(ctx, bk, cb, in, n, out);
+		if (n == room)
+			for (i = 11; i >= 0 && ++cb[i] == 0; i--)
+				;
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+}
+
+
+/*
+ * CTR plus CBC-MAC over groups of 8 blocks, small enough to stay in L1
+ * between the two steps; the counter is advanced with inc32
+ */
+static void aes_ctr_cbcmac_groups(void *ctx, const struct aes_bs_key *bk, aes_uchar *x,
+				  aes_uchar *cb, const aes_uchar *in, size_t nblocks,
+				  aes_uchar *out, int mac_in)
+{
+	aes_uint *rk = ctx;
+	size_t i, n;
+
+	while (nblocks) {
+		n = nblocks < 8 ? nblocks : 8;
+		/* the input is MACed before it is overwritten when in is out */
+		for (i = 0; mac_in && i < n; i++) {
+			aes_xor_block(x, in + 16 * i);
+			aes_rijndael_encrypt(rk, rk[AES_PRIV_NR_POS], x, x);
+		}
+		aes_encrypt_ctr32_bs(ctx, bk, cb, in, n, out);
+		for (i = 0; !mac_in && i < n; i++) {
+			aes_xor_block(x, out + 16 * i);
+			aes_rijndael_encrypt(rk, rk[AES_PRIV_NR_POS], x, x);
+		}
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+}
+
+
+/**
+ * aes_encrypt_ctr_cbcmac - CTR encrypt full blocks and CBC-MAC them in one pass
+ * @ctx: Context pointer from aes_encrypt_init()
+ * @bk: Key schedule from aes_ctr_bs_key_init() for the same key, or %NULL
+ * @x: CBC-MAC chaining value, X_i+1 = E(K, X_i XOR B_i)
+ * @cb: Counter block; advanced by nblocks as a 128-bit big endian integer
+ * @in: Input blocks
+ * @nblocks: Number of 16 byte blocks in in
+ * @out: Output blocks (may be the same buffer as in)
+ * @mac_in: 1 to MAC the input blocks, 0 to MAC the output blocks
+ *
+ * This is the bulk step of CCM (MAC over the plaintext) and EAX (MAC over
+ * the ciphertext). With AES-NI each CBC-MAC block is computed alongside a
+ * counter block.
+ */
+void aes_encrypt_ctr_cbcmac(void *ctx, const struct aes_bs_key *bk, aes_uchar *x, aes_uchar *cb,
+			    const aes_uchar *in, size_t nblocks, aes_uchar *out, int mac_in)
+{
+	aes_uint *rk = ctx;
+	struct aes_bs_key tmp;
+	aes_ulong room;
+	size_t n;
+	int i, features = aes_cpu_features();
+
+	/*
+	 * bitslice the key once here rather than for every group of 8, and only
+	 * if aes_ctr_cbcmac_groups() will use it
+	 */
+	tmp.Nr = 0;
+	if ((features & (AES_CPU_AESNI | AES_CPU_BITSLICE)) == AES_CPU_BITSLICE &&
+	    (bk == NULL || bk->Nr == 0) && nblocks > 8) {
+		aes_ctr_bs_key_init(&tmp, rk);
+		bk = &tmp;
+	}
+
+	/* the backends use inc32, so split where the low 32 bits wrap */
+	while (nblocks) {
+		room = 0x100000000ULL - AES_GET_BE32(cb + 12);
+		n = room < nblocks ? (size_t) room : nblocks;
+#ifdef AES_HAVE_X86_INTRIN
+		if (features & AES_CPU_AESNI)
+			aes_ni_ctr_cbcmac(rk, rk[AES_PRIV_NR_POS], x, cb, in, n, out, mac_in);
+		else
+#endif /* AES_HAVE_X86_INTRIN */
+			aes_ctr_cbcmac_groups(ctx, bk, x, cb, in, n, out, mac_in);
+		if (n == room)
+			for (i = 11; i >= 0 && ++cb[i] == 0; i--)
+				;
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+
+	if (tmp.Nr)
+		memset(&tmp, 0, sizeof(tmp));
+}
+
+
+/**
+ * aes_cbc_mb_lanes - Number of CBC streams encrypted together
+ * Returns: AES_CBC_MB_LANES
+ *
+ * AES-NI interleaves all 8 lanes. The T-table code interleaves 4 lanes with
+ * the same key size, so it also takes 8 to find such groups among mixed keys.
+ */
+int aes_cbc_mb_lanes(void)
+{
+	return AES_CBC_MB_LANES;
+}
+
+
+/**
+ * aes_encrypt_cbc_mb - CBC encrypt full blocks of several independent streams
+ * @rk: Encryption key schedule of each lane
+ * @iv: Chaining block of each lane; updated to the last ciphertext block
+ * @in: Input data of each lane
+ * @out: Output data of each lane (may be the same as in), or %NULL to only
+ *	update iv, as for a CBC-MAC
+ * @nlanes: Number of lanes
+ * @nblocks: Number of 16 byte blocks to encrypt in every lane
+ *
+ * CBC encryption of one stream is serial, so blocks from different lanes are
+ * interleaved instead (see aes_cbc_mb_lanes()).
+ */
+void aes_encrypt_cbc_mb(const aes_uint *rk[], aes_uchar *iv[], const aes_uchar *in[],
+			aes_uchar *out[], size_t nlanes, size_t nblocks)
+{
+#ifdef AES_HAVE_X86_INTRIN
+	if (aes_cpu_features() & AES_CPU_AESNI) {
+		aes_ni_cbc_encrypt_mb(rk, iv, in, out, nlanes, nblocks);
+		return;
+	}
+#endif /* AES_HAVE_X86_INTRIN */
+
+	aes_rijndael_cbc_encrypt_mb(rk, iv, in, out, nlanes, nblocks);
+}
+
+
 void aes_encrypt_deinit(void *ctx)
 {
-	memset(ctx, 0, AES_PRIV_SIZE);
+	aes_key_clear(ctx);
 	free(ctx);
 }
 
@@ -0,0 +1,390 @@
+/*
+ * AES (Rijndael) cipher - AES-NI
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#include "aes.h"
+#include "aes-internal.h"
+
+#include "aes-x86.h"
+
+#ifdef AES_HAVE_X86_INTRIN
+
+static inline AES_NI_TARGET void aes_ni_store_rk(aes_uint *rk, __m128i k, __m128i bswap)
+{
+	_mm_storeu_si128((__m128i *) rk, _mm_shuffle_epi8(k, bswap));
+}
+
+
+/* Key expansion (Intel AES-NI white paper, Gueron) */
+
+static inline AES_NI_TARGET __m128i aes_ni_expand_128(__m128i k, __m128i kg)
+{
+	kg = _mm_shuffle_epi32(kg, 0xff);
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	return _mm_xor_si128(k, kg);
+}
+
+static inline AES_NI_TARGET void aes_ni_expand_192(__m128i *t1, __m128i *t2, __m128i *t3)
+{
+	__m128i t4;
+
+	*t2 = _mm_shuffle_epi32(*t2, 0x55);
+	t4 = _mm_slli_si128(*t1, 4);
+	*t1 = _mm_xor_si128(*t1, t4);
+	t4 = _mm_slli_si128(t4, 4);
+	*t1 = _mm_xor_si128(*t1, t4);
+	t4 = _mm_slli_si128(t4, 4);
+	*t1 = _mm_xor_si128(*t1, t4);
+	*t1 = _mm_xor_si128(*t1, *t2);
+	*t2 = _mm_shuffle_epi32(*t1, 0xff);
+	t4 = _mm_slli_si128(*t3, 4);
+	*t3 = _mm_xor_si128(*t3, t4);
+	*t3 = _mm_xor_si128(*t3, *t2);
+}
+
+static inline AES_NI_TARGET __m128i aes_ni_expand_256_odd(__m128i k, __m128i prev)
+{
+	__m128i kg = _mm_shuffle_epi32(_mm_aeskeygenassist_si128(prev, 0), 0xaa);
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+	return _mm_xor_si128(k, kg);
+}
+
+#define AES_NI_SHUFFLE_PD(a, b, imm) \
+	_mm_castpd_si128(_mm_shuffle_pd(_mm_castsi128_pd(a), _mm_castsi128_pd(b), imm))
+
+
+/**
+ * Expand the cipher key into the encryption key schedule.
+ *
+ * @return	the number of rounds for the given cipher key size.
+ */
+AES_NI_TARGET int aes_ni_key_setup_enc(aes_uint rk[], const aes_uchar cipherKey[], size_t keyBits)
+{
+	const __m128i bswap = aes_ni_bswap32_mask();
+	__m128i ks[15], t1, t2, t3;
+	int i, Nr;
+
+	t1 = _mm_loadu_si128((const __m128i *) cipherKey);
+
+	switch (keyBits) {
+	case 128:
+		Nr = 10;
+		ks[0] = t1;
+#define EXPAND_128(i, rcon) \
+		ks[i] = aes_ni_expand_128(ks[i - 1], _mm_aeskeygenassist_si128(ks[i - 1], rcon))
+		EXPAND_128(1, 0x01);
+		EXPAND_128(2, 0x02);
+		EXPAND_128(3, 0x04);
+		EXPAND_128(4, 0x08);
+		EXPAND_128(5, 0x10);
+		EXPAND_128(6, 0x20);
+		EXPAND_128(7, 0x40);
+		EXPAND_128(8, 0x80);
+		EXPAND_128(9, 0x1b);
+		EXPAND_128(10, 0x36);
+#undef EXPAND_128
+		break;
+	case 192:
+		Nr = 12;
+		t3 = _mm_loadl_epi64((const __m128i *) (cipherKey + 16));
+		ks[0] = t1;
+		ks[1] = t3;
+#define EXPAND_192(i, rcon1, rcon2) \
+		t2 = _mm_aeskeygenassist_si128(t3, rcon1); \
+		aes_ni_expand_192(&t1, &t2, &t3); \
+		ks[i] = AES_NI_SHUFFLE_PD(ks[i], t1, 0); \
+		ks[i + 1] = AES_NI_SHUFFLE_PD(t1, t3, 1); \
+		t2 = _mm_aeskeygenassist_si128(t3, rcon2); \
+		aes_ni_expand_192(&t1, &t2, &t3); \
+		ks[i + 2] = t1; \
+		ks[i + 3] = t3
+		EXPAND_192(1, 0x01, 0x02);
+		EXPAND_192(4, 0x04, 0x08);
+		EXPAND_192(7, 0x10, 0x20);
+#undef EXPAND_192
+		t2 = _mm_aeskeygenassist_si128(t3, 0x40);
+		aes_ni_expand_192(&t1, &t2, &t3);
+		ks[10] = AES_NI_SHUFFLE_PD(ks[10], t1, 0);
+		ks[11] = AES_NI_SHUFFLE_PD(t1, t3, 1);
+		t2 = _mm_aeskeygenassist_si128(t3, 0x80);
+		aes_ni_expand_192(&t1, &t2, &t3);
+		ks[12] = t1;
+		break;
+	case 256:
+		Nr = 14;
+		ks[0] = t1;
+		ks[1] = _mm_loadu_si128((const __m128i *) (cipherKey + 16));
+#define EXPAND_256(i, rcon) \
+		ks[i] = aes_ni_expand_128(ks[i - 2], _mm_aeskeygenassist_si128(ks[i - 1], rcon)); \
+		ks[i + 1] = aes_ni_expand_256_odd(ks[i - 1], ks[i])
+		EXPAND_256(2, 0x01);
+		EXPAND_256(4, 0x02);
+		EXPAND_256(6, 0x04);
+		EXPAND_256(8, 0x08);
+		EXPAND_256(10, 0x10);
+		EXPAND_256(12, 0x20);
+#undef EXPAND_256
+		ks[14] = aes_ni_expand_128(ks[12], _mm_aeskeygenassist_si128(ks[13], 0x40));
+		break;
+	default:
+		return -1;
+	}
+
+	for (i = 0; i <= Nr; i++)
+		aes_ni_store_rk(rk + 4 * i, ks[i], bswap);
+
+	return Nr;
+}
+
+
+/**
+ * Expand the cipher key into the decryption key schedule.
+ *
+ * @return	the number of rounds for the given cipher key size.
+ */
+AES_NI_TARGET int aes_ni_key_setup_dec(aes_uint rk[], const aes_uchar cipherKey[], size_t keyBits)
+{
+	const __m128i bswap = aes_ni_bswap32_mask();
+	__m128i ks[15];
+	int i, Nr;
+
+	/* expand the cipher key: */
+	Nr = aes_ni_key_setup_enc(rk, cipherKey, keyBits);
+	if (Nr < 0)
+		return Nr;
+	for (i = 0; i <= Nr; i++)
+		ks[i] = aes_ni_load_rk(rk + 4 * i, bswap);
+	/* invert the order of the round keys and apply the inverse MixColumn
+	 * transform to all round keys but the first and the last: */
+	aes_ni_store_rk(rk, ks[Nr], bswap);
+	for (i = 1; i < Nr; i++)
+		aes_ni_store_rk(rk + 4 * i, _mm_aesimc_si128(ks[Nr - i]), bswap);
+	aes_ni_store_rk(rk + 4 * Nr, ks[0], bswap);
+
+	return Nr;
+}
+
+
+AES_NI_TARGET void aes_ni_encrypt(const aes_uint rk[], int Nr, const aes_uchar pt[16], aes_uchar ct[16])
+{
+	const __m128i bswap = aes_ni_bswap32_mask();
+	__m128i s;
+	int r;
+
+	s = _mm_xor_si128(_mm_loadu_si128((const __m128i *) pt), aes_ni_load_rk(rk, bswap));
+	for (r = 1; r < Nr; r++)
+		s = _mm_aesenc_si128(s, aes_ni_load_rk(rk + 4 * r, bswap));
+	s = _mm_aesenclast_si128(s, aes_ni_load_rk(rk + 4 * Nr, bswap));
+	_mm_storeu_si128((__m128i *) ct, s);
+}
+
+
+/*
+ * Counter mode with 8 blocks in flight. The counter is kept byte reversed so
+ * that inc32 is a 32-bit lane add that wraps like the big endian counter.
+ */
+AES_NI_TARGET void aes_ni_ctr32(const aes_uint rk[], int Nr, aes_uchar *cb, const aes_uchar *in,
+				size_t nblocks, aes_uchar *out)
+{
+	const __m128i bswap = aes_ni_bswap32_mask();
+	const __m128i rev = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+	__m128i k[15], s[8], ctr;
+	size_t i, n;
+	int r;
+
+	for (r = 0; r <= Nr; r++)
+		k[r] = aes_ni_load_rk(rk + 4 * r, bswap);
+	ctr = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) cb), rev);
+
+	while (nblocks) {
+		n = nblocks < 8 ? nblocks : 8;
+		for (i = 0; i < n; i++) {
+			s[i] = _mm_xor_si128(_mm_shuffle_epi8(ctr, rev), k[0]);
+			ctr = _mm_add_epi32(ctr, one);
+		}
+		for (r = 1; r < Nr; r++)
+			for (i = 0; i < n; i++)
+				s[i] = _mm_aesenc_si128(s[i], k[r]);
+		for (i = 0; i < n; i++) {
+			s[i] = _mm_aesenclast_si128(s[i], k[Nr]);
+			s[i] = _mm_xor_si128(s[i], _mm_loadu_si128((const __m128i *) (in + 16 * i)));
+			_mm_storeu_si128((__m128i *) (out + 16 * i), s[i]);
+		}
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+
+	_mm_storeu_si128((__m128i *) cb, _mm_shuffle_epi8(ctr, rev));
+}
+
+
+/*
+ * CTR plus CBC-MAC in a single pass. The MAC chain is serial, so each of its
+ * blocks is paired with a counter block to keep two AES computations in
+ * flight. When the output is MACed, the MAC of block i runs with the counter
+ * block that produces output block i + 1.
+ */
+AES_NI_TARGET void aes_ni_ctr_cbcmac(const aes_uint rk[], int Nr, aes_uchar *x, aes_uchar *cb,
+				     const aes_uchar *in, size_t nblocks, aes_uchar *out, int mac_in)
+{
+	const __m128i bswap = aes_ni_bswap32_mask();
+	const __m128i rev = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+	__m128i k[15], mac, ctr, s, c, p = _mm_setzero_si128();
+	size_t b;
+	int r, chain;
+
+	for (r = 0; r <= Nr; r++)
+		k[r] = aes_ni_load_rk(rk + 4 * r, bswap);
+	mac = _mm_loadu_si128((const __m128i *) x);
+	ctr = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) cb), rev);
+
+	for (b = 0; b < nblocks; b++) {
+		c = _mm_loadu_si128((const __m128i *) (in + 16 * b));
+		if (mac_in)
+			p = c;
+		chain = mac_in || b > 0;
+
+		s = _mm_xor_si128(_mm_shuffle_epi8(ctr, rev), k[0]);
+		ctr = _mm_add_epi32(ctr, one);
+		if (chain)
+			mac = _mm_xor_si128(_mm_xor_si128(mac, p), k[0]);
+		for (r = 1; r < Nr; r++) {
+			s = _mm_aesenc_si128(s, k[r]);
+			if (chain)
+				mac = _mm_aesenc_si128(mac, k[r]);
+		}
+		s = _mm_xor_si128(_mm_aesenclast_si128(s, k[Nr]), c);
+		if (chain)
+			mac = _mm_aesenclast_si128(mac, k[Nr]);
+
+		_mm_storeu_si128((__m128i *) (out + 16 * b), s);
+		if (!mac_in)
+			p = s;
+	}
+
+	if (!mac_in && nblocks > 0) {
+		mac = _mm_xor_si128(_mm_xor_si128(mac, p), k[0]);
+		for (r = 1; r < Nr; r++)
+			mac = _mm_aesenc_si128(mac, k[r]);
+		mac = _mm_aesenclast_si128(mac, k[Nr]);
+	}
+
+	_mm_storeu_si128((__m128i *) x, mac);
+	_mm_storeu_si128((__m128i *) cb, _mm_shuffle_epi8(ctr, rev));
+}
+
+
+/*
+ * Multi-buffer CBC encryption: one block from each of up to 8 independent
+ * lanes is in flight per round, hiding the aesenc latency that serialises
+ * single-stream CBC. Lanes may use different key sizes; a lane takes its
+ * last round when r reaches its own Nr. With out == NULL only the chaining
+ * values are kept (CBC-MAC).
+ */
+AES_NI_TARGET void aes_ni_cbc_encrypt_mb(const aes_uint *rk[], aes_uchar *iv[], const aes_uchar *in[],
+					 aes_uchar *out[], size_t nlanes, size_t nblocks)
+{
+	const __m128i bswap = aes_ni_bswap32_mask();
+	__m128i k[8][15], s[8];
+	int Nr[8], maxNr;
+	size_t b, i, l, n;
+	int r;
+
+	for (l = 0; l < nlanes; l += n) {
+		n = nlanes - l < 8 ? nlanes - l : 8;
+		maxNr = 0;
+		for (i = 0; i < n; i++) {
+			Nr[i] = rk[l + i][AES_PRIV_NR_POS];
+			for (r = 0; r <= Nr[i]; r++)
+				k[i][r] = aes_ni_load_rk(rk[l + i] + 4 * r, bswap);
+			if (Nr[i] > maxNr)
+				maxNr = Nr[i];
+			s[i] = _mm_loadu_si128((const __m128i *) iv[l + i]);
+		}
+
+		for (b = 0; b < nblocks; b++) {
+			for (i = 0; i < n; i++)
+				s[i] = _mm_xor_si128(_mm_xor_si128(s[i], k[i][0]),
+						     _mm_loadu_si128((const __m128i *) (in[l + i] + 16 * b)));
+			for (r = 1; r <= maxNr; r++)
+				for (i = 0; i < n; i++) {
+					if (r < Nr[i])
+						s[i] = _mm_aesenc_si128(s[i], k[i][r]);
+					else if (r == Nr[i])
+						s[i] = _mm_aesenclast_si128(s[i], k[i][r]);
+				}
+			for (i = 0; out && i < n; i++)
+				_mm_storeu_si128((__m128i *) (out[l + i] + 16 * b), s[i]);
+		}
+
+		for (i = 0; i < n; i++)
+			_mm_storeu_si128((__m128i *) iv[l + i], s[i]);
+	}
+}
+
+
+AES_NI_TARGET void aes_ni_decrypt(const aes_uint rk[], int Nr, const aes_uchar ct[16], aes_uchar pt[16])
+{
+	const __m128i bswap = aes_ni_bswap32_mask();
+	__m128i s;
+	int r;
+
+	s = _mm_xor_si128(_mm_loadu_si128((const __m128i *) ct), aes_ni_load_rk(rk, bswap));
+	for (r = 1; r < Nr; r++)
+		s = _mm_aesdec_si128(s, aes_ni_load_rk(rk + 4 * r, bswap));
+	s = _mm_aesdeclast_si128(s, aes_ni_load_rk(rk + 4 * Nr, bswap));
+	_mm_storeu_si128((__m128i *) pt, s);
+}
+
+
+/*
+ * CBC decryption with 8 blocks in flight. All ciphertext blocks of a group
+ * are loaded before any plaintext is stored, so in may be the same buffer
+ * as out.
+ */
+AES_NI_TARGET void aes_ni_cbc_decrypt(const aes_uint rk[], int Nr, aes_uchar *iv, const aes_uchar *in,
+				      size_t nblocks, aes_uchar *out)
+{
+	const __m128i bswap = aes_ni_bswap32_mask();
+	__m128i k[15], c[8], s[8], prev;
+	size_t i, n;
+	int r;
+
+	for (r = 0; r <= Nr; r++)
+		k[r] = aes_ni_load_rk(rk + 4 * r, bswap);
+	prev = _mm_loadu_si128((const __m128i *) iv);
+
+	while (nblocks) {
+		n = nblocks < 8 ? nblocks : 8;
+		for (i = 0; i < n; i++) {
+			c[i] = _mm_loadu_si128((const __m128i *) (in + 16 * i));
+			s[i] = _mm_xor_si128(c[i], k[0]);
+		}
+		for (r = 1; r < Nr; r++)
+			for (i = 0; i < n; i++)
+				s[i] = _mm_aesdec_si128(s[i], k[r]);
+		for (i = 0; i < n; i++) {
+			s[i] = _mm_aesdeclast_si128(s[i], k[Nr]);
+			s[i] = _mm_xor_si128(s[i], i == 0 ? prev : c[i - 1]);
+			_mm_storeu_si128((__m128i *) (out + 16 * i), s[i]);
+		}
+		prev = c[n - 1];
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+
+	_mm_storeu_si128((__m128i *) iv, prev);
+}
+
+#endif /* AES_HAVE_X86_INTRIN */
@@ -110,12 +110,91 @@ static inline aes_uint rotr(aes_uint val, int bits)
                     (ct)[2] = (aes_uchar)((st) >>  8); \
                     (ct)[3] = (aes_uchar)(st); }
 
+/* dst ^= src for one block, in 64-bit lanes */
+static inline void aes_xor_block(aes_uchar *dst, const aes_uchar *src)
+{
+	aes_ulong d[2], s[2];
+
+	memcpy(d, dst, 16);
+	memcpy(s, src, 16);
+	d[0] ^= s[0];
+	d[1] ^= s[1];
+	memcpy(dst, d, 16);
+}
+
 #define AES_PRIV_SIZE (4 * 4 * 15 + 4)
 #define AES_PRIV_NR_POS (4 * 15)
 
 void aes_rijndael_encrypt(const aes_uint rk[], int Nr, const aes_uchar pt[16], aes_uchar ct[16]);
+void aes_rijndael_encrypt4(const aes_uint rk[], int Nr, const aes_uchar pt[64], aes_uchar ct[64]);
+void aes_rijndael_encrypt4_keys(const aes_uint *rk[4], int Nr, const aes_uchar pt[64], aes_uchar ct[64]);
 void aes_rijndael_decrypt(const aes_uint rk[], int Nr, const aes_uchar ct[16], aes_uchar pt[16]);
+void aes_rijndael_decrypt4(const aes_uint rk[], int Nr, const aes_uchar ct[64], aes_uchar pt[64]);
 int aes_rijndael_key_setup_dec(aes_uint rk[], const aes_uchar cipherKey[], size_t keyBits);
 int aes_rijndael_key_setup_enc(aes_uint rk[], const aes_uchar cipherKey[], size_t keyBits);
+int aes_encrypt_setup(aes_uint rk[], const aes_uchar *key, size_t len);
+/*
+ * Bitsliced key schedule: every round key spread over 8 words of up to two
+ * 64-bit lanes. Nr is 0 when it has not been set up.
+ */
+struct aes_bs_key {
+	aes_ulong sk[2 * 8 * 15] AES_ALIGNED(16);
+	int Nr;
+};
+
+void aes_encrypt_ctr32(void *ctx, aes_uchar *cb, const aes_uchar *in, size_t nblocks,
+		       aes_uchar *out);
+void aes_ctr_bs_key_init(struct aes_bs_key *bk, const aes_uint rk[]);
+void aes_encrypt_ctr32_bs(void *ctx, const struct aes_bs_key *bk, aes_uchar *cb,
+			  const aes_uchar *in, size_t nblocks, aes_uchar *out);
+void aes_encrypt_ctr128_bs(void *ctx, const struct aes_bs_key *bk, aes_uchar *cb,
+			   const aes_uchar *in, size_t nblocks, aes_uchar *out);
+void aes_decrypt_cbc(void *ctx, aes_uchar *iv, const aes_uchar *in, size_t nblocks,
+		     aes_uchar *out);
+void aes_encrypt_ctr_cbcmac(void *ctx, const struct aes_bs_key *bk, aes_uchar *x, aes_uchar *cb,
+			    const aes_uchar *in, size_t nblocks, aes_uchar *out, int mac_in);
+int aes_cbc_mb_lanes(void);
+size_t aes_ccm_aad_hdr(aes_uchar *b, size_t aad_len);
+void aes_omac1_subkeys(void *ctx, aes_uchar *k1, aes_uchar *k2);
+void aes_encrypt_cbc_mb(const aes_uint *rk[], aes_uchar *iv[], const aes_uchar *in[],
+			aes_uchar *out[], size_t nlanes, size_t nblocks);
+
+void aes_bitslice_key_setup(struct aes_bs_key *bk, const aes_uint rk[]);
+void aes_bitslice_ctr32(const struct aes_bs_key *bk, aes_uchar *cb, const aes_uchar *in,
+			size_t nblocks, aes_uchar *out);
+
+/*
+ * GHASH key: hash subkey H, the 4-bit (Shoup) table of its multiples and
+ * the powers H^1..H^16 (GCM byte order) used for aggregated reduction
+ */
+#define AES_GHASH_POWERS 16
+
+struct aes_ghash_key {
+	aes_uchar H[16];
+	aes_ulong HL[16];
+	aes_ulong HH[16];
+	aes_uchar Hpow[AES_GHASH_POWERS][16];
+};
+
+#ifdef AES_HAVE_X86_INTRIN
+void aes_ni_encrypt(const aes_uint rk[], int Nr, const aes_uchar pt[16], aes_uchar ct[16]);
+void aes_ni_decrypt(const aes_uint rk[], int Nr, const aes_uchar ct[16], aes_uchar pt[16]);
+void aes_ni_cbc_decrypt(const aes_uint rk[], int Nr, aes_uchar *iv, const aes_uchar *in, size_t nblocks,
+			aes_uchar *out);
+void aes_ni_cbc_encrypt_mb(const aes_uint *rk[], aes_uchar *iv[], const aes_uchar *in[],
+			   aes_uchar *out[], size_t nlanes, size_t nblocks);
+void aes_ni_ctr_cbcmac(const aes_uint rk[], int Nr, aes_uchar *x, aes_uchar *cb, const aes_uchar *in,
+		       size_t nblocks, aes_uchar *out, int mac_in);
+void aes_ni_ctr32(const aes_uint rk[], int Nr, aes_uchar *cb, const aes_uchar *in, size_t nblocks,
+		  aes_uchar *out);
+int aes_ni_key_setup_dec(aes_uint rk[], const aes_uchar cipherKey[], size_t keyBits);
+int aes_ni_key_setup_enc(aes_uint rk[], const aes_uchar cipherKey[], size_t keyBits);
+void aes_ghash_clmul(const struct aes_ghash_key *hk, const aes_uchar *x, size_t nblocks, aes_uchar *y);
+void aes_gcm_clmul_crypt(const aes_uint rk[], const struct aes_ghash_key *hk, aes_uchar *cb,
+			 const aes_uchar *in, size_t nblocks, aes_uchar *out, aes_uchar *y, int encrypt);
+void aes_ghash_vpclmul(const struct aes_ghash_key *hk, const aes_uchar *x, size_t nblocks, aes_uchar *y);
+void aes_gcm_vaes_crypt(const aes_uint rk[], const struct aes_ghash_key *hk, aes_uchar *cb,
+			const aes_uchar *in, size_t nblocks, aes_uchar *out, aes_uchar *y, int encrypt);
+#endif /* AES_HAVE_X86_INTRIN */
 
 #endif /* AES_I_H */
@@ -1,5 +1,5 @@
 /*
- * One-key CBC MAC (OMAC1) hash with AES-128
+ * One-key CBC MAC (OMAC1) hash with AES
  *
  * Copyright (c) 2003-2007, Jouni Malinen <j@w1.fi>
  *
@@ -23,8 +23,76 @@ static void gf_mulx(aes_uchar *pad)
 
 
 /**
- * omac1_aes_128_vector - One-Key CBC MAC (OMAC1) hash with AES-128
- * @key: 128-bit key for the hash operation
+ * aes_omac1_subkeys - Derive the OMAC1 (CMAC) subkeys
+ * @ctx: Context pointer from aes_encrypt_init()
+ * @k1: Buffer for K1 = L.u, XORed into a complete last block (16 bytes)
+ * @k2: Buffer for K2 = L.u^2, XORed into a padded last block (16 bytes)
+ *
+ * L = E(K, 0^128). The subkeys depend only on the key and may be reused for
+ * any number of messages.
+ */
+void aes_omac1_subkeys(void *ctx, aes_uchar *k1, aes_uchar *k2)
+{
+	memset(k1, 0, AES_BLOCK_SIZE);
+	aes_encrypt(ctx, k1, k1);
+	gf_mulx(k1);
+	memcpy(k2, k1, AES_BLOCK_SIZE);
+	gf_mulx(k2);
+}
+
+
+/*
+ * CBC-MAC the data into cbc, holding back the last block (complete or not)
+ * in buf until aes_cmac_finish() knows which subkey it takes
+ */
+static void aes_cmac_absorb(void *ctx, aes_uchar *cbc, aes_uchar *buf, size_t *buf_len,
+			    const aes_uchar *data, size_t len)
+{
+	size_t n;
+
+	if (*buf_len < AES_BLOCK_SIZE) {
+		n = AES_BLOCK_SIZE - *buf_len;
+		if (n > len)
+			n = len;
+		memcpy(buf + *buf_len, data, n);
+		*buf_len += n;
+		data += n;
+		len -= n;
+	}
+	if (len == 0)
+		return;
+
+	aes_xor_block(cbc, buf);
+	aes_encrypt(ctx, cbc, cbc);
+	while (len > AES_BLOCK_SIZE) {
+		aes_xor_block(cbc, data);
+		aes_encrypt(ctx, cbc, cbc);
+		data += AES_BLOCK_SIZE;
+		len -= AES_BLOCK_SIZE;
+	}
+	memcpy(buf, data, len);
+	*buf_len = len;
+}
+
+
+static void aes_cmac_finish(void *ctx, const aes_uchar *k1, const aes_uchar *k2, aes_uchar *cbc,
+			    aes_uchar *buf, size_t buf_len, aes_uchar *mac)
+{
+	if (buf_len == AES_BLOCK_SIZE) {
+		aes_xor_block(buf, k1);
+	} else {
+		buf[buf_len] = 0x80;
+		memset(buf + buf_len + 1, 0, AES_BLOCK_SIZE - buf_len - 1);
+		aes_xor_block(buf, k2);
+	}
+	aes_xor_block(cbc, buf);
+	aes_encrypt(ctx, cbc, mac);
+}
+
+
+/**
+ * omac1_aes_vector - One-Key CBC MAC (OMAC1) hash with an expanded AES key
+ * @key: Encryption key schedule from aes_encrypt_key_init()
  * @num_elem: Number of elements in the data vector
  * @addr: Pointers to the data areas
  * @len: Lengths of the data blocks
@@ -35,64 +103,221 @@ static void gf_mulx(aes_uchar *pad)
  * OMAC1 was standardized with the name CMAC by NIST in a Special Publication
  * (SP) 800-38B.
  */
-int omac1_aes_128_vector(const aes_uchar *key, size_t num_elem,
-			 const aes_uchar *addr[], const size_t *len, aes_uchar *mac)
+int omac1_aes_vector(const struct aes_key *key, size_t num_elem,
+		     const aes_uchar *addr[], const size_t *len, aes_uchar *mac)
 {
-	void *ctx;
-	aes_uchar cbc[AES_BLOCK_SIZE], pad[AES_BLOCK_SIZE];
-	const aes_uchar *pos, *end;
-	size_t i, e, left, total_len;
+	void *ctx = (void *) key;
+	aes_uchar cbc[AES_BLOCK_SIZE], buf[AES_BLOCK_SIZE];
+	aes_uchar k1[AES_BLOCK_SIZE], k2[AES_BLOCK_SIZE];
+	size_t e, buf_len = 0;
 
-	ctx = aes_encrypt_init(key, 16);
-	if (ctx == NULL)
-		return -1;
+	aes_omac1_subkeys(ctx, k1, k2);
 	memset(cbc, 0, AES_BLOCK_SIZE);
-
-	total_len = 0;
 	for (e = 0; e < num_elem; e++)
-		total_len += len[e];
-	left = total_len;
-
-	e = 0;
-	pos = addr[0];
-	end = pos + len[0];
-
-	while (left >= AES_BLOCK_SIZE) {
-		for (i = 0; i < AES_BLOCK_SIZE; i++) {
-			cbc[i] ^= *pos++;
-			if (pos >= end) {
-				e++;
-				pos = addr[e];
-				end = pos + len[e];
+		aes_cmac_absorb(ctx, cbc, buf, &buf_len, addr[e], len[e]);
+	aes_cmac_finish(ctx, k1, k2, cbc, buf, buf_len, mac);
+	return 0;
+}
+
+
+/**
+ * omac1_aes - One-Key CBC MAC (OMAC1) hash with an expanded AES key
+ * @key: Encryption key schedule from aes_encrypt_key_init()
+ * @data: Data buffer for which a MAC is determined
+ * @data_len: Length of data buffer in bytes
+ * @mac: Buffer for MAC (128 bits, i.e., 16 bytes)
+ * Returns: 0 on success, -1 on failure
+ */
+int omac1_aes(const struct aes_key *key, const aes_uchar *data, size_t data_len, aes_uchar *mac)
+{
+	return omac1_aes_vector(key, 1, &data, &data_len, mac);
+}
+
+
+/**
+ * aes_cmac_ctx_init - Expand an AES-CMAC key and derive its subkeys
+ * @ctx: Key context to initialize (e.g., on the stack)
+ * @key: AES key
+ * @key_len: Length of the key in bytes (16, 24 or 32)
+ * Returns: 0 on success, -1 on failure
+ *
+ * The context is read-only after initialization and may be shared by any
+ * number of messages (and threads). Clear it with aes_cmac_ctx_clear().
+ */
+int aes_cmac_ctx_init(struct aes_cmac_ctx *ctx, const aes_uchar *key, size_t key_len)
+{
+	if (aes_encrypt_key_init(&ctx->key, key, key_len) < 0)
+		return -1;
+	aes_omac1_subkeys(&ctx->key, ctx->k1, ctx->k2);
+	return 0;
+}
+
+
+void aes_cmac_ctx_clear(struct aes_cmac_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+
+/**
+ * aes_cmac_init - Start an incremental AES-CMAC computation
+ * @st: Message state to initialize
+ * @ctx: Key context from aes_cmac_ctx_init(); must outlive the message
+ */
+void aes_cmac_init(struct aes_cmac_stream *st, const struct aes_cmac_ctx *ctx)
+{
+	memset(st, 0, sizeof(*st));
+	st->ctx = ctx;
+}
+
+
+/**
+ * aes_cmac_update - Add data to an incremental AES-CMAC computation
+ * @st: Message state from aes_cmac_init()
+ * @data: Data; may be split into chunks of any length
+ * @len: Length of data in bytes
+ */
+void aes_cmac_update(struct aes_cmac_stream *st, const aes_uchar *data, size_t len)
+{
+	aes_cmac_absorb((void *) &st->ctx->key, st->cbc, st->buf, &st->buf_len, data, len);
+}
+
+
+/**
+ * aes_cmac_final - Finish an incremental AES-CMAC computation
+ * @st: Message state from aes_cmac_init(); cleared on return
+ * @mac: Buffer for MAC (128 bits, i.e., 16 bytes)
+ */
+void aes_cmac_final(struct aes_cmac_stream *st, aes_uchar *mac)
+{
+	const struct aes_cmac_ctx *ctx = st->ctx;
+
+	aes_cmac_finish((void *) &ctx->key, ctx->k1, ctx->k2, st->cbc, st->buf, st->buf_len, mac);
+	memset(st, 0, sizeof(*st));
+}
+
+
+/**
+ * aes_cmac - AES-CMAC of a single buffer with a precomputed key context
+ * @ctx: Key context from aes_cmac_ctx_init()
+ * @data: Data buffer for which a MAC is determined
+ * @data_len: Length of data buffer in bytes
+ * @mac: Buffer for MAC (128 bits, i.e., 16 bytes)
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_cmac(const struct aes_cmac_ctx *ctx, const aes_uchar *data, size_t data_len, aes_uchar *mac)
+{
+	struct aes_cmac_stream st;
+
+	aes_cmac_init(&st, ctx);
+	aes_cmac_update(&st, data, data_len);
+	aes_cmac_final(&st, mac);
+	return 0;
+}
+
+
+/**
+ * aes_cmac_multi - AES-CMAC of several independent messages
+ * @ctx: Key context of each message from aes_cmac_ctx_init()
+ * @num: Number of messages
+ * @data: Data of each message
+ * @len: Length of each message in bytes
+ * @mac: Buffer for the MAC of each message (16 bytes each)
+ *
+ * A CMAC chain is serial, so groups of messages are run through
+ * aes_encrypt_cbc_mb() one block from each message at a time. Messages of
+ * up to 16 bytes take a single interleaved step for the whole group.
+ */
+void aes_cmac_multi(const struct aes_cmac_ctx *ctx[], size_t num, const aes_uchar *data[],
+		    const size_t len[], aes_uchar *mac[])
+{
+	const aes_uint *rk[AES_CBC_MB_LANES], *rk_a[AES_CBC_MB_LANES];
+	const aes_uchar *in[AES_CBC_MB_LANES], *in_a[AES_CBC_MB_LANES];
+	aes_uchar cbc[AES_CBC_MB_LANES][AES_BLOCK_SIZE], last[AES_CBC_MB_LANES][AES_BLOCK_SIZE];
+	aes_uchar *iv[AES_CBC_MB_LANES], *iv_a[AES_CBC_MB_LANES];
+	size_t left[AES_CBC_MB_LANES], g, i, n, na, m, rem;
+	size_t lanes = aes_cbc_mb_lanes();
+
+	for (g = 0; g < num; g += n) {
+		n = num - g < lanes ? num - g : lanes;
+		for (i = 0; i < n; i++) {
+			memset(cbc[i], 0, AES_BLOCK_SIZE);
+			rk[i] = ctx[g + i]->key.rk;
+			iv[i] = cbc[i];
+			in[i] = data[g + i];
+			left[i] = len[g + i] ? (len[g + i] - 1) / AES_BLOCK_SIZE : 0;
+		}
+
+		/* all but the last block, for the shortest remaining length at a time */
+		for (;;) {
+			na = 0;
+			m = (size_t) -1;
+			for (i = 0; i < n; i++) {
+				if (left[i] == 0)
+					continue;
+				if (left[i] < m)
+					m = left[i];
+				rk_a[na] = rk[i];
+				iv_a[na] = iv[i];
+				in_a[na++] = in[i];
+			}
+			if (na == 0)
+				break;
+			aes_encrypt_cbc_mb(rk_a, iv_a, in_a, NULL, na, m);
+			for (i = 0; i < n; i++) {
+				if (left[i] == 0)
+					continue;
+				in[i] += AES_BLOCK_SIZE * m;
+				left[i] -= m;
 			}
 		}
-		if (left > AES_BLOCK_SIZE)
-			aes_encrypt(ctx, cbc, cbc);
-		left -= AES_BLOCK_SIZE;
-	}
 
-	memset(pad, 0, AES_BLOCK_SIZE);
-	aes_encrypt(ctx, pad, pad);
-	gf_mulx(pad);
-
-	if (left || total_len == 0) {
-		for (i = 0; i < left; i++) {
-			cbc[i] ^= *pos++;
-			if (pos >= end) {
-				e++;
-				pos = addr[e];
-				end = pos + len[e];
+		/* last block with K1 or with padding and K2 */
+		for (i = 0; i < n; i++) {
+			rem = len[g + i] - (in[i] - data[g + i]);
+			if (rem)
+				memcpy(last[i], in[i], rem);
+			if (rem == AES_BLOCK_SIZE) {
+				aes_xor_block(last[i], ctx[g + i]->k1);
+			} else {
+				last[i][rem] = 0x80;
+				memset(last[i] + rem + 1, 0, AES_BLOCK_SIZE - rem - 1);
+				aes_xor_block(last[i], ctx[g + i]->k2);
 			}
+			in[i] = last[i];
 		}
-		cbc[left] ^= 0x80;
-		gf_mulx(pad);
+		aes_encrypt_cbc_mb(rk, iv, in, NULL, n, 1);
+
+		for (i = 0; i < n; i++)
+			memcpy(mac[g + i], cbc[i], AES_BLOCK_SIZE);
 	}
+}
 
-	for (i = 0; i < AES_BLOCK_SIZE; i++)
-		pad[i] ^= cbc[i];
-	aes_encrypt(ctx, pad, mac);
-	aes_encrypt_deinit(ctx);
-	return 0;
+
+/**
+ * omac1_aes_128_vector - One-Key CBC MAC (OMAC1) hash with AES-128
+ * @key: 128-bit key for the hash operation
+ * @num_elem: Number of elements in the data vector
+ * @addr: Pointers to the data areas
+ * @len: Lengths of the data blocks
+ * @mac: Buffer for MAC (128 bits, i.e., 16 bytes)
+ * Returns: 0 on success, -1 on failure
+ *
+ * This is a mode for using block cipher (AES in this case) for authentication.
+ * OMAC1 was standardized with the name CMAC by NIST in a Special Publication
+ * (SP) 800-38B.
+ */
+int omac1_aes_128_vector(const aes_uchar *key, size_t num_elem,
+			 const aes_uchar *addr[], const size_t *len, aes_uchar *mac)
+{
+	struct aes_key ctx;
+	int ret;
+
+	if (aes_encrypt_key_init(&ctx, key, 16) < 0)
+		return -1;
+	ret = omac1_aes_vector(&ctx, num_elem, addr, len, mac);
+	aes_key_clear(&ctx);
+	return ret;
 }
 
 
@@ -7,6 +7,7 @@
 #include <sys/stat.h>
 
 #include <iomanip>
+#include <fstream>
 #include <sstream>
 #include <memory>
 #include <string>
@@ -14,6 +15,8 @@
 #include <map>
 #include <set>
 #include <chrono>
+#include <functional>
+#include <thread>
 
 #include "aes.h"
 #include "logging.h"
@@ -21,8 +24,209 @@
 
 using namespace std::chrono;
 
+/* aes_opencl_config */
+
+// kernel variant (see the top of aes.cl) and local work size, tuned per device
+struct aes_opencl_config
+{
+    int vec;
+    int small_tables;
+    int small_tables_local;
+    int key_local;
+    int uchar_swizzle;
+    size_t local_size;
+
+    aes_opencl_config() : vec(0), small_tables(0), small_tables_local(1), key_local(0), uchar_swizzle(1), local_size(256) {}
+
+    // aes.cl and aes_vec.cl (uint4 state) provide the same ECB and CTR kernels
+    static const char* sourceName(int vec)
+    {
+        return vec ? "src/aes_vec.cl" : "src/aes.cl";
+    }
+
+    const char* source() const
+    {
+        return sourceName(vec);
+    }
+
+    std::string options() const
+    {
+        std::stringstream ss;
+        ss << "-DAES_SMALL_TABLES=" << small_tables
+           << " -DAES_SMALL_TABLES_LOCAL=" << small_tables_local
+           << " -DAES_KEY_LOCAL=" << key_local
+           << " -DAES_USE_UCHAR_SWIZZLE=" << uchar_swizzle;
+        return ss.str();
+    }
+
+    std::string toString() const
+    {
+        std::stringstream ss;
+        ss << source() << " " << options() << " local_size=" << local_size;
+        return ss.str();
+    }
+};
+
+
+/* aes_opencl_batch */
+
+// host side of aes_rijndael_ctr_batch in aes.cl, the layouts must match
+struct aes_batch_desc
+{
+    cl_uint4 cb;
+    cl_ulong offset;
+    cl_ulong length;
+    cl_uint key_index;
+    cl_uint ctr32;
+    cl_ulong first_block;
+};
+
+// Collects short CTR messages with their own keys and encrypts them with one
+// kernel launch per batch. Messages are packed at 16 byte aligned offsets in
+// a staging buffer and key schedules are uploaded once per batch, however
+// many messages use them. A batch is submitted when it would overflow or on
+// flush(); output pointers are written when the batch completes.
+struct aes_opencl_batch
+{
+    struct message
+    {
+        aes_uchar *out;
+        size_t offset;
+        size_t length;
+    };
+
+    opencl_context_ptr clctx;
+    opencl_command_queue_ptr queue;
+    opencl_kernel_ptr kernel;
+    size_t local_size;
+    size_t blocks_per_item;
+    size_t max_bytes;
+    size_t max_msgs;
+    size_t max_keys;
+
+    opencl_buffer_ptr rk_buf;
+    opencl_buffer_ptr desc_buf;
+    opencl_buffer_ptr in_buf;
+    opencl_buffer_ptr out_buf;
+
+    std::vector<aes_uint> rk_table;
+    std::map<const struct aes_key*, cl_uint> key_index;
+    std::vector<aes_batch_desc> desc;
+    std::vector<message> msgs;
+    std::vector<aes_uchar> staging;
+    size_t staged;
+    size_t num_blocks;
+    size_t num_batches;
+
+    aes_opencl_batch(opencl_context_ptr clctx, opencl_command_queue_ptr queue, opencl_program_ptr program,
+                     size_t local_size, size_t blocks_per_item, size_t max_bytes, size_t max_msgs, size_t max_keys)
+        : clctx(clctx), queue(queue), kernel(program->createKernel("aes_rijndael_ctr_batch")),
+          local_size(local_size), blocks_per_item(blocks_per_item),
+          max_bytes(max_bytes), max_msgs(max_msgs), max_keys(max_keys),
+          staging(max_bytes), staged(0), num_blocks(0), num_batches(0)
+    {
+        rk_buf = clctx->createBuffer(CL_MEM_READ_ONLY, max_keys * AES_PRIV_SIZE, NULL);
+        desc_buf = clctx->createBuffer(CL_MEM_READ_ONLY, max_msgs * sizeof(aes_batch_desc), NULL);
+        in_buf = clctx->createBuffer(CL_MEM_READ_ONLY, max_bytes, NULL);
+        out_buf = clctx->createBuffer(CL_MEM_WRITE_ONLY, max_bytes, NULL);
+    }
+
+    // queue len bytes of in for encryption with key and initial counter block
+    // nonce, or submit the batch first if the message does not fit
+    bool add(const struct aes_key *key, const aes_uchar *nonce, const aes_uchar *in, aes_uchar *out, size_t len)
+    {
+        size_t padded = (len + 15) & ~(size_t)15;
+        if (padded > max_bytes) {
+            log_error("%s: message of %ld bytes exceeds the batch size", __func__, len);
+            return false;
+        }
+        bool new_key = key_index.find(key) == key_index.end();
+        if (staged + padded > max_bytes || msgs.size() == max_msgs || (new_key && key_index.size() == max_keys)) {
+            if (!flush()) return false;
+            new_key = true;
+        }
+        if (new_key) {
+            key_index[key] = (cl_uint)key_index.size();
+            rk_table.insert(rk_table.end(), key->rk, key->rk + AES_PRIV_SIZE / sizeof(aes_uint));
+        }
+
+        aes_batch_desc d;
+        for (int j = 0; j < 4; j++) {
+            d.cb.s[j] = AES_GET_BE32(nonce + 4 * j);
+        }
+        d.offset = staged;
+        d.length = len;
+        d.key_index = key_index[key];
+        d.ctr32 = 0;
+        d.first_block = num_blocks;
+        desc.push_back(d);
+
+        memcpy(&staging[staged], in, len);
+        msgs.push_back(message{ out, staged, len });
+        staged += padded;
+        num_blocks += padded / 16;
+        return true;
+    }
+
+    // encrypt the queued messages and copy them to their output buffers
+    bool flush()
+    {
+        if (num_blocks == 0) {
+            reset();
+            return true;
+        }
+
+        cl_uint num_msgs = (cl_uint)desc.size();
+        cl_ulong total_blocks = num_blocks;
+        size_t per_group = local_size * blocks_per_item;
+        size_t groups = (num_blocks + per_group - 1) / per_group;
+
+        kernel->setArg(0, rk_buf);
+        kernel->setArg(1, desc_buf);
+        kernel->setArg(2, sizeof(num_msgs), &num_msgs);
+        kernel->setArg(3, sizeof(total_blocks), &total_blocks);
+        kernel->setArg(4, in_buf);
+        kernel->setArg(5, out_buf);
+
+        queue->enqueueWriteBuffer(rk_buf, false, 0, rk_table.size() * sizeof(aes_uint), &rk_table[0]);
+        queue->enqueueWriteBuffer(desc_buf, false, 0, desc.size() * sizeof(aes_batch_desc), &desc[0]);
+        queue->enqueueWriteBuffer(in_buf, false, 0, staged, &staging[0]);
+        opencl_event_ptr launched = queue->enqueueNDRangeKernel(kernel, opencl_dim(groups * local_size), opencl_dim(local_size));
+        opencl_event_ptr done = launched ? queue->enqueueReadBuffer(out_buf, true, 0, staged, &staging[0]) : opencl_event_ptr();
+        if (!done) {
+            // the writes may still be reading the staging buffer
+            queue->finish();
+            reset();
+            return false;
+        }
+        done->wait();
+
+        for (const message &m : msgs) {
+            memcpy(m.out, &staging[m.offset], m.length);
+        }
+        num_batches++;
+        reset();
+        return true;
+    }
+
+    void reset()
+    {
+        rk_table.clear();
+        key_index.clear();
+        desc.clear();
+        msgs.clear();
+        staged = 0;
+        num_blocks = 0;
+    }
+};
+
+
 /* aes_opencl_test */
 
+// tuned configurations, one line per device:
+// name <tab> driver version <tab> small_tables small_tables_local key_local uchar_swizzle local_size
+static const char *tune_file = "aes-opencl-test.tune";
+
 struct aes_opencl_test
 {
     opencl_ptr cl;
@@ -30,6 +234,7 @@ struct aes_opencl_test
     opencl_device_ptr chosen_device;
     opencl_context_ptr clctx;
     opencl_command_queue_ptr clcmdqueue;
+    aes_opencl_config config;
     
     void initCL()
     {
@@ -37,7 +242,12 @@ struct aes_opencl_test
         cl = opencl_ptr(new opencl());
         gpu_devices = cl->getDevices("gpu");
         if (gpu_devices.size() == 0) {
-            log_error_exit("no OpenCL gpu devices found");
+            // e.g. pocl on a host without a GPU
+            log_debug("no OpenCL gpu devices found, trying any device");
+            gpu_devices = cl->getDevices("any");
+        }
+        if (gpu_devices.size() == 0) {
+            log_error_exit("no OpenCL devices found");
         }
         
         // find device with largest workgroup size
@@ -51,12 +261,205 @@ struct aes_opencl_test
         log_debug("using device: %s", chosen_device->getName().c_str());
         chosen_device->print();
         
-        // create context
-        opencl_device_list use_devices{ chosen_device };
+        // create context with every matching device on the chosen device's platform
+        opencl_device_list use_devices;
+        for (opencl_device_ptr device : gpu_devices) {
+            if (device->getPlatform() == chosen_device->getPlatform()) {
+                use_devices.push_back(device);
+            }
+        }
+        log_debug("context with %ld device(s)", use_devices.size());
         clctx = cl->createContext(use_devices, false);
+        clctx->setBinaryCacheDir("aes-opencl-cache");
         clcmdqueue = clctx->createCommandQueue(chosen_device, 0);
+
+        // tuned kernel variant, or the defaults from aes.cl
+        if (loadConfig()) {
+            log_debug("using tuned config: %s", config.toString().c_str());
+        } else {
+            log_debug("no tuned config in %s, run with --tune", tune_file);
+        }
+        while (config.local_size > chosen_device->getMaxWorkGroupSize()) config.local_size >>= 1;
+    }
+
+    std::string deviceKey()
+    {
+        return chosen_device->getName() + "\t" + chosen_device->getDriverVersion() + "\t";
+    }
+
+    bool loadConfig()
+    {
+        std::ifstream in(tune_file);
+        std::string line, key = deviceKey();
+        while (std::getline(in, line)) {
+            if (line.compare(0, key.size(), key) != 0) continue;
+            std::istringstream ss(line.substr(key.size()));
+            aes_opencl_config c;
+            if (ss >> c.small_tables >> c.small_tables_local >> c.key_local >> c.uchar_swizzle >> c.local_size) {
+                // entries saved before aes_vec.cl was tuned have no source field
+                if (!(ss >> c.vec)) c.vec = 0;
+                config = c;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void saveConfig()
+    {
+        // keep the entries of other devices and driver versions
+        std::vector<std::string> lines;
+        std::string line, key = deviceKey();
+        std::ifstream in(tune_file);
+        while (std::getline(in, line)) {
+            if (line.compare(0, key.size(), key) != 0) lines.push_back(line);
+        }
+        in.close();
+
+        std::stringstream ss;
+        ss << key << config.small_tables << " " << config.small_tables_local << " " << config.key_local << " "
+           << config.uchar_swizzle << " " << config.local_size << " " << config.vec;
+        lines.push_back(ss.str());
+
+        std::ofstream out(tune_file, std::ios::trunc);
+        for (const std::string &l : lines) {
+            out << l << "\n";
+        }
+        if (!out) {
+            log_error("failed to write %s", tune_file);
+        }
     }
     
+    // blocks per work-item for a launch over nblocks: keep at least four
+    // work-groups per compute unit and spend the remaining parallelism on
+    // amortizing the per work-group table and round key staging. Buffers
+    // must hold a whole number of work-groups of blocks.
+    int blocksPerItem(size_t nblocks, size_t local_size)
+    {
+        size_t min_groups = 4 * chosen_device->getMaxComputeUnits();
+        int n = 1;
+        while (n < 16 && nblocks / (2 * n * local_size) >= min_groups) {
+            n *= 2;
+        }
+        log_debug("%s: %d blocks per work-item for %ld blocks", __func__, n, nblocks);
+        return n;
+    }
+
+    std::string programOptions(int blocks_per_item)
+    {
+        return config.options() + " -DAES_BLOCKS_PER_ITEM=" + std::to_string(blocks_per_item);
+    }
+
+    // build source for a launch over nblocks with the tuned local size cut to
+    // the largest power of two that every kernel in kernel_names can run with
+    // on the chosen device: the tuner only checks aes_rijndael_ctr, and kernels
+    // with more registers or local memory may allow smaller work-groups. The
+    // blocks per work-item depend on the local size, so rebuild until it fits.
+    opencl_program_ptr buildProgram(const char *source, size_t nblocks, const std::vector<std::string> &kernel_names,
+                                    size_t &local_size, int &bpi)
+    {
+        local_size = config.local_size;
+        for (;;) {
+            bpi = blocksPerItem(nblocks, local_size);
+            opencl_program_ptr program = clctx->createProgram(source, programOptions(bpi));
+            size_t limit = local_size, fit = 1;
+            for (const std::string &name : kernel_names) {
+                opencl_kernel_ptr kernel = program->getKernel(name);
+                if (!kernel) log_error_exit("%s: no kernel %s in %s", __func__, name.c_str(), source);
+                limit = std::min(limit, kernel->getWorkGroupSize(chosen_device));
+            }
+            while (fit * 2 <= limit) fit <<= 1;
+            if (fit == local_size) return program;
+            log_debug("%s: %s: local size %ld -> %ld", __func__, source, local_size, fit);
+            local_size = fit;
+        }
+    }
+
+    // time the CTR kernel of aes.cl and aes_vec.cl for every kernel variant
+    // and power of two local size the device allows, using event profiling,
+    // and save the fastest
+    void tune()
+    {
+        static const int num_runs = 3;
+        static const aes_uchar key[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
+        static const size_t MEGA_BYTE = 1024 * 1024;
+        static const size_t DATA_SIZE = 8 * MEGA_BYTE;
+        // large tables, small tables, small tables in local memory
+        static const int tables[3][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 } };
+
+        opencl_command_queue_ptr profqueue = clctx->createCommandQueue(chosen_device, CL_QUEUE_PROFILING_ENABLE);
+
+        struct aes_key rk;
+        if (aes_encrypt_key_init(&rk, key, 16) < 0) log_error_exit("aes_encrypt_key_init failed");
+        cl_int Nr = rk.rk[AES_PRIV_NR_POS];
+        cl_uint4 cb = {{ 0, 0, 0, 0 }};
+        cl_ulong block_offset = 0;
+
+        opencl_buffer_ptr rk_buf = clctx->createBuffer(CL_MEM_READ_ONLY, AES_PRIV_SIZE, NULL);
+        opencl_buffer_ptr in_buf = clctx->createBuffer(CL_MEM_READ_WRITE, DATA_SIZE, NULL);
+        opencl_buffer_ptr out_buf = clctx->createBuffer(CL_MEM_READ_WRITE, DATA_SIZE, NULL);
+        profqueue->enqueueWriteBuffer(rk_buf, true, 0, AES_PRIV_SIZE, rk.rk)->wait();
+
+        aes_opencl_config best;
+        cl_ulong best_time = 0;
+
+        for (int vec = 0; vec <= 1; vec++) {
+            for (int t = 0; t < 3; t++) {
+                for (int key_local = 0; key_local <= 1; key_local++) {
+                    for (int uchar_swizzle = 0; uchar_swizzle <= 1; uchar_swizzle++) {
+                        config.vec = vec;
+                        config.small_tables = tables[t][0];
+                        config.small_tables_local = tables[t][1];
+                        config.key_local = key_local;
+                        config.uchar_swizzle = uchar_swizzle;
+
+                        for (size_t local_size = 16; local_size <= chosen_device->getMaxWorkGroupSize(); local_size <<= 1) {
+                            config.local_size = local_size;
+                            const int bpi = blocksPerItem(DATA_SIZE / 16, local_size);
+                            opencl_program_ptr aesprog = clctx->createProgram(config.source(), programOptions(bpi));
+                            opencl_kernel_ptr kernel = aesprog->getKernel("aes_rijndael_ctr");
+                            if (!kernel || local_size > kernel->getWorkGroupSize(chosen_device)) break;
+
+                            kernel->setArg(0, rk_buf);
+                            kernel->setArg(1, Nr);
+                            kernel->setArg(2, sizeof(cb), &cb);
+                            kernel->setArg(3, sizeof(block_offset), &block_offset);
+                            kernel->setArg(4, (cl_int)0);
+                            kernel->setArg(5, in_buf);
+                            kernel->setArg(6, out_buf);
+
+                            // best of num_runs, device time only
+                            cl_ulong time = 0;
+                            for (int i = 0; i < num_runs; i++) {
+                                opencl_event_ptr event = profqueue->enqueueNDRangeKernel(kernel, opencl_dim(DATA_SIZE / 16 / bpi), opencl_dim(local_size));
+                                if (!event) break;
+                                event->wait();
+                                openclProfilingInfo info = event->getProfilingInfo();
+                                if (time == 0 || info.end - info.start < time) time = info.end - info.start;
+                            }
+                            if (time == 0) continue;
+
+                            log_debug("tune %s: %f MB/sec", config.toString().c_str(), DATA_SIZE / MEGA_BYTE / (time / 1e9));
+                            if (best_time == 0 || time < best_time) {
+                                best_time = time;
+                                best = config;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        aes_key_clear(&rk);
+
+        if (best_time == 0) {
+            log_error_exit("tune: no kernel variant ran");
+        }
+        config = best;
+        log_debug("tune best %s: %f MB/sec", config.toString().c_str(), DATA_SIZE / MEGA_BYTE / (best_time / 1e9));
+        saveConfig();
+    }
+
     void testCL()
     {
         int a[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
@@ -86,16 +489,20 @@ struct aes_opencl_test
         log_debug("%s Add Test: %s", __func__, error ? "Failed" : "Success");
     }
 
-    void testAES()
+    void testAES(const char *source)
     {
-        opencl_program_ptr aesprog = clctx->createProgram("src/aes.cl");
-        opencl_kernel_ptr aes_rijndael_encrypt_kernel = aesprog->getKernel("aes_rijndael_encrypt");
-        opencl_kernel_ptr aes_rijndael_decrypt_kernel = aesprog->getKernel("aes_rijndael_decrypt");
-        
         static const int num_runs = 5;
         static const aes_uchar key[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
         static const size_t MEGA_BYTE = 1024 * 1024;
         static const size_t DATA_SIZE = 32 * MEGA_BYTE;
+
+        size_t local_size;
+        int bpi;
+        log_debug("%s: %s", __func__, source);
+        opencl_program_ptr aesprog = buildProgram(source, DATA_SIZE / 16, { "aes_rijndael_encrypt", "aes_rijndael_decrypt" },
+                                                  local_size, bpi);
+        opencl_kernel_ptr aes_rijndael_encrypt_kernel = aesprog->getKernel("aes_rijndael_encrypt");
+        opencl_kernel_ptr aes_rijndael_decrypt_kernel = aesprog->getKernel("aes_rijndael_decrypt");
         
         aes_uchar *pt = new aes_uchar[DATA_SIZE];
         if (!pt) log_error_exit("pt alloc_failed");
@@ -112,7 +519,8 @@ struct aes_opencl_test
         if (!dt) log_error_exit("pt alloc_failed");
         memset((void*)dt, 0x00, DATA_SIZE);
         
-        void *rk = aes_encrypt_init(key, 16);
+        struct aes_key rk;
+        if (aes_encrypt_key_init(&rk, key, 16) < 0) log_error_exit("aes_encrypt_key_init failed");
 
         opencl_buffer_ptr rk_buf = clctx->createBuffer(CL_MEM_READ_WRITE, AES_PRIV_SIZE, NULL);
         opencl_buffer_ptr pt_buf = clctx->createBuffer(CL_MEM_READ_WRITE, DATA_SIZE, NULL);
@@ -123,7 +531,7 @@ struct aes_opencl_test
         aes_rijndael_encrypt_kernel->setArg(2, pt_buf);
         aes_rijndael_encrypt_kernel->setArg(3, ct_buf);
 
-        clcmdqueue->enqueueWriteBuffer(rk_buf, true, 0, AES_PRIV_SIZE, rk)->wait();
+        clcmdqueue->enqueueWriteBuffer(rk_buf, true, 0, AES_PRIV_SIZE, rk.rk)->wait();
         
         // Memory reads and writes
         for (int i = 0; i < num_runs; i++) {
@@ -147,20 +555,20 @@ struct aes_opencl_test
             
             // GPU encrypt
             clcmdqueue->enqueueWriteBuffer(pt_buf, true, 0, DATA_SIZE, pt);
-            clcmdqueue->enqueueNDRangeKernel(aes_rijndael_encrypt_kernel, opencl_dim(DATA_SIZE / 16), opencl_dim(256));
+            bool ok = (bool)clcmdqueue->enqueueNDRangeKernel(aes_rijndael_encrypt_kernel, opencl_dim(DATA_SIZE / 16 / bpi), opencl_dim(local_size));
             clcmdqueue->enqueueReadBuffer(ct_buf, true, 0, DATA_SIZE, ct)->wait();
             
             const auto t2 = high_resolution_clock::now();
             
             // CPU encrypt
             for (size_t j = 0; j < DATA_SIZE; j += 16) {
-                aes_rijndael_encrypt((aes_uint*)rk, 10, pt + j, dt + j);
+                aes_encrypt(&rk, pt + j, dt + j);
             }
             
             const auto t3 = high_resolution_clock::now();
             
             // Stats
-            bool pass = (memcmp(ct, dt, DATA_SIZE) == 0);
+            bool pass = ok && (memcmp(ct, dt, DATA_SIZE) == 0);
             float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
             float cpu_time_sec = duration_cast<microseconds>(t3 - t2).count() / 1000000.0;
             log_debug("encrypt %s %ld MB GPU: %f sec (%f MB/sec) CPU: %f sec (%f MB/sec)",
@@ -172,19 +580,585 @@ struct aes_opencl_test
         // GPU encryption only (no memory transfers)
         for (int i = 0; i < num_runs; i++) {
             const auto t1 = high_resolution_clock::now();
-            clcmdqueue->enqueueNDRangeKernel(aes_rijndael_encrypt_kernel, opencl_dim(DATA_SIZE / 16), opencl_dim(256))->wait();
+            opencl_event_ptr event = clcmdqueue->enqueueNDRangeKernel(aes_rijndael_encrypt_kernel, opencl_dim(DATA_SIZE / 16 / bpi), opencl_dim(local_size));
+            if (!event) {
+                log_debug("encrypt FAIL: kernel launch failed");
+                break;
+            }
+            event->wait();
             const auto t2 = high_resolution_clock::now();
             float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
             log_debug("encrypt %ld MB GPU: %f sec (%f MB/sec) [no memory transfer]",
                       DATA_SIZE / MEGA_BYTE,
                       gpu_time_sec, DATA_SIZE / MEGA_BYTE / gpu_time_sec);
         }
-        
-        aes_encrypt_deinit(rk);
+
+        // GPU decrypt of the ciphertext back to the plaintext
+        struct aes_key dk;
+        if (aes_decrypt_key_init(&dk, key, 16) < 0) log_error_exit("aes_decrypt_key_init failed");
+        opencl_buffer_ptr dk_buf = clctx->createBuffer(CL_MEM_READ_WRITE, AES_PRIV_SIZE, NULL);
+        aes_rijndael_decrypt_kernel->setArg(0, dk_buf);
+        aes_rijndael_decrypt_kernel->setArg(1, (cl_int)10);
+        aes_rijndael_decrypt_kernel->setArg(2, ct_buf);
+        aes_rijndael_decrypt_kernel->setArg(3, pt_buf);
+        clcmdqueue->enqueueWriteBuffer(dk_buf, true, 0, AES_PRIV_SIZE, dk.rk)->wait();
+        {
+            memset((void*)dt, 0x00, DATA_SIZE);
+            const auto t1 = high_resolution_clock::now();
+            opencl_event_ptr event = clcmdqueue->enqueueNDRangeKernel(aes_rijndael_decrypt_kernel, opencl_dim(DATA_SIZE / 16 / bpi), opencl_dim(local_size));
+            if (event) event->wait();
+            const auto t2 = high_resolution_clock::now();
+            clcmdqueue->enqueueReadBuffer(pt_buf, true, 0, DATA_SIZE, dt)->wait();
+            bool pass = event && (memcmp(pt, dt, DATA_SIZE) == 0);
+            float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
+            log_debug("decrypt %s %ld MB GPU: %f sec (%f MB/sec) [no memory transfer]",
+                      (pass ? "PASS" : "FAIL"), DATA_SIZE / MEGA_BYTE,
+                      gpu_time_sec, DATA_SIZE / MEGA_BYTE / gpu_time_sec);
+        }
+
+        aes_key_clear(&dk);
+        aes_key_clear(&rk);
+        delete [] pt;
+        delete [] ct;
+        delete [] dt;
+    }
+
+    void testCTR(const char *source)
+    {
+        static const int num_runs = 5;
+        static const aes_uchar key[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
+        // low 64 bits of the counter carry into the high 64 bits within the first blocks
+        static const aes_uchar nonce[16] = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xf0 };
+        static const size_t MEGA_BYTE = 1024 * 1024;
+        static const size_t DATA_SIZE = 32 * MEGA_BYTE;
+
+        size_t local_size;
+        int bpi;
+        log_debug("%s: %s", __func__, source);
+        opencl_program_ptr aesprog = buildProgram(source, DATA_SIZE / 16, { "aes_rijndael_ctr", "aes_rijndael_ctr_keystream" },
+                                                  local_size, bpi);
+        opencl_kernel_ptr aes_rijndael_ctr_kernel = aesprog->getKernel("aes_rijndael_ctr");
+        opencl_kernel_ptr aes_rijndael_ctr_keystream_kernel = aesprog->getKernel("aes_rijndael_ctr_keystream");
+
+        aes_uchar *pt = new aes_uchar[DATA_SIZE];
+        if (!pt) log_error_exit("pt alloc_failed");
+        for (size_t j = 0; j < DATA_SIZE; j++) {
+            pt[j] = (aes_uchar)(j * 7);
+        }
+
+        aes_uchar *ct = new aes_uchar[DATA_SIZE];
+        if (!ct) log_error_exit("ct alloc_failed");
+        memset((void*)ct, 0x00, DATA_SIZE);
+
+        aes_uchar *dt = new aes_uchar[DATA_SIZE];
+        if (!dt) log_error_exit("dt alloc_failed");
+
+        struct aes_key rk;
+        if (aes_encrypt_key_init(&rk, key, 16) < 0) log_error_exit("aes_encrypt_key_init failed");
+        cl_int Nr = rk.rk[AES_PRIV_NR_POS];
+
+        // initial counter block as big endian words
+        cl_uint4 cb;
+        for (int j = 0; j < 4; j++) {
+            cb.s[j] = AES_GET_BE32(nonce + 4 * j);
+        }
+        cl_ulong block_offset = 0;
+
+        opencl_buffer_ptr rk_buf = clctx->createBuffer(CL_MEM_READ_ONLY, AES_PRIV_SIZE, NULL);
+        opencl_buffer_ptr pt_buf = clctx->createBuffer(CL_MEM_READ_WRITE, DATA_SIZE, NULL);
+        opencl_buffer_ptr ct_buf = clctx->createBuffer(CL_MEM_READ_WRITE, DATA_SIZE, NULL);
+
+        aes_rijndael_ctr_kernel->setArg(0, rk_buf);
+        aes_rijndael_ctr_kernel->setArg(1, Nr);
+        aes_rijndael_ctr_kernel->setArg(2, sizeof(cb), &cb);
+        aes_rijndael_ctr_kernel->setArg(3, sizeof(block_offset), &block_offset);
+        aes_rijndael_ctr_kernel->setArg(4, (cl_int)0);
+        aes_rijndael_ctr_kernel->setArg(5, pt_buf);
+        aes_rijndael_ctr_kernel->setArg(6, ct_buf);
+
+        clcmdqueue->enqueueWriteBuffer(rk_buf, true, 0, AES_PRIV_SIZE, rk.rk)->wait();
+
+        // Copy host buffer to device -> GPU CTR encrypt -> Copy device buffer to host
+        for (int i = 0; i < num_runs; i++) {
+            const auto t1 = high_resolution_clock::now();
+
+            // GPU encrypt
+            clcmdqueue->enqueueWriteBuffer(pt_buf, true, 0, DATA_SIZE, pt);
+            bool ok = (bool)clcmdqueue->enqueueNDRangeKernel(aes_rijndael_ctr_kernel, opencl_dim(DATA_SIZE / 16 / bpi), opencl_dim(local_size));
+            clcmdqueue->enqueueReadBuffer(ct_buf, true, 0, DATA_SIZE, ct)->wait();
+
+            const auto t2 = high_resolution_clock::now();
+
+            // CPU encrypt
+            memcpy(dt, pt, DATA_SIZE);
+            if (aes_ctr_encrypt(&rk, nonce, dt, DATA_SIZE) < 0) log_error_exit("aes_ctr_encrypt failed");
+
+            const auto t3 = high_resolution_clock::now();
+
+            // Stats
+            bool pass = ok && (memcmp(ct, dt, DATA_SIZE) == 0);
+            float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
+            float cpu_time_sec = duration_cast<microseconds>(t3 - t2).count() / 1000000.0;
+            log_debug("ctr encrypt %s %ld MB GPU: %f sec (%f MB/sec) CPU: %f sec (%f MB/sec)",
+                      (pass ? "PASS" : "FAIL"), DATA_SIZE / MEGA_BYTE,
+                      gpu_time_sec, DATA_SIZE / MEGA_BYTE / gpu_time_sec,
+                      cpu_time_sec, DATA_SIZE / MEGA_BYTE / cpu_time_sec);
+        }
+
+        // Pipelined: chunks in flight overlap host to device copies, CTR and device to host copies
+        static const size_t PIPELINE_CHUNK_SIZE = 4 * MEGA_BYTE;
+        opencl_pipeline_ptr pipeline = clctx->createPipeline(chosen_device, PIPELINE_CHUNK_SIZE, 3);
+        for (int i = 0; i < num_runs; i++) {
+            memset((void*)ct, 0x00, DATA_SIZE);
+            const auto t1 = high_resolution_clock::now();
+
+            bool ok = pipeline->run(aes_rijndael_ctr_kernel, pt, ct, DATA_SIZE, 16 * bpi, local_size,
+                [](opencl_kernel_ptr &kernel, opencl_buffer_ptr &in, opencl_buffer_ptr &out, size_t offset) {
+                    cl_ulong chunk_block_offset = offset / 16;
+                    kernel->setArg(3, sizeof(chunk_block_offset), &chunk_block_offset);
+                    kernel->setArg(5, in);
+                    kernel->setArg(6, out);
+                });
+
+            const auto t2 = high_resolution_clock::now();
+
+            bool pass = ok && (memcmp(ct, dt, DATA_SIZE) == 0);
+            float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
+            log_debug("ctr encrypt %s %ld MB GPU: %f sec (%f MB/sec) [pipelined, %ld x %ld MB in flight]",
+                      (pass ? "PASS" : "FAIL"), DATA_SIZE / MEGA_BYTE,
+                      gpu_time_sec, DATA_SIZE / MEGA_BYTE / gpu_time_sec,
+                      pipeline->getNumSets(), PIPELINE_CHUNK_SIZE / MEGA_BYTE);
+        }
+
+        // Multi-GPU: one pipeline (with its own queues) and kernel object per device,
+        // the buffer is split between devices by their measured throughput
+        if (clctx->getDevices().size() > 1) {
+            opencl_splitter_ptr multi = clctx->createSplitter(PIPELINE_CHUNK_SIZE, 0);
+            for (opencl_device_ptr device : clctx->getDevices()) {
+                opencl_kernel_ptr kernel = aesprog->createKernel("aes_rijndael_ctr");
+                if (!kernel) log_error_exit("createKernel failed");
+                kernel->setArg(0, rk_buf);
+                kernel->setArg(1, Nr);
+                kernel->setArg(2, sizeof(cb), &cb);
+                kernel->setArg(4, (cl_int)0);
+                multi->addDevice(device, clctx->createPipeline(device, PIPELINE_CHUNK_SIZE, 3), kernel, 16 * bpi, local_size,
+                    [](opencl_kernel_ptr &kernel, opencl_buffer_ptr &in, opencl_buffer_ptr &out, size_t offset) {
+                        cl_ulong chunk_block_offset = offset / 16;
+                        kernel->setArg(3, sizeof(chunk_block_offset), &chunk_block_offset);
+                        kernel->setArg(5, in);
+                        kernel->setArg(6, out);
+                    });
+            }
+            for (int i = 0; i < num_runs; i++) {
+                memset((void*)ct, 0x00, DATA_SIZE);
+                const auto t1 = high_resolution_clock::now();
+
+                bool ok = multi->run(pt, ct, DATA_SIZE,
+                    [&rk](const void *in, void *out, size_t offset, size_t size) {
+                        aes_uchar chunk_nonce[16];
+                        ctr_add(nonce, offset / 16, chunk_nonce);
+                        memcpy(out, in, size);
+                        return aes_ctr_encrypt(&rk, chunk_nonce, (aes_uchar*)out, size) == 0;
+                    });
+
+                const auto t2 = high_resolution_clock::now();
+
+                bool pass = ok && (memcmp(ct, dt, DATA_SIZE) == 0);
+                float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
+                log_debug("ctr encrypt %s %ld MB GPU: %f sec (%f MB/sec) [%ld devices, split %s]",
+                          (pass ? "PASS" : "FAIL"), DATA_SIZE / MEGA_BYTE,
+                          gpu_time_sec, DATA_SIZE / MEGA_BYTE / gpu_time_sec,
+                          clctx->getDevices().size(), splitStats(multi, DATA_SIZE).c_str());
+            }
+        }
+
+        // Split: CPU threads and the GPU pipeline take chunks of the buffer by measured throughput
+        static const size_t SPLIT_GRAIN = 256 * 1024;
+        size_t cpu_threads = std::max(1u, std::thread::hardware_concurrency()) - 1;
+        opencl_splitter_ptr splitter = clctx->createSplitter(SPLIT_GRAIN, std::max((size_t)1, cpu_threads));
+        splitter->addDevice(chosen_device, pipeline, aes_rijndael_ctr_kernel, 16 * bpi, local_size,
+            [](opencl_kernel_ptr &kernel, opencl_buffer_ptr &in, opencl_buffer_ptr &out, size_t offset) {
+                cl_ulong chunk_block_offset = offset / 16;
+                kernel->setArg(3, sizeof(chunk_block_offset), &chunk_block_offset);
+                kernel->setArg(5, in);
+                kernel->setArg(6, out);
+            });
+        for (int i = 0; i < num_runs; i++) {
+            memset((void*)ct, 0x00, DATA_SIZE);
+            const auto t1 = high_resolution_clock::now();
+
+            bool ok = splitter->run(pt, ct, DATA_SIZE,
+                [&rk](const void *in, void *out, size_t offset, size_t size) {
+                    aes_uchar chunk_nonce[16];
+                    ctr_add(nonce, offset / 16, chunk_nonce);
+                    memcpy(out, in, size);
+                    return aes_ctr_encrypt(&rk, chunk_nonce, (aes_uchar*)out, size) == 0;
+                });
+
+            const auto t2 = high_resolution_clock::now();
+
+            bool pass = ok && (memcmp(ct, dt, DATA_SIZE) == 0);
+            float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
+            log_debug("ctr encrypt %s %ld MB CPU+GPU: %f sec (%f MB/sec) [split %s]",
+                      (pass ? "PASS" : "FAIL"), DATA_SIZE / MEGA_BYTE,
+                      gpu_time_sec, DATA_SIZE / MEGA_BYTE / gpu_time_sec, splitStats(splitter, DATA_SIZE).c_str());
+        }
+
+        // Pinned host memory: the data is written and read in place. With host unified
+        // memory the kernel runs on the host buffers themselves (zero-copy), otherwise
+        // the pinned pages are the source and destination of the transfers
+        bool zero_copy = chosen_device->hasHostUnifiedMemory() || chosen_device->getDeviceType() == CL_DEVICE_TYPE_CPU;
+        opencl_host_buffer_ptr pt_host = clctx->createHostBuffer(clcmdqueue, CL_MEM_READ_ONLY, DATA_SIZE);
+        opencl_host_buffer_ptr ct_host = clctx->createHostBuffer(clcmdqueue, CL_MEM_WRITE_ONLY, DATA_SIZE);
+        if (!pt_host->isMapped() || !ct_host->isMapped()) log_error_exit("host buffer map failed");
+        memcpy(pt_host->getHostPtr(), pt, DATA_SIZE);
+        if (zero_copy) {
+            aes_rijndael_ctr_kernel->setArg(5, pt_host->getBuffer());
+            aes_rijndael_ctr_kernel->setArg(6, ct_host->getBuffer());
+        }
+        for (int i = 0; i < num_runs; i++) {
+            memset(ct_host->getHostPtr(), 0x00, DATA_SIZE);
+            const auto t1 = high_resolution_clock::now();
+
+            bool ok;
+            if (zero_copy) {
+                pt_host->unmap();
+                ct_host->unmap();
+                ok = (bool)clcmdqueue->enqueueNDRangeKernel(aes_rijndael_ctr_kernel, opencl_dim(DATA_SIZE / 16 / bpi), opencl_dim(local_size));
+                pt_host->map(CL_MAP_WRITE);
+                // read and write: the next run clears the output through this mapping
+                ct_host->map(CL_MAP_READ | CL_MAP_WRITE);
+            } else {
+                clcmdqueue->enqueueWriteBuffer(pt_buf, true, 0, DATA_SIZE, pt_host->getHostPtr());
+                ok = (bool)clcmdqueue->enqueueNDRangeKernel(aes_rijndael_ctr_kernel, opencl_dim(DATA_SIZE / 16 / bpi), opencl_dim(local_size));
+                clcmdqueue->enqueueReadBuffer(ct_buf, true, 0, DATA_SIZE, ct_host->getHostPtr())->wait();
+            }
+
+            const auto t2 = high_resolution_clock::now();
+
+            bool pass = ok && ct_host->isMapped() && (memcmp(ct_host->getHostPtr(), dt, DATA_SIZE) == 0);
+            float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
+            log_debug("ctr encrypt %s %ld MB GPU: %f sec (%f MB/sec) [%s]",
+                      (pass ? "PASS" : "FAIL"), DATA_SIZE / MEGA_BYTE,
+                      gpu_time_sec, DATA_SIZE / MEGA_BYTE / gpu_time_sec,
+                      zero_copy ? "zero-copy" : "pinned");
+        }
+        if (zero_copy) {
+            aes_rijndael_ctr_kernel->setArg(5, pt_buf);
+            aes_rijndael_ctr_kernel->setArg(6, ct_buf);
+        }
+
+        // GPU keystream only (no memory transfers), 32-bit counter as used by GCM
+        aes_rijndael_ctr_keystream_kernel->setArg(0, rk_buf);
+        aes_rijndael_ctr_keystream_kernel->setArg(1, Nr);
+        aes_rijndael_ctr_keystream_kernel->setArg(2, sizeof(cb), &cb);
+        aes_rijndael_ctr_keystream_kernel->setArg(3, sizeof(block_offset), &block_offset);
+        aes_rijndael_ctr_keystream_kernel->setArg(4, (cl_int)1);
+        aes_rijndael_ctr_keystream_kernel->setArg(5, ct_buf);
+
+        bool keystream_ok = true;
+        for (int i = 0; i < num_runs; i++) {
+            const auto t1 = high_resolution_clock::now();
+            opencl_event_ptr event = clcmdqueue->enqueueNDRangeKernel(aes_rijndael_ctr_keystream_kernel, opencl_dim(DATA_SIZE / 16 / bpi), opencl_dim(local_size));
+            if (!event) {
+                keystream_ok = false;
+                break;
+            }
+            event->wait();
+            const auto t2 = high_resolution_clock::now();
+            float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
+            log_debug("ctr keystream %ld MB GPU: %f sec (%f MB/sec) [no memory transfer]",
+                      DATA_SIZE / MEGA_BYTE,
+                      gpu_time_sec, DATA_SIZE / MEGA_BYTE / gpu_time_sec);
+        }
+
+        clcmdqueue->enqueueReadBuffer(ct_buf, true, 0, DATA_SIZE, ct)->wait();
+        aes_uchar ctr[16];
+        memcpy(ctr, nonce, sizeof(ctr));
+        memset((void*)dt, 0x00, DATA_SIZE);
+        aes_encrypt_ctr32(&rk, ctr, dt, DATA_SIZE / 16, dt);
+        log_debug("ctr keystream %s", keystream_ok && memcmp(ct, dt, DATA_SIZE) == 0 ? "PASS" : "FAIL");
+
+        aes_key_clear(&rk);
         delete [] pt;
         delete [] ct;
         delete [] dt;
     }
+
+    // share of the buffer each worker of the last split processed
+    static std::string splitStats(opencl_splitter_ptr &splitter, size_t size)
+    {
+        std::stringstream ss;
+        for (const opencl_splitter::worker_stats &ws : splitter->getStats()) {
+            if (ws.bytes == 0) continue;
+            ss << (ss.tellp() > 0 ? ", " : "") << ws.name << " " << ws.bytes * 100 / size << "%";
+        }
+        return ss.str();
+    }
+
+    // out = 128-bit big endian counter + n
+    static void ctr_add(const aes_uchar *counter, cl_ulong n, aes_uchar *out)
+    {
+        unsigned int carry = 0;
+        for (int j = 15; j >= 0; j--) {
+            carry += counter[j] + (unsigned int)(n & 0xff);
+            out[j] = (aes_uchar)carry;
+            carry >>= 8;
+            n >>= 8;
+        }
+    }
+
+    static int log2_ceil(size_t n)
+    {
+        int l = 0;
+        while (((size_t)1 << l) < n) l++;
+        return l;
+    }
+
+    void testGCM()
+    {
+        static const int num_runs = 5;
+        static const aes_uchar key[16] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F };
+        static const aes_uchar iv[12] = { 0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88 };
+        static const size_t MEGA_BYTE = 1024 * 1024;
+        static const size_t DATA_SIZE = 32 * MEGA_BYTE - 5; // partial last block
+        static const size_t AAD_SIZE = 1000;
+        static const int CHUNK_LOG2 = 4; // blocks folded by each GHASH work-item
+
+        // power of two local size, as the GHASH tree reduction requires,
+        // that the CTR and GHASH kernels can all be launched with
+        const size_t nblocks = (DATA_SIZE + 15) / 16;
+        size_t local_size;
+        int bpi;
+        opencl_program_ptr aesprog = buildProgram("src/aes.cl", nblocks,
+                                                  { "aes_rijndael_ctr", "aes_gcm_ghash", "aes_ghash_reduce" },
+                                                  local_size, bpi);
+        const int local_log2 = log2_ceil(local_size);
+
+        // device buffers are padded to whole work-groups of blocks
+        const size_t ctr_global = (nblocks + local_size * bpi - 1) / (local_size * bpi) * local_size;
+        const size_t buf_size = ctr_global * bpi * 16;
+        const size_t aad_buf_size = (AAD_SIZE + 15) / 16 * 16;
+
+        opencl_kernel_ptr aes_rijndael_ctr_kernel = aesprog->getKernel("aes_rijndael_ctr");
+        opencl_kernel_ptr aes_ghash_powers_kernel = aesprog->getKernel("aes_ghash_powers");
+        opencl_kernel_ptr aes_gcm_ghash_kernel = aesprog->getKernel("aes_gcm_ghash");
+        opencl_kernel_ptr aes_ghash_reduce_kernel = aesprog->getKernel("aes_ghash_reduce");
+        opencl_kernel_ptr aes_gcm_tag_kernel = aesprog->getKernel("aes_gcm_tag");
+
+        aes_uchar *pt = new aes_uchar[buf_size];
+        if (!pt) log_error_exit("pt alloc_failed");
+        memset((void*)pt, 0x00, buf_size);
+        for (size_t j = 0; j < DATA_SIZE; j++) {
+            pt[j] = (aes_uchar)(j * 7);
+        }
+
+        aes_uchar *aad = new aes_uchar[aad_buf_size];
+        if (!aad) log_error_exit("aad alloc_failed");
+        memset((void*)aad, 0x00, aad_buf_size);
+        for (size_t j = 0; j < AAD_SIZE; j++) {
+            aad[j] = (aes_uchar)(j * 5 + 1);
+        }
+
+        aes_uchar *ct = new aes_uchar[buf_size];
+        if (!ct) log_error_exit("ct alloc_failed");
+        aes_uchar *dt = new aes_uchar[DATA_SIZE];
+        if (!dt) log_error_exit("dt alloc_failed");
+        aes_uchar tag[16], dtag[16];
+
+        struct aes_key rk;
+        if (aes_encrypt_key_init(&rk, key, 16) < 0) log_error_exit("aes_encrypt_key_init failed");
+        cl_int Nr = rk.rk[AES_PRIV_NR_POS];
+
+        // J0 = IV || 0^31 || 1 as big endian words; the data starts at inc32(J0)
+        cl_uint4 j0;
+        for (int j = 0; j < 3; j++) {
+            j0.s[j] = AES_GET_BE32(iv + 4 * j);
+        }
+        j0.s[3] = 1;
+        cl_ulong block_offset = 1;
+
+        // GHASH over A, C and the length block, padded at the front to whole work-groups
+        const cl_ulong aad_len = AAD_SIZE, crypt_len = DATA_SIZE;
+        const size_t ghash_blocks = (AAD_SIZE + 15) / 16 + nblocks + 1;
+        const size_t ghash_per_group = local_size << CHUNK_LOG2;
+        size_t ghash_groups = (ghash_blocks + ghash_per_group - 1) / ghash_per_group;
+        cl_ulong ghash_pad = ghash_groups * ghash_per_group - ghash_blocks;
+
+        opencl_buffer_ptr rk_buf = clctx->createBuffer(CL_MEM_READ_ONLY, AES_PRIV_SIZE, NULL);
+        opencl_buffer_ptr pt_buf = clctx->createBuffer(CL_MEM_READ_WRITE, buf_size, NULL);
+        opencl_buffer_ptr ct_buf = clctx->createBuffer(CL_MEM_READ_WRITE, buf_size, NULL);
+        opencl_buffer_ptr aad_buf = clctx->createBuffer(CL_MEM_READ_ONLY, aad_buf_size, NULL);
+        opencl_buffer_ptr hpow_buf = clctx->createBuffer(CL_MEM_READ_WRITE, 64 * 16, NULL);
+        opencl_buffer_ptr partial_buf[2] = {
+            clctx->createBuffer(CL_MEM_READ_WRITE, ghash_groups * 16, NULL),
+            clctx->createBuffer(CL_MEM_READ_WRITE, ghash_groups * 16, NULL)
+        };
+        opencl_buffer_ptr tag_buf = clctx->createBuffer(CL_MEM_WRITE_ONLY, 16, NULL);
+
+        aes_rijndael_ctr_kernel->setArg(0, rk_buf);
+        aes_rijndael_ctr_kernel->setArg(1, Nr);
+        aes_rijndael_ctr_kernel->setArg(2, sizeof(j0), &j0);
+        aes_rijndael_ctr_kernel->setArg(3, sizeof(block_offset), &block_offset);
+        aes_rijndael_ctr_kernel->setArg(4, (cl_int)1);
+        aes_rijndael_ctr_kernel->setArg(5, pt_buf);
+        aes_rijndael_ctr_kernel->setArg(6, ct_buf);
+
+        aes_ghash_powers_kernel->setArg(0, rk_buf);
+        aes_ghash_powers_kernel->setArg(1, Nr);
+        aes_ghash_powers_kernel->setArg(2, hpow_buf);
+
+        aes_gcm_ghash_kernel->setArg(0, hpow_buf);
+        aes_gcm_ghash_kernel->setArg(1, aad_buf);
+        aes_gcm_ghash_kernel->setArg(2, sizeof(aad_len), (void*)&aad_len);
+        aes_gcm_ghash_kernel->setArg(3, ct_buf);
+        aes_gcm_ghash_kernel->setArg(4, sizeof(crypt_len), (void*)&crypt_len);
+        aes_gcm_ghash_kernel->setArg(5, sizeof(ghash_pad), &ghash_pad);
+        aes_gcm_ghash_kernel->setArg(6, (cl_int)CHUNK_LOG2);
+        aes_gcm_ghash_kernel->setArgLocalMemory(7, local_size * 16);
+        aes_gcm_ghash_kernel->setArg(8, partial_buf[0]);
+
+        aes_ghash_reduce_kernel->setArg(0, hpow_buf);
+        aes_ghash_reduce_kernel->setArgLocalMemory(6, local_size * 16);
+
+        aes_gcm_tag_kernel->setArg(0, rk_buf);
+        aes_gcm_tag_kernel->setArg(1, Nr);
+        aes_gcm_tag_kernel->setArg(2, sizeof(j0), &j0);
+        aes_gcm_tag_kernel->setArg(3, hpow_buf);
+        aes_gcm_tag_kernel->setArg(5, tag_buf);
+
+        clcmdqueue->enqueueWriteBuffer(rk_buf, true, 0, AES_PRIV_SIZE, rk.rk)->wait();
+        clcmdqueue->enqueueWriteBuffer(aad_buf, true, 0, aad_buf_size, aad)->wait();
+
+        // Copy host buffer to device -> GPU GCM encrypt -> Copy ciphertext and tag to host
+        for (int i = 0; i < num_runs; i++) {
+            const auto t1 = high_resolution_clock::now();
+
+            // GPU encrypt: CTR, then GHASH over the ciphertext in log passes
+            clcmdqueue->enqueueWriteBuffer(pt_buf, true, 0, buf_size, pt);
+            bool ok = clcmdqueue->enqueueNDRangeKernel(aes_ghash_powers_kernel, opencl_dim(1), opencl_dim(1)) &&
+                      clcmdqueue->enqueueNDRangeKernel(aes_rijndael_ctr_kernel, opencl_dim(ctr_global), opencl_dim(local_size)) &&
+                      clcmdqueue->enqueueNDRangeKernel(aes_gcm_ghash_kernel, opencl_dim(ghash_groups * local_size), opencl_dim(local_size));
+
+            size_t groups = ghash_groups;
+            cl_int shift = CHUNK_LOG2 + local_log2;
+            int in = 0;
+            while (ok && groups > 1) {
+                cl_ulong n = groups;
+                cl_int chunk_log2 = n > local_size ? CHUNK_LOG2 : 0;
+                size_t per_group = local_size << chunk_log2;
+                groups = (n + per_group - 1) / per_group;
+                cl_ulong pad = groups * per_group - n;
+                aes_ghash_reduce_kernel->setArg(1, shift);
+                aes_ghash_reduce_kernel->setArg(2, partial_buf[in]);
+                aes_ghash_reduce_kernel->setArg(3, sizeof(n), &n);
+                aes_ghash_reduce_kernel->setArg(4, sizeof(pad), &pad);
+                aes_ghash_reduce_kernel->setArg(5, chunk_log2);
+                aes_ghash_reduce_kernel->setArg(7, partial_buf[in ^ 1]);
+                ok = (bool)clcmdqueue->enqueueNDRangeKernel(aes_ghash_reduce_kernel, opencl_dim(groups * local_size), opencl_dim(local_size));
+                shift += chunk_log2 + local_log2;
+                in ^= 1;
+            }
+
+            aes_gcm_tag_kernel->setArg(4, partial_buf[in]);
+            ok = ok && clcmdqueue->enqueueNDRangeKernel(aes_gcm_tag_kernel, opencl_dim(1), opencl_dim(1));
+            clcmdqueue->enqueueReadBuffer(ct_buf, true, 0, DATA_SIZE, ct);
+            clcmdqueue->enqueueReadBuffer(tag_buf, true, 0, sizeof(tag), tag)->wait();
+
+            const auto t2 = high_resolution_clock::now();
+
+            // CPU encrypt
+            if (aes_gcm_ae(key, sizeof(key), iv, sizeof(iv), pt, DATA_SIZE, aad, AAD_SIZE, dt, dtag) < 0) {
+                log_error_exit("aes_gcm_ae failed");
+            }
+
+            const auto t3 = high_resolution_clock::now();
+
+            // Stats
+            bool pass = ok && memcmp(ct, dt, DATA_SIZE) == 0 && memcmp(tag, dtag, sizeof(tag)) == 0;
+            float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
+            float cpu_time_sec = duration_cast<microseconds>(t3 - t2).count() / 1000000.0;
+            log_debug("gcm encrypt %s %ld MB GPU: %f sec (%f MB/sec) CPU: %f sec (%f MB/sec)",
+                      (pass ? "PASS" : "FAIL"), DATA_SIZE / MEGA_BYTE,
+                      gpu_time_sec, DATA_SIZE / MEGA_BYTE / gpu_time_sec,
+                      cpu_time_sec, DATA_SIZE / MEGA_BYTE / cpu_time_sec);
+        }
+
+        aes_key_clear(&rk);
+        delete [] pt;
+        delete [] aad;
+        delete [] ct;
+        delete [] dt;
+    }
+
+    void testBatch()
+    {
+        static const int num_runs = 5;
+        static const size_t NUM_KEYS = 256;
+        static const size_t NUM_MSGS = 16384;
+        static const size_t MAX_MSG_SIZE = 1500;
+        static const size_t MEGA_BYTE = 1024 * 1024;
+
+        // no block count, so one block per work-item
+        size_t local_size;
+        int bpi;
+        opencl_program_ptr aesprog = buildProgram("src/aes.cl", 0, { "aes_rijndael_ctr_batch" }, local_size, bpi);
+        aes_opencl_batch batch(clctx, clcmdqueue, aesprog, local_size, bpi, 4 * MEGA_BYTE, 4096, 1024);
+
+        // per-session keys and records of varying length, as in TLS or IPsec
+        std::vector<struct aes_key> keys(NUM_KEYS);
+        for (size_t k = 0; k < NUM_KEYS; k++) {
+            aes_uchar key[32];
+            for (int j = 0; j < 32; j++) key[j] = (aes_uchar)(k * 31 + j);
+            if (aes_encrypt_key_init(&keys[k], key, 16 + 8 * (k % 3)) < 0) log_error_exit("aes_encrypt_key_init failed");
+        }
+        std::vector<size_t> offsets(NUM_MSGS + 1, 0);
+        for (size_t m = 0; m < NUM_MSGS; m++) {
+            offsets[m + 1] = offsets[m] + 1 + (m * 7919) % MAX_MSG_SIZE;
+        }
+        const size_t data_size = offsets[NUM_MSGS];
+        std::vector<aes_uchar> pt(data_size), ct(data_size), dt(data_size), nonces(NUM_MSGS * 16);
+        for (size_t j = 0; j < data_size; j++) pt[j] = (aes_uchar)(j * 7);
+        for (size_t j = 0; j < nonces.size(); j++) nonces[j] = (aes_uchar)(j * 13 + 5);
+
+        for (int i = 0; i < num_runs; i++) {
+            std::fill(ct.begin(), ct.end(), 0);
+            const auto t1 = high_resolution_clock::now();
+
+            // GPU encrypt
+            bool ok = true;
+            batch.num_batches = 0;
+            for (size_t m = 0; m < NUM_MSGS && ok; m++) {
+                ok = batch.add(&keys[m % NUM_KEYS], &nonces[m * 16], &pt[offsets[m]], &ct[offsets[m]], offsets[m + 1] - offsets[m]);
+            }
+            ok = ok && batch.flush();
+
+            const auto t2 = high_resolution_clock::now();
+
+            // CPU encrypt
+            memcpy(&dt[0], &pt[0], data_size);
+            for (size_t m = 0; m < NUM_MSGS; m++) {
+                if (aes_ctr_encrypt(&keys[m % NUM_KEYS], &nonces[m * 16], &dt[offsets[m]], offsets[m + 1] - offsets[m]) < 0) {
+                    log_error_exit("aes_ctr_encrypt failed");
+                }
+            }
+
+            const auto t3 = high_resolution_clock::now();
+
+            // Stats
+            bool pass = ok && ct == dt;
+            float gpu_time_sec = duration_cast<microseconds>(t2 - t1).count() / 1000000.0;
+            float cpu_time_sec = duration_cast<microseconds>(t3 - t2).count() / 1000000.0;
+            log_debug("ctr batch %s %ld msgs %ld keys %f MB GPU: %f sec (%f MB/sec) CPU: %f sec (%f MB/sec) [%ld batches]",
+                      (pass ? "PASS" : "FAIL"), NUM_MSGS, NUM_KEYS, (float)data_size / MEGA_BYTE,
+                      gpu_time_sec, data_size / MEGA_BYTE / gpu_time_sec,
+                      cpu_time_sec, data_size / MEGA_BYTE / cpu_time_sec, batch.num_batches);
+        }
+
+        for (struct aes_key &key : keys) {
+            aes_key_clear(&key);
+        }
+    }
 };
 
 int main(int argc, const char * argv[])
@@ -192,8 +1166,18 @@ int main(int argc, const char * argv[])
     aes_opencl_test test;
     
     test.initCL();
+    if (argc > 1 && strcmp(argv[1], "--tune") == 0) {
+        test.tune();
+    }
     test.testCL();
-    test.testAES();
+    // the ECB and CTR kernels of aes.cl and aes_vec.cl, the tuned source first
+    for (int i = 0; i < 2; i++) {
+        const char *source = aes_opencl_config::sourceName(test.config.vec ^ i);
+        test.testAES(source);
+        test.testCTR(source);
+    }
+    test.testGCM();
+    test.testBatch();
 
     return 0;
 }
@@ -10,29 +10,26 @@
 #include "aes.h"
 
 /**
- * aes_unwrap - Unwrap key with AES Key Wrap Algorithm (128-bit KEK) (RFC3394)
- * @kek: Key encryption key (KEK)
+ * aes_key_unwrap - Unwrap key with AES Key Wrap Algorithm (RFC3394)
+ * @kek_dec: Key encryption key schedule from aes_decrypt_key_init()
  * @n: Length of the plaintext key in 64-bit units; e.g., 2 = 128-bit = 16
  * bytes
  * @cipher: Wrapped key to be unwrapped, (n + 1) * 64 bits
  * @plain: Plaintext key, n * 64 bits
  * Returns: 0 on success, -1 on failure (e.g., integrity verification failed)
  */
-int aes_unwrap(const aes_uchar *kek, int n, const aes_uchar *cipher, aes_uchar *plain)
+int aes_key_unwrap(const struct aes_key *kek_dec, int n, const aes_uchar *cipher,
+		   aes_uchar *plain)
 {
 	aes_uchar a[8], *r, b[16];
 	int i, j;
-	void *ctx;
+	void *ctx = (void *) kek_dec;
 
 	/* 1) Initialize variables. */
 	memcpy(a, cipher, 8);
 	r = plain;
 	memcpy(r, cipher + 8, 8 * n);
 
-	ctx = aes_decrypt_init(kek, 16);
-	if (ctx == NULL)
-		return -1;
-
 	/* 2) Compute intermediate values.
 	 * For j = 5 to 0
 	 *     For i = n to 1
@@ -53,7 +50,6 @@ int aes_unwrap(const aes_uchar *kek, int n, const aes_uchar *cipher, aes_uchar *
 			r -= 8;
 		}
 	}
-	aes_decrypt_deinit(ctx);
 
 	/* 3) Output results.
 	 *
@@ -67,3 +63,25 @@ int aes_unwrap(const aes_uchar *kek, int n, const aes_uchar *cipher, aes_uchar *
 
 	return 0;
 }
+
+
+/**
+ * aes_unwrap - Unwrap key with AES Key Wrap Algorithm (128-bit KEK) (RFC3394)
+ * @kek: Key encryption key (KEK)
+ * @n: Length of the plaintext key in 64-bit units; e.g., 2 = 128-bit = 16
+ * bytes
+ * @cipher: Wrapped key to be unwrapped, (n + 1) * 64 bits
+ * @plain: Plaintext key, n * 64 bits
+ * Returns: 0 on success, -1 on failure (e.g., integrity verification failed)
+ */
+int aes_unwrap(const aes_uchar *kek, int n, const aes_uchar *cipher, aes_uchar *plain)
+{
+	struct aes_key ctx;
+	int ret;
+
+	if (aes_decrypt_key_init(&ctx, kek, 16) < 0)
+		return -1;
+	ret = aes_key_unwrap(&ctx, n, cipher, plain);
+	aes_key_clear(&ctx);
+	return ret;
+}
@@ -10,19 +10,19 @@
 #include "aes.h"
 
 /**
- * aes_wrap - Wrap keys with AES Key Wrap Algorithm (128-bit KEK) (RFC3394)
- * @kek: 16-octet Key encryption key (KEK)
+ * aes_key_wrap - Wrap keys with AES Key Wrap Algorithm (RFC3394)
+ * @kek: Key encryption key schedule from aes_encrypt_key_init()
  * @n: Length of the plaintext key in 64-bit units; e.g., 2 = 128-bit = 16
  * bytes
  * @plain: Plaintext key to be wrapped, n * 64 bits
  * @cipher: Wrapped key, (n + 1) * 64 bits
  * Returns: 0 on success, -1 on failure
  */
-int aes_wrap(const aes_uchar *kek, int n, const aes_uchar *plain, aes_uchar *cipher)
+int aes_key_wrap(const struct aes_key *kek, int n, const aes_uchar *plain, aes_uchar *cipher)
 {
 	aes_uchar *a, *r, b[16];
 	int i, j;
-	void *ctx;
+	void *ctx = (void *) kek;
 
 	a = cipher;
 	r = cipher + 8;
@@ -31,10 +31,6 @@ int aes_wrap(const aes_uchar *kek, int n, const aes_uchar *plain, aes_uchar *cip
 	memset(a, 0xa6, 8);
 	memcpy(r, plain, 8 * n);
 
-	ctx = aes_encrypt_init(kek, 16);
-	if (ctx == NULL)
-		return -1;
-
 	/* 2) Calculate intermediate values.
 	 * For j = 0 to 5
 	 *     For i=1 to n
@@ -54,7 +50,6 @@ int aes_wrap(const aes_uchar *kek, int n, const aes_uchar *plain, aes_uchar *cip
 			r += 8;
 		}
 	}
-	aes_encrypt_deinit(ctx);
 
 	/* 3) Output the results.
 	 *
@@ -64,3 +59,25 @@ int aes_wrap(const aes_uchar *kek, int n, const aes_uchar *plain, aes_uchar *cip
 
 	return 0;
 }
+
+
+/**
+ * aes_wrap - Wrap keys with AES Key Wrap Algorithm (128-bit KEK) (RFC3394)
+ * @kek: 16-octet Key encryption key (KEK)
+ * @n: Length of the plaintext key in 64-bit units; e.g., 2 = 128-bit = 16
+ * bytes
+ * @plain: Plaintext key to be wrapped, n * 64 bits
+ * @cipher: Wrapped key, (n + 1) * 64 bits
+ * Returns: 0 on success, -1 on failure
+ */
+int aes_wrap(const aes_uchar *kek, int n, const aes_uchar *plain, aes_uchar *cipher)
+{
+	struct aes_key ctx;
+	int ret;
+
+	if (aes_encrypt_key_init(&ctx, kek, 16) < 0)
+		return -1;
+	ret = aes_key_wrap(&ctx, n, plain, cipher);
+	aes_key_clear(&ctx);
+	return ret;
+}
@@ -0,0 +1,115 @@
+/*
+ * AES x86 SIMD helpers (AES-NI, PCLMULQDQ)
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+#ifndef AES_X86_H
+#define AES_X86_H
+
+#ifdef AES_HAVE_X86_INTRIN
+
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+/*
+ * The key schedule uses the same layout as aes_rijndael_key_setup_enc(),
+ * i.e. each round key word holds the big endian column value in host order.
+ * This keeps schedules interchangeable between the T-table and AES-NI code
+ * and lets them be uploaded unchanged to the OpenCL kernels. Round keys are
+ * byte swapped into AES-NI order with pshufb as they are loaded.
+ */
+
+#define AES_NI_TARGET AES_TARGET("aes,ssse3")
+
+static inline AES_NI_TARGET __m128i aes_ni_bswap32_mask(void)
+{
+	return _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+}
+
+static inline AES_NI_TARGET __m128i aes_ni_load_rk(const aes_uint *rk, __m128i bswap)
+{
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) rk), bswap);
+}
+
+/*
+ * Blocks are byte reflected on load so that the carry-less product of two
+ * field elements is the bit reflected product shifted right by one bit. The
+ * 256-bit products of up to AES_GHASH_POWERS blocks with the matching powers
+ * of H are summed and then shifted and reduced modulo
+ * x^128 + x^7 + x^2 + x + 1 once (Gueron and Kounavis, Intel white paper).
+ */
+
+#define AES_CLMUL_TARGET AES_TARGET("pclmul,ssse3")
+
+static inline AES_CLMUL_TARGET __m128i ghash_bswap_mask(void)
+{
+	return _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+}
+
+static inline AES_CLMUL_TARGET __m128i ghash_load(const aes_uchar *x, __m128i bswap)
+{
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) x), bswap);
+}
+
+
+/* lo:mid:hi += a * b (unreduced 256-bit product) */
+static inline AES_CLMUL_TARGET void ghash_clmul_acc(__m128i a, __m128i b,
+						    __m128i *lo, __m128i *mid, __m128i *hi)
+{
+	*lo = _mm_xor_si128(*lo, _mm_clmulepi64_si128(a, b, 0x00));
+	*hi = _mm_xor_si128(*hi, _mm_clmulepi64_si128(a, b, 0x11));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x10));
+	*mid = _mm_xor_si128(*mid, _mm_clmulepi64_si128(a, b, 0x01));
+}
+
+
+/* Fold the middle term, shift left by one bit and reduce */
+static inline AES_CLMUL_TARGET __m128i ghash_reduce(__m128i lo, __m128i mid, __m128i hi)
+{
+	__m128i t2, t4, t5, t7, t8, t9;
+
+	lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+	hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+	/* hi:lo <<= 1 */
+	t7 = _mm_srli_epi32(lo, 31);
+	t8 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	lo = _mm_or_si128(lo, t7);
+	hi = _mm_or_si128(hi, t8);
+	hi = _mm_or_si128(hi, t9);
+
+	/* first phase of the reduction */
+	t7 = _mm_slli_epi32(lo, 31);
+	t8 = _mm_slli_epi32(lo, 30);
+	t9 = _mm_slli_epi32(lo, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	lo = _mm_xor_si128(lo, t7);
+
+	/* second phase of the reduction */
+	t2 = _mm_srli_epi32(lo, 1);
+	t4 = _mm_srli_epi32(lo, 2);
+	t5 = _mm_srli_epi32(lo, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	lo = _mm_xor_si128(lo, t2);
+
+	return _mm_xor_si128(hi, lo);
+}
+
+
+#define AES_GCM_X86_TARGET AES_TARGET("aes,pclmul,ssse3")
+
+#endif /* AES_HAVE_X86_INTRIN */
+
+#endif /* AES_X86_H */
@@ -2,10 +2,24 @@
  *  aes.cl
  */
 
+/* kernel variants, defaults unless set by the host with -D */
+#ifndef AES_SMALL_TABLES
 #define AES_SMALL_TABLES 0
+#endif
+#ifndef AES_SMALL_TABLES_LOCAL
 #define AES_SMALL_TABLES_LOCAL 1
+#endif
+#ifndef AES_KEY_LOCAL
 #define AES_KEY_LOCAL 0
+#endif
+#ifndef AES_USE_UCHAR_SWIZZLE
 #define AES_USE_UCHAR_SWIZZLE 1
+#endif
+
+/* blocks encrypted by each work-item, usually set by the host with -D */
+#ifndef AES_BLOCKS_PER_ITEM
+#define AES_BLOCKS_PER_ITEM 1
+#endif
 
 /* macros to access bytes of a uint */
 #if AES_USE_UCHAR_SWIZZLE
@@ -783,122 +797,506 @@ __constant uchar Td4s[256] = {
 #endif /* !(AES_SMALL_TABLES || AES_SMALL_TABLES_LOCAL) */
 
 
-__kernel void aes_rijndael_encrypt(__constant uint *rk_global, int Nr, __global const uchar *pt_buf /*[16]*/, __global uchar *ct_buf /*[16]*/)
-{
-	uint s0, s1, s2, s3, t0, t1, t2, t3;
-	int r;
-
+/* staging of the encryption table and round keys in local memory */
 #if AES_SMALL_TABLES_LOCAL
-    __local uint Te0_local[256];
-    
-    Te0_local[get_local_id(0)] = Te0[get_local_id(0)];
+#define AES_TE_LOCAL_SETUP() \
+    __local uint Te0_local[256]; \
+    for (size_t i = get_local_id(0); i < 256; i += get_local_size(0)) \
+        Te0_local[i] = Te0[i]
+#define AES_TE_LOCAL_PARAM , __local const uint *Te0_local
+#define AES_TE_LOCAL_ARG , Te0_local
+#define AES_TD_LOCAL_SETUP() \
+    __local uint Td0_local[256]; \
+    __local uchar Td4s_local[256]; \
+    for (size_t i = get_local_id(0); i < 256; i += get_local_size(0)) { \
+        Td0_local[i] = Td0[i]; \
+        Td4s_local[i] = Td4s[i]; \
+    }
+#else
+#define AES_TE_LOCAL_SETUP()
+#define AES_TE_LOCAL_PARAM
+#define AES_TE_LOCAL_ARG
+#define AES_TD_LOCAL_SETUP()
 #endif
 
 #if AES_KEY_LOCAL
-    __local uint rk_local[60];
-    __local uint* rk = rk_local;
-    size_t rk_num = (Nr + 1) << 2;
-    if (get_local_id(0) < rk_num) {
-        rk_local[get_local_id(0)] = rk_global[get_local_id(0)];
-    }
+#define AES_RK_SPACE __local
+#define AES_RK_SETUP(rk, rk_global, Nr) \
+    __local uint rk_local[60]; \
+    __local const uint *rk = rk_local; \
+    for (size_t i = get_local_id(0); i < (size_t)((Nr + 1) << 2); i += get_local_size(0)) \
+        rk_local[i] = rk_global[i]
 #else
-    __constant uint* rk = rk_global;
+#define AES_RK_SPACE __constant
+#define AES_RK_SETUP(rk, rk_global, Nr) \
+    __constant const uint *rk = rk_global
 #endif
 
 #if AES_SMALL_TABLES_LOCAL || AES_KEY_LOCAL
-    barrier(CLK_LOCAL_MEM_FENCE);
+#define AES_LOCAL_BARRIER() barrier(CLK_LOCAL_MEM_FENCE)
+#else
+#define AES_LOCAL_BARRIER()
 #endif
 
-    __global const uchar *pt = pt_buf + get_global_id(0) * 16;
-    __global uchar *ct = ct_buf + get_global_id(0) * 16;
+/*
+ * index of block k of this work-item: each work-group covers
+ * AES_BLOCKS_PER_ITEM * local size consecutive blocks, and for a given k
+ * neighbouring work-items access neighbouring blocks so accesses coalesce
+ */
+#define AES_BLOCK_INDEX(k) \
+    ((get_group_id(0) * AES_BLOCKS_PER_ITEM + (k)) * get_local_size(0) + get_local_id(0))
 
-    /* read block */
-    uint pt_0 = *(__global const uint*)(pt);
-    uint pt_1 = *(__global const uint*)(pt + 4);
-    uint pt_2 = *(__global const uint*)(pt + 8);
-    uint pt_3 = *(__global const uint*)(pt + 12);
-    
-	/*
-	 * map byte array block to cipher state
-	 * and add initial round key:
-	 */
-	s0 = as_uint(as_uchar4(pt_0).wzyx) ^ rk[0];
-	s1 = as_uint(as_uchar4(pt_1).wzyx) ^ rk[1];
-	s2 = as_uint(as_uchar4(pt_2).wzyx) ^ rk[2];
-	s3 = as_uint(as_uchar4(pt_3).wzyx) ^ rk[3];
-    
 #define ROUND(i,d,s) \
 d##0 = TE0(s##0) ^ TE1(s##1) ^ TE2(s##2) ^ TE3(s##3) ^ rk[4 * i]; \
 d##1 = TE0(s##1) ^ TE1(s##2) ^ TE2(s##3) ^ TE3(s##0) ^ rk[4 * i + 1]; \
 d##2 = TE0(s##2) ^ TE1(s##3) ^ TE2(s##0) ^ TE3(s##1) ^ rk[4 * i + 2]; \
 d##3 = TE0(s##3) ^ TE1(s##0) ^ TE2(s##1) ^ TE3(s##2) ^ rk[4 * i + 3]
-    
-	/* Nr - 1 full rounds: */
-	r = Nr >> 1;
-	for (;;) {
-		ROUND(1,t,s);
-		rk += 8;
-		if (--r == 0)
-			break;
-		ROUND(0,s,t);
-	}
-    
+
+/*
+ * encrypt one block held as four big endian column words, defined once for
+ * each address space the round keys are read from
+ */
+#define AES_ENCRYPT_STATE(name, rk_space) \
+uint4 name(rk_space const uint *rk, int Nr, uint4 in AES_TE_LOCAL_PARAM) \
+{ \
+	uint s0, s1, s2, s3, t0, t1, t2, t3; \
+	int r; \
+\
+	/* add initial round key: */ \
+	s0 = in.x ^ rk[0]; \
+	s1 = in.y ^ rk[1]; \
+	s2 = in.z ^ rk[2]; \
+	s3 = in.w ^ rk[3]; \
+\
+	/* Nr - 1 full rounds: */ \
+	r = Nr >> 1; \
+	for (;;) { \
+		ROUND(1,t,s); \
+		rk += 8; \
+		if (--r == 0) \
+			break; \
+		ROUND(0,s,t); \
+	} \
+\
+	/* apply last round: */ \
+	return (uint4)(TE41(t0) ^ TE42(t1) ^ TE43(t2) ^ TE44(t3) ^ rk[0], \
+	               TE41(t1) ^ TE42(t2) ^ TE43(t3) ^ TE44(t0) ^ rk[1], \
+	               TE41(t2) ^ TE42(t3) ^ TE43(t0) ^ TE44(t1) ^ rk[2], \
+	               TE41(t3) ^ TE42(t0) ^ TE43(t1) ^ TE44(t2) ^ rk[3]); \
+}
+
+AES_ENCRYPT_STATE(aes_encrypt_state, AES_RK_SPACE)
+
+/* per work-item keys, see aes_rijndael_ctr_batch */
+AES_ENCRYPT_STATE(aes_encrypt_state_global, __global)
+
 #undef ROUND
-    
-	/*
-	 * apply last round and
-	 * map cipher state to byte array block:
-	 */
-	uint ct_0 = as_uint(as_uchar4(TE41(t0) ^ TE42(t1) ^ TE43(t2) ^ TE44(t3) ^ rk[0]).wzyx);
-	uint ct_1 = as_uint(as_uchar4(TE41(t1) ^ TE42(t2) ^ TE43(t3) ^ TE44(t0) ^ rk[1]).wzyx);
-	uint ct_2 = as_uint(as_uchar4(TE41(t2) ^ TE42(t3) ^ TE43(t0) ^ TE44(t1) ^ rk[2]).wzyx);
-	uint ct_3 = as_uint(as_uchar4(TE41(t3) ^ TE42(t0) ^ TE43(t1) ^ TE44(t2) ^ rk[3]).wzyx);
-    
-    /* write block */
-    *(__global uint*)(ct) = ct_0;
-    *(__global uint*)(ct + 4) = ct_1;
-    *(__global uint*)(ct + 8) = ct_2;
-    *(__global uint*)(ct + 12) = ct_3;
+
+/*
+ * counter block n of a stream starting at cb: cb + n as a 128-bit big endian
+ * integer, or with ctr32 only the last 32 bits wrap around (GCM inc32)
+ */
+uint4 aes_ctr_block(uint4 cb, ulong n, int ctr32)
+{
+	ulong lo, hi;
+
+	if (ctr32)
+		return (uint4)(cb.x, cb.y, cb.z, cb.w + (uint)n);
+
+	lo = upsample(cb.z, cb.w) + n;
+	hi = upsample(cb.x, cb.y) + (lo < n);
+	return (uint4)((uint)(hi >> 32), (uint)hi, (uint)(lo >> 32), (uint)lo);
 }
 
-__kernel void aes_rijndael_decrypt(__constant uint *rk_global, int Nr,  __global const uchar *ct_buf /*[16]*/, __global uchar *pt_buf /*[16]*/)
+__kernel void aes_rijndael_encrypt(__constant uint *rk_global, int Nr, __global const uchar *pt_buf /*[16]*/, __global uchar *ct_buf /*[16]*/)
 {
-	uint s0, s1, s2, s3, t0, t1, t2, t3;
-	int r;
-    
-#if AES_SMALL_TABLES_LOCAL
-    __local uint Td0_local[256];
-    __local uchar Td4s_local[256];
-    
-    Td0_local[get_local_id(0)] = Td0[get_local_id(0)];
-    Td4s_local[get_local_id(0)] = Td4s_local[get_local_id(0)];
+    AES_TE_LOCAL_SETUP();
+    AES_RK_SETUP(rk, rk_global, Nr);
+    AES_LOCAL_BARRIER();
+
+    for (int k = 0; k < AES_BLOCKS_PER_ITEM; k++) {
+        __global const uchar *pt = pt_buf + AES_BLOCK_INDEX(k) * 16;
+        __global uchar *ct = ct_buf + AES_BLOCK_INDEX(k) * 16;
+
+        /* read block */
+        uint pt_0 = *(__global const uint*)(pt);
+        uint pt_1 = *(__global const uint*)(pt + 4);
+        uint pt_2 = *(__global const uint*)(pt + 8);
+        uint pt_3 = *(__global const uint*)(pt + 12);
+
+	/* map byte array block to cipher state */
+	uint4 s = (uint4)(as_uint(as_uchar4(pt_0).wzyx),
+	                  as_uint(as_uchar4(pt_1).wzyx),
+	                  as_uint(as_uchar4(pt_2).wzyx),
+	                  as_uint(as_uchar4(pt_3).wzyx));
+
+	s = aes_encrypt_state(rk, Nr, s AES_TE_LOCAL_ARG);
+
+        /* map cipher state to byte array block and write block */
+        *(__global uint*)(ct) = as_uint(as_uchar4(s.x).wzyx);
+        *(__global uint*)(ct + 4) = as_uint(as_uchar4(s.y).wzyx);
+        *(__global uint*)(ct + 8) = as_uint(as_uchar4(s.z).wzyx);
+        *(__global uint*)(ct + 12) = as_uint(as_uchar4(s.w).wzyx);
+    }
+}
+
+/*
+ * Counter mode: block i of in_buf is XORed with the encryption of counter
+ * block number block_offset + i, AES_BLOCKS_PER_ITEM blocks per work-item.
+ * cb is the initial counter block as big endian words and the buffers hold
+ * a whole number of blocks.
+ */
+__kernel void aes_rijndael_ctr(__constant uint *rk_global, int Nr, uint4 cb, ulong block_offset, int ctr32,
+                               __global const uchar *in_buf, __global uchar *out_buf)
+{
+    AES_TE_LOCAL_SETUP();
+    AES_RK_SETUP(rk, rk_global, Nr);
+    AES_LOCAL_BARRIER();
+
+    for (int k = 0; k < AES_BLOCKS_PER_ITEM; k++) {
+        size_t i = AES_BLOCK_INDEX(k);
+        uint4 ks = aes_encrypt_state(rk, Nr, aes_ctr_block(cb, block_offset + i, ctr32)
+                                     AES_TE_LOCAL_ARG);
+
+        __global const uint *in = (__global const uint*)(in_buf + i * 16);
+        __global uint *out = (__global uint*)(out_buf + i * 16);
+
+        out[0] = in[0] ^ as_uint(as_uchar4(ks.x).wzyx);
+        out[1] = in[1] ^ as_uint(as_uchar4(ks.y).wzyx);
+        out[2] = in[2] ^ as_uint(as_uchar4(ks.z).wzyx);
+        out[3] = in[3] ^ as_uint(as_uchar4(ks.w).wzyx);
+    }
+}
+
+/* Counter mode keystream only: AES_BLOCKS_PER_ITEM blocks of ks_buf per work-item */
+__kernel void aes_rijndael_ctr_keystream(__constant uint *rk_global, int Nr, uint4 cb, ulong block_offset, int ctr32,
+                                         __global uchar *ks_buf)
+{
+    AES_TE_LOCAL_SETUP();
+    AES_RK_SETUP(rk, rk_global, Nr);
+    AES_LOCAL_BARRIER();
+
+    for (int k = 0; k < AES_BLOCKS_PER_ITEM; k++) {
+        size_t i = AES_BLOCK_INDEX(k);
+        uint4 ks = aes_encrypt_state(rk, Nr, aes_ctr_block(cb, block_offset + i, ctr32)
+                                     AES_TE_LOCAL_ARG);
+
+        __global uint *out = (__global uint*)(ks_buf + i * 16);
+
+        out[0] = as_uint(as_uchar4(ks.x).wzyx);
+        out[1] = as_uint(as_uchar4(ks.y).wzyx);
+        out[2] = as_uint(as_uchar4(ks.z).wzyx);
+        out[3] = as_uint(as_uchar4(ks.w).wzyx);
+    }
+}
+
+/*
+ * Batched counter mode: many messages, each with its own key, in one
+ * NDRange. Key schedule k is rk_table[k * AES_RK_WORDS ...] in the host
+ * layout, with Nr in the last word. Message m is desc[m]: its key index,
+ * initial counter block and counter mode, its byte offset in the buffers
+ * (a multiple of 16) and length, and the number of blocks in the messages
+ * before it. Block i of the batch belongs to the last message whose
+ * first_block is <= i, found by binary search; bytes past the end of a
+ * message are not written. total_blocks is desc[num_msgs - 1].first_block
+ * plus the blocks of the last message.
+ */
+#define AES_RK_WORDS 61
+
+typedef struct {
+    uint4 cb;
+    ulong offset;
+    ulong length;
+    uint key_index;
+    uint ctr32;
+    ulong first_block;
+} aes_batch_desc;
+
+__kernel void aes_rijndael_ctr_batch(__global const uint *rk_table, __global const aes_batch_desc *desc, uint num_msgs,
+                                     ulong total_blocks, __global const uchar *in_buf, __global uchar *out_buf)
+{
+    AES_TE_LOCAL_SETUP();
+    AES_LOCAL_BARRIER();
+
+    for (int k = 0; k < AES_BLOCKS_PER_ITEM; k++) {
+        ulong i = AES_BLOCK_INDEX(k);
+        if (i >= total_blocks)
+            continue;
+
+        uint lo = 0, hi = num_msgs - 1;
+        while (lo < hi) {
+            uint mid = (lo + hi + 1) >> 1;
+            if (desc[mid].first_block <= i)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+        __global const aes_batch_desc *d = desc + lo;
+
+        ulong n = i - d->first_block;
+        __global const uint *rk = rk_table + d->key_index * AES_RK_WORDS;
+        uint4 ks = aes_encrypt_state_global(rk, (int)rk[AES_RK_WORDS - 1], aes_ctr_block(d->cb, n, d->ctr32)
+                                            AES_TE_LOCAL_ARG);
+
+        ulong pos = d->offset + n * 16;
+        ulong len = d->length - n * 16;
+        if (len >= 16) {
+            __global const uint *in = (__global const uint*)(in_buf + pos);
+            __global uint *out = (__global uint*)(out_buf + pos);
+
+            out[0] = in[0] ^ as_uint(as_uchar4(ks.x).wzyx);
+            out[1] = in[1] ^ as_uint(as_uchar4(ks.y).wzyx);
+            out[2] = in[2] ^ as_uint(as_uchar4(ks.z).wzyx);
+            out[3] = in[3] ^ as_uint(as_uchar4(ks.w).wzyx);
+        } else {
+            uint w[4] = { ks.x, ks.y, ks.z, ks.w };
+            for (uint j = 0; j < len; j++)
+                out_buf[pos + j] = in_buf[pos + j] ^ (uchar)(w[j >> 2] >> (24 - 8 * (j & 3)));
+        }
+    }
+}
+
+/*
+ * GHASH
+ *
+ * Blocks are held as ulong2 with x = bytes 0..7 and y = bytes 8..15 as big
+ * endian integers. The GHASH of X_1..X_n is sum X_i * H^(n - i + 1). Each
+ * work-item folds a chunk of consecutive blocks with Horner's rule, the
+ * chunks of a work-group are combined by a tree reduction in local memory
+ * using hpow[k] = H^(2^k), and aes_ghash_reduce combines the per-group
+ * partial sums the same way until one value is left. Leading zero blocks do
+ * not change the sum, so the sequence is padded at the front to fill the
+ * last work-group. The final multiplication by H is done by aes_gcm_tag.
+ */
+
+/* last4[i] = i * R >> 48 for R = 11100001 || 0^120, see aes-gcm.c */
+__constant ulong gf_last4[16] = {
+    0x0000, 0x1c20, 0x3840, 0x2460,
+    0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560,
+    0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/* z = x * y in GF(2^128), one bit at a time */
+ulong2 gf_mult(ulong2 x, ulong2 y)
+{
+	ulong2 z = (ulong2)(0, 0);
+	ulong m, t;
+	int i;
+
+	for (i = 0; i < 128; i++) {
+		m = -((i < 64 ? x.x >> (63 - i) : x.y >> (127 - i)) & 1);
+		z.x ^= y.x & m;
+		z.y ^= y.y & m;
+		t = (y.y & 1) * 0xe100000000000000UL;
+		y.y = (y.x << 63) | (y.y >> 1);
+		y.x = (y.x >> 1) ^ t;
+	}
+
+	return z;
+}
+
+/* 4-bit (Shoup) table M[i] = i * m in GCM bit order, as ghash_init_key() */
+void gf_table_init(__local ulong2 *M, ulong2 m)
+{
+	ulong t;
+	int i, j;
+
+	M[0] = (ulong2)(0, 0);
+	M[8] = m;
+	for (i = 4; i > 0; i >>= 1) {
+		t = (m.y & 1) * 0xe1000000;
+		m.y = (m.x << 63) | (m.y >> 1);
+		m.x = (m.x >> 1) ^ (t << 32);
+		M[i] = m;
+	}
+	for (i = 2; i <= 8; i *= 2)
+		for (j = 1; j < i; j++)
+			M[i + j] = M[i] ^ M[j];
+}
+
+/* z = x * m with the table of m, four bits at a time as gf_mult_4bit() */
+ulong2 gf_mult_4bit(__local const ulong2 *M, ulong2 x)
+{
+	ulong2 z;
+	ulong rem;
+	int i;
+
+	z = M[x.y & 0xf];
+	for (i = 1; i < 32; i++) {
+		rem = z.y & 0xf;
+		z.y = (z.x << 60) | (z.y >> 4);
+		z.x = (z.x >> 4) ^ (gf_last4[rem] << 48);
+		z ^= M[(i < 16 ? x.y >> (4 * i) : x.x >> (4 * (i - 16))) & 0xf];
+	}
+
+	return z;
+}
+
+/*
+ * block i of a buffer holding len bytes, with the last block zero padded;
+ * a partial last block is read a byte at a time so that nothing past
+ * buf + len is touched
+ */
+ulong2 ghash_load(__global const uchar *buf, ulong len, ulong i)
+{
+	__global const ulong *p = (__global const ulong*)(buf + i * 16);
+	ulong left = len - i * 16;
+	ulong2 x = (ulong2)(0, 0);
+	ulong j;
+
+	if (left >= 16)
+		return (ulong2)(as_ulong(as_uchar8(p[0]).s76543210),
+		                as_ulong(as_uchar8(p[1]).s76543210));
+
+	for (j = 0; j < left; j++) {
+		if (j < 8)
+			x.x |= (ulong)buf[i * 16 + j] << (56 - 8 * j);
+		else
+			x.y |= (ulong)buf[i * 16 + j] << (120 - 8 * j);
+	}
+
+	return x;
+}
+
+/*
+ * Combine the values of the work-group: each work-item value is followed by
+ * 2^shift blocks of the work-items after it.
+ */
+ulong2 ghash_tree(__local ulong2 *scratch, __global const ulong2 *hpow, int shift, ulong2 acc)
+{
+	size_t lid = get_local_id(0), stride;
+
+	scratch[lid] = acc;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (stride = 1; stride < get_local_size(0); stride <<= 1, shift++) {
+		if ((lid & (2 * stride - 1)) == 0)
+			scratch[lid] = gf_mult(scratch[lid], hpow[shift]) ^ scratch[lid + stride];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	return scratch[0];
+}
+
+/* hpow[k] = H^(2^k) for k = 0..63, H = E(K, 0^128); one work-item */
+__kernel void aes_ghash_powers(__constant uint *rk_global, int Nr, __global ulong2 *hpow)
+{
+    AES_TE_LOCAL_SETUP();
+    AES_RK_SETUP(rk, rk_global, Nr);
+    AES_LOCAL_BARRIER();
+
+    if (get_global_id(0) != 0)
+        return;
+
+    uint4 h = aes_encrypt_state(rk, Nr, (uint4)(0, 0, 0, 0) AES_TE_LOCAL_ARG);
+    ulong2 p = (ulong2)(upsample(h.x, h.y), upsample(h.z, h.w));
+    for (int k = 0; k < 64; k++) {
+        hpow[k] = p;
+        p = gf_mult(p, p);
+    }
+}
+
+/*
+ * First GHASH pass over A || 0^v || C || 0^u || [len(A)]_64 || [len(C)]_64
+ * preceded by pad zero blocks. Each work-item folds 2^chunk_log2 blocks and
+ * each work-group writes one partial sum. The local size must be a power of
+ * two and scratch must hold one ulong2 per work-item. aad and crypt need
+ * only hold aad_len and crypt_len bytes.
+ */
+__kernel void aes_gcm_ghash(__global const ulong2 *hpow, __global const uchar *aad, ulong aad_len,
+                            __global const uchar *crypt, ulong crypt_len, ulong pad, int chunk_log2,
+                            __local ulong2 *scratch, __global ulong2 *partial)
+{
+    __local ulong2 M[16];
+    ulong na = (aad_len + 15) >> 4;
+    ulong nc = (crypt_len + 15) >> 4;
+    ulong v = (ulong)get_global_id(0) << chunk_log2;
+    ulong end = v + ((ulong)1 << chunk_log2);
+    ulong2 acc = (ulong2)(0, 0), x;
+
+    if (get_local_id(0) == 0)
+        gf_table_init(M, hpow[0]);
     barrier(CLK_LOCAL_MEM_FENCE);
-#endif
 
-#if AES_KEY_LOCAL
-    __local uint rk_local[60];
-    __local uint* rk = rk_local;
-    size_t rk_num = (Nr + 1) << 2;
-    if (get_local_id(0) < rk_num) {
-        rk_local[get_local_id(0)] = rk_global[get_local_id(0)];
+    for (v = v < pad ? pad : v; v < end; v++) {
+        ulong i = v - pad;
+        if (i < na)
+            x = ghash_load(aad, aad_len, i);
+        else if (i < na + nc)
+            x = ghash_load(crypt, crypt_len, i - na);
+        else
+            x = (ulong2)(aad_len * 8, crypt_len * 8);
+        acc = gf_mult_4bit(M, acc) ^ x;
     }
-#else
-    __constant uint* rk = rk_global;
-#endif
 
-#if AES_SMALL_TABLES_LOCAL || AES_KEY_LOCAL
+    acc = ghash_tree(scratch, hpow, chunk_log2, acc);
+    if (get_local_id(0) == 0)
+        partial[get_group_id(0)] = acc;
+}
+
+/*
+ * Further GHASH passes over n partial sums preceded by pad zero values,
+ * where each value is followed by 2^shift blocks of the next one.
+ */
+__kernel void aes_ghash_reduce(__global const ulong2 *hpow, int shift, __global const ulong2 *in, ulong n,
+                               ulong pad, int chunk_log2, __local ulong2 *scratch, __global ulong2 *out)
+{
+    __local ulong2 M[16];
+    ulong v = (ulong)get_global_id(0) << chunk_log2;
+    ulong end = v + ((ulong)1 << chunk_log2);
+    ulong2 acc = (ulong2)(0, 0);
+
+    if (get_local_id(0) == 0)
+        gf_table_init(M, hpow[shift]);
     barrier(CLK_LOCAL_MEM_FENCE);
-#endif
 
-    __global const uchar *ct = ct_buf + get_global_id(0) * 16;
-    __global uchar *pt = pt_buf + get_global_id(0) * 16;
-    
-    /* read block */
-    uint ct_0 = *(__global const uint*)(ct);
-    uint ct_1 = *(__global const uint*)(ct + 4);
-    uint ct_2 = *(__global const uint*)(ct + 8);
-    uint ct_3 = *(__global const uint*)(ct + 12);
-    
+    for (v = v < pad ? pad : v; v < end; v++)
+        acc = gf_mult_4bit(M, acc) ^ in[v - pad];
+
+    acc = ghash_tree(scratch, hpow, shift + chunk_log2, acc);
+    if (get_local_id(0) == 0)
+        out[get_group_id(0)] = acc;
+}
+
+/* T = GHASH * H XOR E(K, J0), written as 16 bytes; one work-item */
+__kernel void aes_gcm_tag(__constant uint *rk_global, int Nr, uint4 j0, __global const ulong2 *hpow,
+                          __global const ulong2 *ghash, __global uchar *tag)
+{
+    AES_TE_LOCAL_SETUP();
+    AES_RK_SETUP(rk, rk_global, Nr);
+    AES_LOCAL_BARRIER();
+
+    if (get_global_id(0) != 0)
+        return;
+
+    uint4 ek = aes_encrypt_state(rk, Nr, j0 AES_TE_LOCAL_ARG);
+    ulong2 s = gf_mult(ghash[0], hpow[0]) ^ (ulong2)(upsample(ek.x, ek.y), upsample(ek.z, ek.w));
+
+    __global ulong *t = (__global ulong*)tag;
+    t[0] = as_ulong(as_uchar8(s.x).s76543210);
+    t[1] = as_ulong(as_uchar8(s.y).s76543210);
+}
+
+__kernel void aes_rijndael_decrypt(__constant uint *rk_global, int Nr,  __global const uchar *ct_buf /*[16]*/, __global uchar *pt_buf /*[16]*/)
+{
+	uint s0, s1, s2, s3, t0, t1, t2, t3;
+	int r;
+
+    AES_TD_LOCAL_SETUP();
+    AES_RK_SETUP(rk_key, rk_global, Nr);
+    AES_LOCAL_BARRIER();
+
+    for (int k = 0; k < AES_BLOCKS_PER_ITEM; k++) {
+        AES_RK_SPACE const uint *rk = rk_key;
+        __global const uchar *ct = ct_buf + AES_BLOCK_INDEX(k) * 16;
+        __global uchar *pt = pt_buf + AES_BLOCK_INDEX(k) * 16;
+
+        /* read block */
+        uint ct_0 = *(__global const uint*)(ct);
+        uint ct_1 = *(__global const uint*)(ct + 4);
+        uint ct_2 = *(__global const uint*)(ct + 8);
+        uint ct_3 = *(__global const uint*)(ct + 12);
+
 	/*
 	 * map byte array block to cipher state
 	 * and add initial round key:
@@ -935,10 +1333,11 @@ d##3 = TD0(s##3) ^ TD1(s##2) ^ TD2(s##1) ^ TD3(s##0) ^ rk[4 * i + 3]
 	uint pt_2 = as_uint(as_uchar4(TD41(t2) ^ TD42(t1) ^ TD43(t0) ^ TD44(t3) ^ rk[2]).wzyx);
 	uint pt_3 = as_uint(as_uchar4(TD41(t3) ^ TD42(t2) ^ TD43(t1) ^ TD44(t0) ^ rk[3]).wzyx);
 
-    /* write block */
-    *(__global uint*)(pt) = pt_0;
-    *(__global uint*)(pt + 4) = pt_1;
-    *(__global uint*)(pt + 8) = pt_2;
-    *(__global uint*)(pt + 12) = pt_3;
+        /* write block */
+        *(__global uint*)(pt) = pt_0;
+        *(__global uint*)(pt + 4) = pt_1;
+        *(__global uint*)(pt + 8) = pt_2;
+        *(__global uint*)(pt + 12) = pt_3;
+    }
 }
 
@@ -21,6 +21,35 @@ extern "C" {
 #include "aes-internal.h"
 #include "aes-debug.h"
 
+/* CPU features used for runtime backend selection */
+#define AES_CPU_AESNI       0x0001 /* AES-NI and SSSE3 */
+#define AES_CPU_PCLMUL      0x0002 /* PCLMULQDQ and SSSE3 */
+#define AES_CPU_VAES        0x0004 /* VAES, VPCLMULQDQ and AVX-512 (F, BW) */
+
+/*
+ * Not a CPU feature: the portable counter mode code uses the constant-time
+ * bitsliced AES instead of the T-tables. Always available; on by default
+ * unless built with AES_NO_BITSLICE.
+ */
+#define AES_CPU_BITSLICE    0x0100
+
+int aes_cpu_features(void);
+void aes_cpu_set_features(int mask);
+
+/*
+ * Expanded AES key schedule. It holds no pointers, so it may live on the
+ * stack, in an arena or inside another structure; aes_encrypt() and
+ * aes_decrypt() accept a pointer to it in place of the context returned by
+ * aes_encrypt_init()/aes_decrypt_init().
+ */
+struct aes_key {
+	aes_uint rk[AES_PRIV_SIZE / sizeof(aes_uint)] AES_ALIGNED(16);
+};
+
+int AES_WARN_UNUSED_RESULT aes_encrypt_key_init(struct aes_key *key, const aes_uchar *k, size_t len);
+int AES_WARN_UNUSED_RESULT aes_decrypt_key_init(struct aes_key *key, const aes_uchar *k, size_t len);
+void aes_key_clear(struct aes_key *key);
+
 void * aes_encrypt_init(const aes_uchar *key, size_t len);
 void aes_encrypt(void *ctx, const aes_uchar *plain, aes_uchar *crypt);
 void aes_encrypt_deinit(void *ctx);
@@ -50,6 +79,73 @@ int AES_WARN_UNUSED_RESULT aes_128_cbc_encrypt(const aes_uchar *key, const aes_u
                                                size_t data_len);
 int AES_WARN_UNUSED_RESULT aes_128_cbc_decrypt(const aes_uchar *key, const aes_uchar *iv, aes_uchar *data,
                                                size_t data_len);
+
+/* Modes with a pre-expanded key (encryption schedule unless noted) */
+int AES_WARN_UNUSED_RESULT aes_key_wrap(const struct aes_key *kek, int n, const aes_uchar *plain,
+                                        aes_uchar *cipher);
+int AES_WARN_UNUSED_RESULT aes_key_unwrap(const struct aes_key *kek_dec, int n, const aes_uchar *cipher,
+                                          aes_uchar *plain);
+int AES_WARN_UNUSED_RESULT omac1_aes_vector(const struct aes_key *key, size_t num_elem,
+                                            const aes_uchar *addr[], const size_t *len,
+                                            aes_uchar *mac);
+int AES_WARN_UNUSED_RESULT omac1_aes(const struct aes_key *key, const aes_uchar *data, size_t data_len,
+                                     aes_uchar *mac);
+int AES_WARN_UNUSED_RESULT aes_ctr_encrypt(const struct aes_key *key, const aes_uchar *nonce,
+                                           aes_uchar *data, size_t data_len);
+int AES_WARN_UNUSED_RESULT aes_eax_encrypt(const struct aes_key *key,
+                                           const aes_uchar *nonce, size_t nonce_len,
+                                           const aes_uchar *hdr, size_t hdr_len,
+                                           aes_uchar *data, size_t data_len, aes_uchar *tag);
+int AES_WARN_UNUSED_RESULT aes_eax_decrypt(const struct aes_key *key,
+                                           const aes_uchar *nonce, size_t nonce_len,
+                                           const aes_uchar *hdr, size_t hdr_len,
+                                           aes_uchar *data, size_t data_len, const aes_uchar *tag);
+int AES_WARN_UNUSED_RESULT aes_cbc_encrypt(const struct aes_key *key, const aes_uchar *iv, aes_uchar *data,
+                                           size_t data_len);
+int AES_WARN_UNUSED_RESULT aes_cbc_decrypt(const struct aes_key *key_dec, const aes_uchar *iv,
+                                           aes_uchar *data, size_t data_len);
+int AES_WARN_UNUSED_RESULT aes_cbc_decrypt_threads(const struct aes_key *key_dec, const aes_uchar *iv,
+                                                   aes_uchar *data, size_t data_len, int num_threads);
+int AES_WARN_UNUSED_RESULT aes_ccm_seal(const struct aes_key *key, const aes_uchar *nonce,
+                                        size_t nonce_len, size_t M,
+                                        const aes_uchar *plain, size_t plain_len,
+                                        const aes_uchar *aad, size_t aad_len, aes_uchar *crypt,
+                                        aes_uchar *auth);
+int AES_WARN_UNUSED_RESULT aes_ccm_open(const struct aes_key *key, const aes_uchar *nonce,
+                                        size_t nonce_len, size_t M,
+                                        const aes_uchar *crypt, size_t crypt_len,
+                                        const aes_uchar *aad, size_t aad_len, const aes_uchar *auth,
+                                        aes_uchar *plain);
+
+/*
+ * Multi-buffer CBC encryption of independent streams. Jobs are submitted to
+ * a manager that encrypts up to AES_CBC_MB_LANES of them together, a block
+ * from each lane at a time. On completion a job's data holds the ciphertext
+ * and its iv the last ciphertext block. Jobs are returned in completion
+ * order, not in submission order.
+ */
+#define AES_CBC_MB_LANES 8
+
+struct aes_cbc_job {
+	const struct aes_key *key;	/* encryption key schedule */
+	aes_uchar iv[AES_BLOCK_SIZE];
+	aes_uchar *data;		/* encrypted in place */
+	size_t data_len;		/* must be divisible by 16 */
+	void *user_data;
+};
+
+struct aes_cbc_mb {
+	struct aes_cbc_job *lane[AES_CBC_MB_LANES];
+	size_t done[AES_CBC_MB_LANES];
+	struct aes_cbc_job *finished[AES_CBC_MB_LANES];
+	int num_finished;
+	int lanes;
+};
+
+void aes_cbc_mb_init(struct aes_cbc_mb *mb);
+struct aes_cbc_job * aes_cbc_mb_submit(struct aes_cbc_mb *mb, struct aes_cbc_job *job);
+struct aes_cbc_job * aes_cbc_mb_flush(struct aes_cbc_mb *mb);
+
 int AES_WARN_UNUSED_RESULT aes_gcm_ae(const aes_uchar *key, size_t key_len,
                                       const aes_uchar *iv, size_t iv_len,
                                       const aes_uchar *plain, size_t plain_len,
@@ -60,6 +156,100 @@ int AES_WARN_UNUSED_RESULT aes_gcm_ad(const aes_uchar *key, size_t key_len,
                                       const aes_uchar *crypt, size_t crypt_len,
                                       const aes_uchar *aad, size_t aad_len, const aes_uchar *tag,
                                       aes_uchar *plain);
+
+/* AES-EAX key context: expanded key and OMAC subkeys */
+struct aes_eax_ctx {
+	struct aes_key key;
+	aes_uchar k1[AES_BLOCK_SIZE];
+	aes_uchar k2[AES_BLOCK_SIZE];
+	struct aes_bs_key bk;
+};
+
+int AES_WARN_UNUSED_RESULT aes_eax_ctx_init(struct aes_eax_ctx *ctx, const aes_uchar *key, size_t key_len);
+void aes_eax_ctx_clear(struct aes_eax_ctx *ctx);
+int AES_WARN_UNUSED_RESULT aes_eax_seal(const struct aes_eax_ctx *ctx,
+                                        const aes_uchar *nonce, size_t nonce_len,
+                                        const aes_uchar *hdr, size_t hdr_len,
+                                        aes_uchar *data, size_t data_len, aes_uchar *tag);
+int AES_WARN_UNUSED_RESULT aes_eax_open(const struct aes_eax_ctx *ctx,
+                                        const aes_uchar *nonce, size_t nonce_len,
+                                        const aes_uchar *hdr, size_t hdr_len,
+                                        aes_uchar *data, size_t data_len, const aes_uchar *tag);
+
+/* AES-CMAC (OMAC1) key context: expanded key and subkeys */
+struct aes_cmac_ctx {
+	struct aes_key key;
+	aes_uchar k1[AES_BLOCK_SIZE];
+	aes_uchar k2[AES_BLOCK_SIZE];
+};
+
+/* AES-CMAC incremental message state (refers to, but does not own, ctx) */
+struct aes_cmac_stream {
+	const struct aes_cmac_ctx *ctx;
+	aes_uchar cbc[AES_BLOCK_SIZE];
+	aes_uchar buf[AES_BLOCK_SIZE];
+	size_t buf_len;
+};
+
+int AES_WARN_UNUSED_RESULT aes_cmac_ctx_init(struct aes_cmac_ctx *ctx, const aes_uchar *key, size_t key_len);
+void aes_cmac_ctx_clear(struct aes_cmac_ctx *ctx);
+void aes_cmac_init(struct aes_cmac_stream *st, const struct aes_cmac_ctx *ctx);
+void aes_cmac_update(struct aes_cmac_stream *st, const aes_uchar *data, size_t len);
+void aes_cmac_final(struct aes_cmac_stream *st, aes_uchar *mac);
+int AES_WARN_UNUSED_RESULT aes_cmac(const struct aes_cmac_ctx *ctx, const aes_uchar *data, size_t data_len,
+                                    aes_uchar *mac);
+void aes_cmac_multi(const struct aes_cmac_ctx *ctx[], size_t num, const aes_uchar *data[],
+                    const size_t len[], aes_uchar *mac[]);
+
+/* AES-GCM key context: expanded key and precomputed GHASH key */
+struct aes_gcm_ctx {
+	struct aes_key key;
+	struct aes_ghash_key hk;
+	struct aes_bs_key bk;
+};
+
+int AES_WARN_UNUSED_RESULT aes_gcm_ctx_init(struct aes_gcm_ctx *ctx, const aes_uchar *key, size_t key_len);
+void aes_gcm_ctx_clear(struct aes_gcm_ctx *ctx);
+struct aes_gcm_ctx * aes_gcm_key_init(const aes_uchar *key, size_t key_len);
+void aes_gcm_key_free(struct aes_gcm_ctx *ctx);
+int AES_WARN_UNUSED_RESULT aes_gcm_seal(const struct aes_gcm_ctx *ctx,
+                                        const aes_uchar *iv, size_t iv_len,
+                                        const aes_uchar *plain, size_t plain_len,
+                                        const aes_uchar *aad, size_t aad_len,
+                                        aes_uchar *crypt, aes_uchar *tag);
+int AES_WARN_UNUSED_RESULT aes_gcm_open(const struct aes_gcm_ctx *ctx,
+                                        const aes_uchar *iv, size_t iv_len,
+                                        const aes_uchar *crypt, size_t crypt_len,
+                                        const aes_uchar *aad, size_t aad_len, const aes_uchar *tag,
+                                        aes_uchar *plain);
+
+/* AES-GCM incremental message state (refers to, but does not own, ctx) */
+struct aes_gcm_stream {
+	const struct aes_gcm_ctx *ctx;
+	aes_uchar J0[AES_BLOCK_SIZE];
+	aes_uchar cb[AES_BLOCK_SIZE];
+	aes_uchar S[16];
+	aes_uchar ks[AES_BLOCK_SIZE];
+	aes_uchar buf[AES_BLOCK_SIZE];
+	size_t buf_len;
+	aes_ulong aad_len;
+	aes_ulong crypt_len;
+	int state;
+};
+
+int AES_WARN_UNUSED_RESULT aes_gcm_stream_init(struct aes_gcm_stream *st,
+                                               const struct aes_gcm_ctx *ctx,
+                                               const aes_uchar *iv, size_t iv_len);
+int AES_WARN_UNUSED_RESULT aes_gcm_aad_update(struct aes_gcm_stream *st,
+                                              const aes_uchar *aad, size_t aad_len);
+int AES_WARN_UNUSED_RESULT aes_gcm_encrypt_update(struct aes_gcm_stream *st,
+                                                  const aes_uchar *plain, size_t plain_len,
+                                                  aes_uchar *crypt);
+int AES_WARN_UNUSED_RESULT aes_gcm_decrypt_update(struct aes_gcm_stream *st,
+                                                  const aes_uchar *crypt, size_t crypt_len,
+                                                  aes_uchar *plain);
+int AES_WARN_UNUSED_RESULT aes_gcm_encrypt_final(struct aes_gcm_stream *st, aes_uchar *tag);
+int AES_WARN_UNUSED_RESULT aes_gcm_decrypt_final(struct aes_gcm_stream *st, const aes_uchar *tag);
 int AES_WARN_UNUSED_RESULT aes_gmac(const aes_uchar *key, size_t key_len,
                                     const aes_uchar *iv, size_t iv_len,
                                     const aes_uchar *aad, size_t aad_len, aes_uchar *tag);
@@ -2,10 +2,24 @@
  *  aes.cl
  */
 
+/* kernel variants, defaults unless set by the host with -D */
+#ifndef AES_SMALL_TABLES
 #define AES_SMALL_TABLES 0
+#endif
+#ifndef AES_SMALL_TABLES_LOCAL
 #define AES_SMALL_TABLES_LOCAL 1
+#endif
+#ifndef AES_KEY_LOCAL
 #define AES_KEY_LOCAL 1
+#endif
+#ifndef AES_USE_UCHAR_SWIZZLE
 #define AES_USE_UCHAR_SWIZZLE 1
+#endif
+
+/* blocks encrypted by each work-item, usually set by the host with -D */
+#ifndef AES_BLOCKS_PER_ITEM
+#define AES_BLOCKS_PER_ITEM 1
+#endif
 
 /* macros to access bytes of a uint */
 #if AES_USE_UCHAR_SWIZZLE
@@ -783,49 +797,70 @@ __constant uchar Td4s[256] = {
 #endif /* !(AES_SMALL_TABLES || AES_SMALL_TABLES_LOCAL) */
 
 
-__kernel void aes_rijndael_encrypt(__constant uint4 *rk_global, int Nr, __global const uint4 *pt_buf /*[16]*/, __global uint4 *ct_buf /*[16]*/)
-{
-	uint4 s, t;
-	int r;
-
+/* staging of the encryption table and round keys in local memory */
 #if AES_SMALL_TABLES_LOCAL
-    __local uint Te0_local[256];
-    
-    Te0_local[get_local_id(0)] = Te0[get_local_id(0)];
+#define AES_TE_LOCAL_SETUP() \
+    __local uint Te0_local[256]; \
+    for (size_t i = get_local_id(0); i < 256; i += get_local_size(0)) \
+        Te0_local[i] = Te0[i]
+#define AES_TE_LOCAL_PARAM , __local const uint *Te0_local
+#define AES_TE_LOCAL_ARG , Te0_local
+#define AES_TD_LOCAL_SETUP() \
+    __local uint Td0_local[256]; \
+    __local uchar Td4s_local[256]; \
+    for (size_t i = get_local_id(0); i < 256; i += get_local_size(0)) { \
+        Td0_local[i] = Td0[i]; \
+        Td4s_local[i] = Td4s[i]; \
+    }
+#else
+#define AES_TE_LOCAL_SETUP()
+#define AES_TE_LOCAL_PARAM
+#define AES_TE_LOCAL_ARG
+#define AES_TD_LOCAL_SETUP()
 #endif
 
 #if AES_KEY_LOCAL
-    __local uint4 rk_local[15];
-    __local uint4* rk = rk_local;
-    if (get_local_id(0) <= (size_t)Nr) {
-        rk_local[get_local_id(0)] = rk_global[get_local_id(0)];
-    }
+#define AES_RK_SPACE __local
+#define AES_RK_SETUP(rk, rk_global, Nr) \
+    __local uint4 rk_local[15]; \
+    __local const uint4 *rk = rk_local; \
+    for (size_t i = get_local_id(0); i <= (size_t)Nr; i += get_local_size(0)) \
+        rk_local[i] = rk_global[i]
 #else
-    __constant uint* rk = rk_global;
+#define AES_RK_SPACE __constant
+#define AES_RK_SETUP(rk, rk_global, Nr) \
+    __constant const uint4 *rk = rk_global
 #endif
 
 #if AES_SMALL_TABLES_LOCAL || AES_KEY_LOCAL
-    barrier(CLK_LOCAL_MEM_FENCE);
+#define AES_LOCAL_BARRIER() barrier(CLK_LOCAL_MEM_FENCE)
+#else
+#define AES_LOCAL_BARRIER()
 #endif
 
-    /* read block */
-    uint4 pt = pt_buf[get_global_id(0)];
-    
-	/*
-	 * map byte array block to cipher state
-	 * and add initial round key:
-	 */
-	s = (uint4)(as_uint(as_uchar4(pt.s0).s3210),
-                as_uint(as_uchar4(pt.s1).s3210),
-                as_uint(as_uchar4(pt.s2).s3210),
-                as_uint(as_uchar4(pt.s3).s3210)) ^ rk[0];
-    
+/*
+ * index of block k of this work-item: each work-group covers
+ * AES_BLOCKS_PER_ITEM * local size consecutive blocks, and for a given k
+ * neighbouring work-items access neighbouring blocks so accesses coalesce
+ */
+#define AES_BLOCK_INDEX(k) \
+    ((get_group_id(0) * AES_BLOCKS_PER_ITEM + (k)) * get_local_size(0) + get_local_id(0))
+
+/* encrypt one block held as four big endian column words */
+uint4 aes_encrypt_state(AES_RK_SPACE const uint4 *rk, int Nr, uint4 s AES_TE_LOCAL_PARAM)
+{
+	uint4 t;
+	int r;
+
+	/* add initial round key: */
+	s ^= rk[0];
+
 #define ROUND(i,X,Y) \
 X = (uint4)(TE0(Y.s0) ^ TE1(Y.s1) ^ TE2(Y.s2) ^ TE3(Y.s3), \
             TE0(Y.s1) ^ TE1(Y.s2) ^ TE2(Y.s3) ^ TE3(Y.s0), \
             TE0(Y.s2) ^ TE1(Y.s3) ^ TE2(Y.s0) ^ TE3(Y.s1), \
             TE0(Y.s3) ^ TE1(Y.s0) ^ TE2(Y.s1) ^ TE3(Y.s2)) ^ rk[i]
-    
+
 	/* Nr - 1 full rounds: */
 	r = Nr >> 1;
 	for (;;) {
@@ -835,57 +870,103 @@ X = (uint4)(TE0(Y.s0) ^ TE1(Y.s1) ^ TE2(Y.s2) ^ TE3(Y.s3), \
 			break;
 		ROUND(0,s,t);
 	}
-    
+
 #undef ROUND
-    
-	/*
-	 * apply last round and
-	 * map cipher state to byte array block:
-	 */
-	s = (uint4)(TE41(t.s0) ^ TE42(t.s1) ^ TE43(t.s2) ^ TE44(t.s3),
-                TE41(t.s1) ^ TE42(t.s2) ^ TE43(t.s3) ^ TE44(t.s0),
-                TE41(t.s2) ^ TE42(t.s3) ^ TE43(t.s0) ^ TE44(t.s1),
-                TE41(t.s3) ^ TE42(t.s0) ^ TE43(t.s1) ^ TE44(t.s2)) ^ rk[0];
-    
-    /* write block */
-    ct_buf[get_global_id(0)] = (uint4)(as_uint(as_uchar4(s.s0).s3210),
-                                       as_uint(as_uchar4(s.s1).s3210),
-                                       as_uint(as_uchar4(s.s2).s3210),
-                                       as_uint(as_uchar4(s.s3).s3210));
+
+	/* apply last round: */
+	return (uint4)(TE41(t.s0) ^ TE42(t.s1) ^ TE43(t.s2) ^ TE44(t.s3),
+	               TE41(t.s1) ^ TE42(t.s2) ^ TE43(t.s3) ^ TE44(t.s0),
+	               TE41(t.s2) ^ TE42(t.s3) ^ TE43(t.s0) ^ TE44(t.s1),
+	               TE41(t.s3) ^ TE42(t.s0) ^ TE43(t.s1) ^ TE44(t.s2)) ^ rk[0];
 }
 
-__kernel void aes_rijndael_decrypt(__constant uint *rk_global, int Nr,  __global const uchar *ct_buf /*[16]*/, __global uchar *pt_buf /*[16]*/)
+/* map between byte array blocks and big endian column words */
+uint4 aes_bswap4(uint4 v)
+{
+	return (uint4)(as_uint(as_uchar4(v.s0).s3210),
+	               as_uint(as_uchar4(v.s1).s3210),
+	               as_uint(as_uchar4(v.s2).s3210),
+	               as_uint(as_uchar4(v.s3).s3210));
+}
+
+/*
+ * counter block n of a stream starting at cb: cb + n as a 128-bit big endian
+ * integer, or with ctr32 only the last 32 bits wrap around (GCM inc32)
+ */
+uint4 aes_ctr_block(uint4 cb, ulong n, int ctr32)
+{
+	ulong lo, hi;
+
+	if (ctr32)
+		return (uint4)(cb.s0, cb.s1, cb.s2, cb.s3 + (uint)n);
+
+	lo = upsample(cb.s2, cb.s3) + n;
+	hi = upsample(cb.s0, cb.s1) + (lo < n);
+	return (uint4)((uint)(hi >> 32), (uint)hi, (uint)(lo >> 32), (uint)lo);
+}
+
+__kernel void aes_rijndael_encrypt(__constant uint4 *rk_global, int Nr, __global const uint4 *pt_buf /*[16]*/, __global uint4 *ct_buf /*[16]*/)
+{
+    AES_TE_LOCAL_SETUP();
+    AES_RK_SETUP(rk, rk_global, Nr);
+    AES_LOCAL_BARRIER();
+
+    for (int k = 0; k < AES_BLOCKS_PER_ITEM; k++) {
+        size_t i = AES_BLOCK_INDEX(k);
+        ct_buf[i] = aes_bswap4(aes_encrypt_state(rk, Nr, aes_bswap4(pt_buf[i]) AES_TE_LOCAL_ARG));
+    }
+}
+
+/*
+ * Counter mode: block i is XORed with the keystream for counter block number
+ * block_offset + i, AES_BLOCKS_PER_ITEM blocks per work-item. cb is the
+ * initial counter block as big endian words.
+ */
+__kernel void aes_rijndael_ctr(__constant uint4 *rk_global, int Nr, uint4 cb, ulong block_offset, int ctr32,
+                               __global const uint4 *in_buf, __global uint4 *out_buf)
+{
+    AES_TE_LOCAL_SETUP();
+    AES_RK_SETUP(rk, rk_global, Nr);
+    AES_LOCAL_BARRIER();
+
+    for (int k = 0; k < AES_BLOCKS_PER_ITEM; k++) {
+        size_t i = AES_BLOCK_INDEX(k);
+        uint4 ks = aes_encrypt_state(rk, Nr, aes_ctr_block(cb, block_offset + i, ctr32)
+                                     AES_TE_LOCAL_ARG);
+        out_buf[i] = in_buf[i] ^ aes_bswap4(ks);
+    }
+}
+
+/* Counter mode keystream only: AES_BLOCKS_PER_ITEM blocks of ks_buf per work-item */
+__kernel void aes_rijndael_ctr_keystream(__constant uint4 *rk_global, int Nr, uint4 cb, ulong block_offset, int ctr32,
+                                         __global uint4 *ks_buf)
+{
+    AES_TE_LOCAL_SETUP();
+    AES_RK_SETUP(rk, rk_global, Nr);
+    AES_LOCAL_BARRIER();
+
+    for (int k = 0; k < AES_BLOCKS_PER_ITEM; k++) {
+        size_t i = AES_BLOCK_INDEX(k);
+        uint4 ks = aes_encrypt_state(rk, Nr, aes_ctr_block(cb, block_offset + i, ctr32)
+                                     AES_TE_LOCAL_ARG);
+        ks_buf[i] = aes_bswap4(ks);
+    }
+}
+
+__kernel void aes_rijndael_decrypt(__constant uint4 *rk_global, int Nr,  __global const uchar *ct_buf /*[16]*/, __global uchar *pt_buf /*[16]*/)
 {
 	uint s0, s1, s2, s3, t0, t1, t2, t3;
 	int r;
-    
-#if AES_SMALL_TABLES_LOCAL
-    __local uint Td0_local[256];
-    __local uchar Td4s_local[256];
-    
-    Td0_local[get_local_id(0)] = Td0[get_local_id(0)];
-    Td4s_local[get_local_id(0)] = Td4s_local[get_local_id(0)];
-    barrier(CLK_LOCAL_MEM_FENCE);
-#endif
 
-#if AES_KEY_LOCAL
-    __local uint rk_local[60];
-    __local uint* rk = rk_local;
-    size_t rk_num = (Nr + 1) << 2;
-    if (get_local_id(0) < rk_num) {
-        rk_local[get_local_id(0)] = rk_global[get_local_id(0)];
-    }
-#else
-    __constant uint* rk = rk_global;
-#endif
+    AES_TD_LOCAL_SETUP();
+    AES_RK_SETUP(rk_key, rk_global, Nr);
+    AES_LOCAL_BARRIER();
 
-#if AES_SMALL_TABLES_LOCAL || AES_KEY_LOCAL
-    barrier(CLK_LOCAL_MEM_FENCE);
-#endif
+    for (int k = 0; k < AES_BLOCKS_PER_ITEM; k++) {
+        AES_RK_SPACE const uint *rk = (AES_RK_SPACE const uint *)rk_key;
+        __global const uchar *ct = ct_buf + AES_BLOCK_INDEX(k) * 16;
+        __global uchar *pt = pt_buf + AES_BLOCK_INDEX(k) * 16;
 
-    __global const uchar *ct = ct_buf + get_global_id(0) * 16;
-    __global uchar *pt = pt_buf + get_global_id(0) * 16;
-    
 	/*
 	 * map byte array block to cipher state
 	 * and add initial round key:
@@ -921,5 +1002,6 @@ d##3 = TD0(s##3) ^ TD1(s##2) ^ TD2(s##1) ^ TD3(s##0) ^ rk[4 * i + 3]
 	*(__global uint*)(pt +  4) = as_uint(as_uchar4(TD41(t1) ^ TD42(t0) ^ TD43(t3) ^ TD44(t2) ^ rk[1]).wzyx);
 	*(__global uint*)(pt +  8) = as_uint(as_uchar4(TD41(t2) ^ TD42(t1) ^ TD43(t0) ^ TD44(t3) ^ rk[2]).wzyx);
 	*(__global uint*)(pt + 12) = as_uint(as_uchar4(TD41(t3) ^ TD42(t2) ^ TD43(t1) ^ TD44(t0) ^ rk[3]).wzyx);
+    }
 }
 
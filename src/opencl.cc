@@ -7,9 +7,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#endif
 
 #include <algorithm>
+#include <chrono>
+#include <functional>
 #include <iomanip>
 #include <sstream>
 #include <memory>
@@ -17,6 +24,8 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <thread>
+#include <mutex>
 
 #include "logging.h"
 #include "opencl.h"
@@ -93,6 +102,7 @@ opencl_device::opencl_device(opencl_platform_ptr platform, cl_device_id deviceId
     opencl::getDeviceInfoUint(deviceId, CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE, globalMemCacheLineSize);
     opencl::getDeviceInfoUlong(deviceId, CL_DEVICE_GLOBAL_MEM_SIZE, globalMemSize);
     opencl::getDeviceInfoBool(deviceId, CL_DEVICE_IMAGE_SUPPORT, imageSupport);
+    opencl::getDeviceInfoBool(deviceId, CL_DEVICE_HOST_UNIFIED_MEMORY, hostUnifiedMemory);
     opencl::getDeviceInfoSize(deviceId, CL_DEVICE_IMAGE2D_MAX_WIDTH, image2DmaxWidth);
     opencl::getDeviceInfoSize(deviceId, CL_DEVICE_IMAGE2D_MAX_HEIGHT, image2DmaxHeight);
     opencl::getDeviceInfoSize(deviceId, CL_DEVICE_IMAGE3D_MAX_WIDTH, image3DmaxWidth);
@@ -217,6 +227,7 @@ void opencl_device::print()
     log_debug("device[%u].globamMemCacheLineSize   = %u", deviceIndex, globalMemCacheLineSize);
     log_debug("device[%u].globalMemSize            = %lu", deviceIndex, globalMemSize);
     log_debug("device[%u].imageSupport             = %s", deviceIndex, imageSupport ? "TRUE" : "FALSE");
+    log_debug("device[%u].hostUnifiedMemory        = %s", deviceIndex, hostUnifiedMemory ? "TRUE" : "FALSE");
     log_debug("device[%u].image2DmaxWidth          = %u", deviceIndex, (uint)image2DmaxWidth);
     log_debug("device[%u].image2DmaxHeight         = %u", deviceIndex, (uint)image2DmaxHeight);
     log_debug("device[%u].image3DmaxWidth          = %u", deviceIndex, (uint)image3DmaxWidth);
@@ -345,6 +356,30 @@ opencl_program_ptr opencl_context::createProgram(std::string src, std::string op
     }
 }
 
+void opencl_context::setBinaryCacheDir(std::string dir)
+{
+    if (dir.size() > 0 && mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        log_error("%s:%s failed to create %s: %s", class_name, __func__, dir.c_str(), strerror(errno));
+        return;
+    }
+    binaryCacheDir = dir;
+}
+
+opencl_host_buffer_ptr opencl_context::createHostBuffer(opencl_command_queue_ptr queue, cl_mem_flags flags, size_t size, void *host_ptr)
+{
+    return opencl_host_buffer_ptr(new opencl_host_buffer(this, queue, flags, size, host_ptr));
+}
+
+opencl_splitter_ptr opencl_context::createSplitter(size_t grain, size_t cpu_threads)
+{
+    return opencl_splitter_ptr(new opencl_splitter(grain, cpu_threads));
+}
+
+opencl_pipeline_ptr opencl_context::createPipeline(opencl_device_ptr device, size_t chunk_size, size_t num_sets)
+{
+    return opencl_pipeline_ptr(new opencl_pipeline(this, device, chunk_size, num_sets));
+}
+
 opencl_command_queue_ptr opencl_context::createCommandQueue(opencl_device_ptr device, cl_command_queue_properties properties)
 {
     opencl_command_queue_ptr cmdqueue(new opencl_command_queue(this, device, properties));
@@ -400,52 +435,71 @@ opencl_program::opencl_program(opencl_context *context, std::string src, std::st
         src_offset += len;
     }
     
-    const char* src_strings[] = { (const char*)src_buf };
-    const size_t src_lengths[] = { (size_t)src_size };
-    
- 	cl_int ret;
-    clProgram = clCreateProgramWithSource(context->clContext, 1, src_strings, src_lengths, &ret);
-    if (ret != CL_SUCCESS) {
-        log_error("%s:%s clCreateProgramWithSource failed: ret=%d", class_name, __func__, ret);
-        delete [] src_buf;
-        return;
-    } else {
-        log_debug("%s:%s created program: %s", class_name, __func__, src.c_str());
+    fclose(src_file);
+
+    // binary cache entries, one per device
+    std::vector<std::string> cache_paths;
+    if (context->binaryCacheDir.size() > 0) {
+        for (opencl_device_ptr device : context->devices) {
+            cache_paths.push_back(binaryCachePath(device, src_buf, src_size));
+        }
     }
-    delete [] src_buf;
 
     cl_device_id *devices_arr = new cl_device_id[context->devices.size()];
     for (size_t i = 0; i < context->devices.size(); i++) {
         devices_arr[i] = context->devices[i]->deviceId;
     }
 
-    ret = clBuildProgram(clProgram, (cl_uint)context->devices.size(), devices_arr, options.c_str(), NULL, NULL);
-    if (ret != CL_SUCCESS) {
-        log_error("%s:%s clBuildProgram failed: ret=%d", class_name, __func__, ret);
+ 	cl_int ret;
+    if (cache_paths.size() > 0 && createFromBinaryCache(cache_paths, devices_arr)) {
+        log_debug("%s:%s loaded program from binary cache: %s", class_name, __func__, src.c_str());
+        delete [] src_buf;
     } else {
-        log_debug("%s:%s built program: %s", class_name, __func__, src.c_str());
-    }
+        const char* src_strings[] = { (const char*)src_buf };
+        const size_t src_lengths[] = { (size_t)src_size };
 
-    delete [] devices_arr;
-
-    for (size_t i = 0; i < context->devices.size(); i++) {
-        size_t build_log_size;
-        ret = clGetProgramBuildInfo(clProgram, context->devices[i]->deviceId, CL_PROGRAM_BUILD_LOG, 0, NULL, &build_log_size);
+        clProgram = clCreateProgramWithSource(context->clContext, 1, src_strings, src_lengths, &ret);
         if (ret != CL_SUCCESS) {
-            log_error("%s:%s clGetProgramBuildInfo failed: ret=%d", class_name, __func__, ret);
-            continue;
+            log_error("%s:%s clCreateProgramWithSource failed: ret=%d", class_name, __func__, ret);
+            delete [] src_buf;
+            delete [] devices_arr;
+            return;
+        } else {
+            log_debug("%s:%s created program: %s", class_name, __func__, src.c_str());
         }
-        char *build_log = new char[build_log_size + 1];
-        build_log[build_log_size] = '\0';
-        ret = clGetProgramBuildInfo(clProgram, context->devices[i]->deviceId, CL_PROGRAM_BUILD_LOG, build_log_size, build_log, NULL);
+        delete [] src_buf;
+
+        ret = clBuildProgram(clProgram, (cl_uint)context->devices.size(), devices_arr, options.c_str(), NULL, NULL);
         if (ret != CL_SUCCESS) {
-            log_error("%s:%s clGetProgramBuildInfo failed: ret=%d", class_name, __func__, ret);
+            log_error("%s:%s clBuildProgram failed: ret=%d", class_name, __func__, ret);
         } else {
-            log_debug("%s:%s device[%u] program build log = [%s]", class_name, __func__, context->devices[i]->deviceIndex, build_log);
+            log_debug("%s:%s built program: %s", class_name, __func__, src.c_str());
+            if (cache_paths.size() > 0) {
+                saveBinaryCache(cache_paths);
+            }
+        }
+
+        for (size_t i = 0; i < context->devices.size(); i++) {
+            size_t build_log_size;
+            ret = clGetProgramBuildInfo(clProgram, context->devices[i]->deviceId, CL_PROGRAM_BUILD_LOG, 0, NULL, &build_log_size);
+            if (ret != CL_SUCCESS) {
+                log_error("%s:%s clGetProgramBuildInfo failed: ret=%d", class_name, __func__, ret);
+                continue;
+            }
+            char *build_log = new char[build_log_size + 1];
+            build_log[build_log_size] = '\0';
+            ret = clGetProgramBuildInfo(clProgram, context->devices[i]->deviceId, CL_PROGRAM_BUILD_LOG, build_log_size, build_log, NULL);
+            if (ret != CL_SUCCESS) {
+                log_error("%s:%s clGetProgramBuildInfo failed: ret=%d", class_name, __func__, ret);
+            } else {
+                log_debug("%s:%s device[%u] program build log = [%s]", class_name, __func__, context->devices[i]->deviceIndex, build_log);
+            }
+            delete [] build_log;
         }
-        delete [] build_log;
     }
-    
+
+    delete [] devices_arr;
+
     cl_uint  num_kernels;
     ret = clCreateKernelsInProgram(clProgram, 0, NULL, &num_kernels);
     if (ret != CL_SUCCESS) {
@@ -482,6 +536,104 @@ opencl_program::opencl_program(opencl_context *context, std::string src, std::st
     delete [] kernel_arr;
 }
 
+std::string opencl_program::binaryCachePath(opencl_device_ptr device, const char *src_buf, size_t src_size)
+{
+    // 64-bit FNV-1a over everything the binary depends on
+    std::string parts[] = { options, device->getName(), device->getDriverVersion(), device->platform->getVersion() };
+    cl_ulong hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < src_size; i++) {
+        hash = (hash ^ (unsigned char)src_buf[i]) * 1099511628211ULL;
+    }
+    for (const std::string &part : parts) {
+        for (size_t i = 0; i <= part.size(); i++) {
+            hash = (hash ^ (unsigned char)part.c_str()[i]) * 1099511628211ULL;
+        }
+    }
+    std::stringstream ss;
+    ss << context->binaryCacheDir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".bin";
+    return ss.str();
+}
+
+bool opencl_program::createFromBinaryCache(const std::vector<std::string> &cache_paths, cl_device_id *devices_arr)
+{
+    size_t num_devices = cache_paths.size();
+    std::vector<std::string> binaries(num_devices);
+    std::vector<size_t> binary_lengths(num_devices);
+    std::vector<const unsigned char*> binary_ptrs(num_devices);
+    std::vector<cl_int> binary_status(num_devices);
+    
+    for (size_t i = 0; i < num_devices; i++) {
+        FILE *bin_file = fopen(cache_paths[i].c_str(), "rb");
+        if (!bin_file) return false;
+        char buf[65536];
+        size_t len;
+        while ((len = fread(buf, 1, sizeof(buf), bin_file)) > 0) {
+            binaries[i].append(buf, len);
+        }
+        fclose(bin_file);
+        if (binaries[i].size() == 0) return false;
+        binary_lengths[i] = binaries[i].size();
+        binary_ptrs[i] = (const unsigned char*)binaries[i].data();
+    }
+
+    cl_int ret;
+    clProgram = clCreateProgramWithBinary(context->clContext, (cl_uint)num_devices, devices_arr, &binary_lengths[0],
+                                          &binary_ptrs[0], &binary_status[0], &ret);
+    if (ret != CL_SUCCESS) {
+        log_debug("%s:%s clCreateProgramWithBinary failed: ret=%d, building from source", class_name, __func__, ret);
+        return false;
+    }
+    ret = clBuildProgram(clProgram, (cl_uint)num_devices, devices_arr, options.c_str(), NULL, NULL);
+    if (ret != CL_SUCCESS) {
+        log_debug("%s:%s clBuildProgram failed: ret=%d, building from source", class_name, __func__, ret);
+        clReleaseProgram(clProgram);
+        return false;
+    }
+    return true;
+}
+
+void opencl_program::saveBinaryCache(const std::vector<std::string> &cache_paths)
+{
+    size_t num_devices = cache_paths.size();
+    std::vector<size_t> binary_sizes(num_devices);
+    
+    cl_int ret = clGetProgramInfo(clProgram, CL_PROGRAM_BINARY_SIZES, num_devices * sizeof(size_t), &binary_sizes[0], NULL);
+    if (ret != CL_SUCCESS) {
+        log_error("%s:%s clGetProgramInfo failed: ret=%d", class_name, __func__, ret);
+        return;
+    }
+    std::vector<std::vector<unsigned char>> binaries(num_devices);
+    std::vector<unsigned char*> binary_ptrs(num_devices);
+    for (size_t i = 0; i < num_devices; i++) {
+        if (binary_sizes[i] == 0) return;
+        binaries[i].resize(binary_sizes[i]);
+        binary_ptrs[i] = &binaries[i][0];
+    }
+    ret = clGetProgramInfo(clProgram, CL_PROGRAM_BINARIES, num_devices * sizeof(unsigned char*), &binary_ptrs[0], NULL);
+    if (ret != CL_SUCCESS) {
+        log_error("%s:%s clGetProgramInfo failed: ret=%d", class_name, __func__, ret);
+        return;
+    }
+
+    // write then rename so that concurrent processes never load a partial binary
+    for (size_t i = 0; i < num_devices; i++) {
+        std::string tmp_path = cache_paths[i] + ".tmp";
+        FILE *bin_file = fopen(tmp_path.c_str(), "wb");
+        if (!bin_file) {
+            log_error("%s:%s failed to open %s: %s", class_name, __func__, tmp_path.c_str(), strerror(errno));
+            return;
+        }
+        bool ok = fwrite(binary_ptrs[i], 1, binary_sizes[i], bin_file) == binary_sizes[i];
+        ok = (fclose(bin_file) == 0) && ok;
+        if (!ok || rename(tmp_path.c_str(), cache_paths[i].c_str()) != 0) {
+            log_error("%s:%s failed to write %s: %s", class_name, __func__, cache_paths[i].c_str(), strerror(errno));
+            remove(tmp_path.c_str());
+            return;
+        }
+        log_debug("%s:%s saved program binary: %s", class_name, __func__, cache_paths[i].c_str());
+    }
+}
+
 opencl_program::~opencl_program()
 {
     log_debug("%s:%s released program: %s", class_name, __func__, src.c_str());
@@ -498,6 +650,19 @@ opencl_kernel_ptr opencl_program::getKernel(std::string name)
     }
 }
 
+// a kernel object separate from the one returned by getKernel, e.g. to set
+// arguments and enqueue from another thread
+opencl_kernel_ptr opencl_program::createKernel(std::string name)
+{
+    cl_int ret;
+    cl_kernel clKernel = clCreateKernel(clProgram, name.c_str(), &ret);
+    if (ret != CL_SUCCESS) {
+        log_error("%s:%s clCreateKernel failed: ret=%d", class_name, __func__, ret);
+        return opencl_kernel_ptr();
+    }
+    return opencl_kernel_ptr(new opencl_kernel(this, clKernel, name));
+}
+
 
 /* opencl_kernel */
 
@@ -566,6 +731,16 @@ void opencl_kernel::setArg(cl_uint arg_index, opencl_buffer_ptr &buffer)
     }
 }
 
+size_t opencl_kernel::getWorkGroupSize(opencl_device_ptr device)
+{
+    size_t workGroupSize = 0;
+    cl_int ret = clGetKernelWorkGroupInfo(clKernel, device->deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &workGroupSize, NULL);
+    if (ret != CL_SUCCESS) {
+        log_error("%s:%s clGetKernelWorkGroupInfo failed: ret=%d", class_name, __func__, ret);
+    }
+    return workGroupSize;
+}
+
 
 /* opencl_buffer */
 
@@ -840,6 +1015,71 @@ opencl_event_ptr opencl_command_queue::enqueueWriteBuffer(opencl_buffer_ptr &buf
     }
 }
 
+opencl_event_ptr opencl_command_queue::enqueueMapBuffer(opencl_buffer_ptr &buffer, cl_bool blocking_map, cl_map_flags map_flags, size_t offset, size_t cb,
+                                                        void* &ptr, opencl_event_list eventWait_list)
+{
+    cl_event evt;
+    cl_event *wait_list = NULL;
+
+    if (eventWait_list.size()) {
+        wait_list = new cl_event[eventWait_list.size()];
+        for (size_t i = 0; i < eventWait_list.size(); i++) {
+            wait_list[i] = eventWait_list.at(i)->evt;
+        }
+    }
+
+    cl_int ret;
+    ptr = clEnqueueMapBuffer(clCommandQueue, buffer->clBuffer, blocking_map, map_flags, offset, cb, (cl_uint)eventWait_list.size(), wait_list, &evt, &ret);
+
+    if (wait_list) {
+        delete [] wait_list;
+    }
+
+    if (ret != CL_SUCCESS) {
+        log_error("%s:%s clEnqueueMapBuffer failed: ret=%d", class_name, __func__, ret);
+        ptr = NULL;
+        return opencl_event_ptr();
+    } else {
+        opencl_event *event = new opencl_event(evt);
+        if (printProfilingInfo) {
+            event->wait();
+            log_debug("%-83s : %s", __func__, event->getProfilingInfo().toString().c_str());
+        }
+        return opencl_event_ptr(event);
+    }
+}
+
+opencl_event_ptr opencl_command_queue::enqueueUnmapBuffer(opencl_buffer_ptr &buffer, void *ptr, opencl_event_list eventWait_list)
+{
+    cl_event evt;
+    cl_event *wait_list = NULL;
+
+    if (eventWait_list.size()) {
+        wait_list = new cl_event[eventWait_list.size()];
+        for (size_t i = 0; i < eventWait_list.size(); i++) {
+            wait_list[i] = eventWait_list.at(i)->evt;
+        }
+    }
+
+    cl_int ret = clEnqueueUnmapMemObject(clCommandQueue, buffer->clBuffer, ptr, (cl_uint)eventWait_list.size(), wait_list, &evt);
+
+    if (wait_list) {
+        delete [] wait_list;
+    }
+
+    if (ret != CL_SUCCESS) {
+        log_error("%s:%s clEnqueueUnmapMemObject failed: ret=%d", class_name, __func__, ret);
+        return opencl_event_ptr();
+    } else {
+        opencl_event *event = new opencl_event(evt);
+        if (printProfilingInfo) {
+            event->wait();
+            log_debug("%-83s : %s", __func__, event->getProfilingInfo().toString().c_str());
+        }
+        return opencl_event_ptr(event);
+    }
+}
+
 opencl_event_ptr opencl_command_queue::enqueueAcquireGLObjects(opencl_buffer_list buffer_list, opencl_event_list eventWait_list)
 {
     cl_event evt;
@@ -1236,3 +1476,235 @@ opencl_context_ptr opencl::createContext(opencl_device_list device_list, bool re
     contexts.push_back(context);
     return context;
 }
+
+
+/* opencl_host_buffer */
+
+opencl_host_buffer::opencl_host_buffer(opencl_context *context, opencl_command_queue_ptr queue, cl_mem_flags flags, size_t size, void *host_ptr)
+    : queue(queue), size(size), host_ptr(NULL)
+{
+    flags |= host_ptr ? CL_MEM_USE_HOST_PTR : CL_MEM_ALLOC_HOST_PTR;
+    buffer = context->createBuffer(flags, size, host_ptr);
+    map();
+}
+
+opencl_host_buffer::~opencl_host_buffer()
+{
+    if (host_ptr) {
+        opencl_event_ptr event = unmap();
+        if (event) event->wait();
+    }
+}
+
+void* opencl_host_buffer::map(cl_map_flags map_flags, opencl_event_list eventWait_list)
+{
+    if (!host_ptr) {
+        queue->enqueueMapBuffer(buffer, true, map_flags, 0, size, host_ptr, eventWait_list);
+    }
+    return host_ptr;
+}
+
+opencl_event_ptr opencl_host_buffer::unmap(opencl_event_list eventWait_list)
+{
+    if (!host_ptr) {
+        return opencl_event_ptr();
+    }
+    opencl_event_ptr event = queue->enqueueUnmapBuffer(buffer, host_ptr, eventWait_list);
+    host_ptr = NULL;
+    return event;
+}
+
+
+/* opencl_pipeline */
+
+opencl_pipeline::opencl_pipeline(opencl_context *context, opencl_device_ptr device, size_t chunk_size, size_t num_sets)
+    : context(context), chunk_size(chunk_size), sets(num_sets)
+{
+    write_queue = context->createCommandQueue(device, 0);
+    kernel_queue = context->createCommandQueue(device, 0);
+    read_queue = context->createCommandQueue(device, 0);
+    for (buffer_set &set : sets) {
+        set.in = context->createBuffer(CL_MEM_READ_ONLY, chunk_size, NULL);
+        set.out = context->createBuffer(CL_MEM_WRITE_ONLY, chunk_size, NULL);
+    }
+}
+
+opencl_pipeline::~opencl_pipeline()
+{
+    finish();
+}
+
+void opencl_pipeline::finish()
+{
+    write_queue->finish();
+    kernel_queue->finish();
+    read_queue->finish();
+    for (buffer_set &set : sets) {
+        set.kernel_done = opencl_event_ptr();
+        set.read_done = opencl_event_ptr();
+    }
+}
+
+bool opencl_pipeline::run(opencl_kernel_ptr &kernel, const void *in, void *out, size_t size,
+                          size_t item_size, size_t local_size, set_args_fn set_args)
+{
+    if (chunk_size % (item_size * local_size) != 0) {
+        log_error("%s:%s chunk size %lu is not a multiple of %lu", class_name, __func__,
+                  (unsigned long)chunk_size, (unsigned long)(item_size * local_size));
+        return false;
+    }
+
+    for (size_t offset = 0, i = 0; offset < size; offset += chunk_size, i++) {
+        buffer_set &set = sets[i % sets.size()];
+        size_t len = std::min(chunk_size, size - offset);
+        size_t items = (len + item_size - 1) / item_size;
+        size_t global = (items + local_size - 1) / local_size * local_size;
+
+        // the input buffer is free once the last kernel reading it completed
+        opencl_event_list write_wait;
+        if (set.kernel_done) write_wait.push_back(set.kernel_done);
+        opencl_event_ptr write_done = write_queue->enqueueWriteBuffer(set.in, false, 0, len, (const char*)in + offset, write_wait);
+        if (!write_done) {
+            finish();
+            return false;
+        }
+
+        // the output buffer is free once the last read from it completed
+        opencl_event_list kernel_wait(write_done);
+        if (set.read_done) kernel_wait.push_back(set.read_done);
+        set_args(kernel, set.in, set.out, offset);
+        set.kernel_done = kernel_queue->enqueueNDRangeKernel(kernel, opencl_dim(global), opencl_dim(local_size), kernel_wait);
+        if (!set.kernel_done) {
+            finish();
+            return false;
+        }
+
+        set.read_done = read_queue->enqueueReadBuffer(set.out, false, 0, len, (char*)out + offset, opencl_event_list(set.kernel_done));
+        if (!set.read_done) {
+            finish();
+            return false;
+        }
+    }
+
+    finish();
+    return true;
+}
+
+
+/* opencl_splitter */
+
+opencl_splitter::opencl_splitter(size_t grain, size_t cpu_threads) : grain(grain), cpu_threads(cpu_threads)
+{
+}
+
+opencl_splitter::~opencl_splitter()
+{
+}
+
+void opencl_splitter::addDevice(opencl_device_ptr device, opencl_pipeline_ptr pipeline, opencl_kernel_ptr kernel,
+                                size_t item_size, size_t local_size, opencl_pipeline::set_args_fn set_args)
+{
+    device_worker worker = { device->getName(), pipeline, kernel, item_size, local_size, set_args };
+    devices.push_back(worker);
+}
+
+bool opencl_splitter::run(const void *in, void *out, size_t size, cpu_fn cpu)
+{
+    const size_t num_workers = cpu_threads + devices.size();
+    if (num_workers == 0 || grain == 0) {
+        log_error("%s:%s no workers", class_name, __func__);
+        return false;
+    }
+
+    std::mutex mutex;
+    size_t next = 0;
+    bool failed = false;
+    std::vector<double> rate(num_workers, 0);
+
+    stats.assign(num_workers, worker_stats());
+    for (size_t w = 0; w < num_workers; w++) {
+        std::stringstream ss;
+        if (w < cpu_threads) {
+            ss << "cpu" << w;
+        } else {
+            ss << devices[w - cpu_threads].name;
+        }
+        stats[w].name = ss.str();
+        stats[w].chunks = stats[w].bytes = 0;
+        stats[w].seconds = 0;
+    }
+
+    // claim the next chunk: at least min_claim, otherwise half of the worker's
+    // throughput share of what remains. Workers that have not finished a chunk
+    // yet are counted at the mean measured rate.
+    auto claim = [&](size_t w, size_t min_claim, size_t &offset, size_t &len) -> bool {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (failed || next >= size) return false;
+        size_t remaining = size - next;
+        double measured = 0;
+        size_t num_measured = 0;
+        for (double r : rate) {
+            if (r > 0) {
+                measured += r;
+                num_measured++;
+            }
+        }
+        size_t want = min_claim;
+        if (rate[w] > 0) {
+            double total = measured + (num_workers - num_measured) * (measured / num_measured);
+            want = std::max(want, (size_t)(remaining * (rate[w] / total) / 2));
+        }
+        want = (want + grain - 1) / grain * grain;
+        offset = next;
+        len = std::min(want, remaining);
+        next += len;
+        return true;
+    };
+
+    auto work = [&](size_t w) {
+        device_worker *device = w < cpu_threads ? NULL : &devices[w - cpu_threads];
+        size_t min_claim = device ? device->pipeline->getChunkSize() * device->pipeline->getNumSets() : grain;
+        size_t offset, len;
+        while (claim(w, min_claim, offset, len)) {
+            const auto t1 = std::chrono::steady_clock::now();
+            bool done = false;
+            if (device) {
+                size_t base = offset;
+                done = device->pipeline->run(device->kernel, (const char*)in + offset, (char*)out + offset, len,
+                                             device->item_size, device->local_size,
+                    [device, base](opencl_kernel_ptr &kernel, opencl_buffer_ptr &in_buf, opencl_buffer_ptr &out_buf, size_t chunk_offset) {
+                        device->set_args(kernel, in_buf, out_buf, base + chunk_offset);
+                    });
+                if (!done) {
+                    log_error("%s:%s %s failed, continuing on the CPU", class_name, __func__, device->name.c_str());
+                    device = NULL;
+                    min_claim = grain;
+                }
+            }
+            if (!done && !cpu((const char*)in + offset, (char*)out + offset, offset, len)) {
+                log_error("%s:%s %s failed on the CPU", class_name, __func__, stats[w].name.c_str());
+                std::lock_guard<std::mutex> guard(mutex);
+                failed = true;
+                return;
+            }
+            const auto t2 = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> guard(mutex);
+            worker_stats &ws = stats[w];
+            ws.chunks++;
+            ws.bytes += len;
+            ws.seconds += std::chrono::duration<double>(t2 - t1).count();
+            rate[w] = ws.seconds > 0 ? ws.bytes / ws.seconds : 0;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t w = 1; w < num_workers; w++) {
+        threads.push_back(std::thread(work, w));
+    }
+    work(0);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    return !failed;
+}
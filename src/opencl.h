@@ -41,6 +41,12 @@ typedef std::shared_ptr<opencl_event> opencl_event_ptr;
 class opencl_command_queue;
 typedef std::shared_ptr<opencl_command_queue> opencl_command_queue_ptr;
 typedef std::vector<opencl_command_queue_ptr> opencl_command_queue_list;
+class opencl_pipeline;
+typedef std::shared_ptr<opencl_pipeline> opencl_pipeline_ptr;
+class opencl_host_buffer;
+typedef std::shared_ptr<opencl_host_buffer> opencl_host_buffer_ptr;
+class opencl_splitter;
+typedef std::shared_ptr<opencl_splitter> opencl_splitter_ptr;
 
 
 /* opencl_platform */
@@ -90,6 +96,7 @@ protected:
     friend class opencl_platform;
     friend class opencl_context;
     friend class opencl_program;
+    friend class opencl_kernel;
     friend class opencl_command_queue;
     
     std::set<std::string> extension_set;
@@ -114,6 +121,7 @@ protected:
     cl_uint globalMemCacheLineSize;
     cl_ulong globalMemSize;
     cl_bool imageSupport;
+    cl_bool hostUnifiedMemory;
     size_t image2DmaxWidth;
     size_t image2DmaxHeight;
     size_t image3DmaxWidth;
@@ -177,6 +185,7 @@ public:
     cl_uint getGlobalMemCacheLineSize() { return globalMemCacheLineSize; }
     cl_ulong getGlobalMemSize() { return globalMemSize; }
     cl_bool hasImageSupport() { return imageSupport; }
+    cl_bool hasHostUnifiedMemory() { return hostUnifiedMemory; }
     size_t getImage2DmaxWidth() { return image2DmaxWidth; }
     size_t getImage2DmaxHeight() { return image2DmaxHeight; }
     size_t getImage3DmaxWidth() { return image3DmaxWidth; }
@@ -225,6 +234,7 @@ protected:
     bool glSharing;
     opencl_command_queue_list cmdqueues;
     std::map<std::string,opencl_program_ptr> programCache;
+    std::string binaryCacheDir;
     
 #ifdef _WIN32
     static void WINAPI notify(const char *errinfo, const void *private_info, size_t cb, void *user_data);
@@ -240,10 +250,14 @@ public:
     bool glSharingIsEnabled() { return glSharing; }
     cl_context getContext() { return clContext; }
     opencl_device_list& getDevices() { return devices; }
+    void setBinaryCacheDir(std::string dir);
     opencl_program_ptr createProgram(std::string src, std::string options = "");
     opencl_command_queue_ptr createCommandQueue(opencl_device_ptr device, cl_command_queue_properties properties = 0);
     opencl_buffer_ptr createBuffer(cl_mem_flags flags, size_t size, void *host_ptr);
     opencl_buffer_ptr createBufferFromGLBuffer(cl_mem_flags flags, cl_uint glbuffer);
+    opencl_pipeline_ptr createPipeline(opencl_device_ptr device, size_t chunk_size, size_t num_sets = 2);
+    opencl_host_buffer_ptr createHostBuffer(opencl_command_queue_ptr queue, cl_mem_flags flags, size_t size, void *host_ptr = NULL);
+    opencl_splitter_ptr createSplitter(size_t grain, size_t cpu_threads);
 };
 
 
@@ -262,10 +276,15 @@ protected:
 
     opencl_program(opencl_context *context, std::string src, std::string options);
 
+    std::string binaryCachePath(opencl_device_ptr device, const char *src_buf, size_t src_size);
+    bool createFromBinaryCache(const std::vector<std::string> &cache_paths, cl_device_id *devices_arr);
+    void saveBinaryCache(const std::vector<std::string> &cache_paths);
+
 public:
     virtual ~opencl_program();
 
     opencl_kernel_ptr getKernel(std::string name);
+    opencl_kernel_ptr createKernel(std::string name);
 };
 
 
@@ -293,6 +312,7 @@ public:
     void setArg(cl_uint arg_index, cl_float floatval);
     void setArg(cl_uint arg_index, cl_double doubleval);
     void setArg(cl_uint arg_index, opencl_buffer_ptr &buffer);
+    size_t getWorkGroupSize(opencl_device_ptr device);
 };
 
 
@@ -463,11 +483,155 @@ public:
         opencl_event_list eventWait_list = opencl_event_list());
     opencl_event_ptr enqueueWriteBuffer(opencl_buffer_ptr &buffer, cl_bool blocking_write, size_t offset, size_t cb, const void *ptr,
         opencl_event_list eventWait_list = opencl_event_list());
+    opencl_event_ptr enqueueMapBuffer(opencl_buffer_ptr &buffer, cl_bool blocking_map, cl_map_flags map_flags, size_t offset, size_t cb,
+        void* &ptr, opencl_event_list eventWait_list = opencl_event_list());
+    opencl_event_ptr enqueueUnmapBuffer(opencl_buffer_ptr &buffer, void *ptr, opencl_event_list eventWait_list = opencl_event_list());
     opencl_event_ptr enqueueAcquireGLObjects(opencl_buffer_list buffer_list, opencl_event_list eventWait_list = opencl_event_list());
     opencl_event_ptr enqueueReleaseGLObjects(opencl_buffer_list buffer_list, opencl_event_list eventWait_list = opencl_event_list());
 };
 
 
+/* opencl_host_buffer */
+
+/*
+ * Host accessible memory for a buffer: allocated by the driver with
+ * CL_MEM_ALLOC_HOST_PTR, usually pinned, or caller memory used in place with
+ * CL_MEM_USE_HOST_PTR. The buffer starts out mapped so the caller can fill it
+ * through getHostPtr(); unmap it before kernels use it and map it again to
+ * read the results. On devices with host unified memory (integrated GPUs,
+ * CPU devices) map and unmap do not copy, and on discrete GPUs the mapped
+ * pointer is a pinned source or destination for enqueueWrite/ReadBuffer.
+ */
+class opencl_host_buffer
+{
+protected:
+    friend class opencl_context;
+
+    opencl_buffer_ptr buffer;
+    opencl_command_queue_ptr queue;
+    size_t size;
+    void *host_ptr;
+
+    opencl_host_buffer(opencl_context *context, opencl_command_queue_ptr queue, cl_mem_flags flags, size_t size, void *host_ptr);
+
+public:
+    virtual ~opencl_host_buffer();
+
+    opencl_buffer_ptr& getBuffer() { return buffer; }
+    size_t getSize() { return size; }
+    void* getHostPtr() { return host_ptr; }
+    bool isMapped() { return host_ptr != NULL; }
+    void* map(cl_map_flags map_flags = CL_MAP_READ | CL_MAP_WRITE, opencl_event_list eventWait_list = opencl_event_list());
+    opencl_event_ptr unmap(opencl_event_list eventWait_list = opencl_event_list());
+};
+
+
+/* opencl_pipeline */
+
+/*
+ * Streams host memory through a kernel in chunks. Each chunk is written,
+ * processed and read back on separate write, kernel and read queues, with
+ * num_sets input/output buffer pairs in flight chained by events, so that
+ * transfers in both directions overlap with kernel execution.
+ */
+class opencl_pipeline
+{
+public:
+    // set the kernel arguments for the chunk at byte offset in the stream
+    typedef std::function<void(opencl_kernel_ptr &kernel, opencl_buffer_ptr &in, opencl_buffer_ptr &out, size_t offset)> set_args_fn;
+
+protected:
+    friend class opencl_context;
+
+    struct buffer_set
+    {
+        opencl_buffer_ptr in;
+        opencl_buffer_ptr out;
+        opencl_event_ptr kernel_done;
+        opencl_event_ptr read_done;
+    };
+
+    opencl_context *context;
+    opencl_command_queue_ptr write_queue;
+    opencl_command_queue_ptr kernel_queue;
+    opencl_command_queue_ptr read_queue;
+    size_t chunk_size;
+    std::vector<buffer_set> sets;
+
+    opencl_pipeline(opencl_context *context, opencl_device_ptr device, size_t chunk_size, size_t num_sets);
+
+    void finish();
+
+public:
+    virtual ~opencl_pipeline();
+
+    size_t getChunkSize() { return chunk_size; }
+    size_t getNumSets() { return sets.size(); }
+    bool run(opencl_kernel_ptr &kernel, const void *in, void *out, size_t size,
+             size_t item_size, size_t local_size, set_args_fn set_args);
+};
+
+
+/* opencl_splitter */
+
+/*
+ * Splits a buffer between CPU threads and OpenCL devices. Workers claim
+ * chunks from a shared offset, each claim sized by the worker's share of the
+ * throughput measured so far (guided self-scheduling): faster workers take
+ * larger chunks and claims shrink towards the end of the buffer so that all
+ * workers finish together. Each device is driven by its own host thread
+ * through a pipeline and needs its own kernel object, as setting kernel
+ * arguments is not thread safe. Chunks a device fails on are done on the CPU;
+ * if the CPU function fails the remaining chunks are abandoned and run()
+ * returns false.
+ */
+class opencl_splitter
+{
+public:
+    // process size bytes from in to out, offset is the byte position of in within the buffer;
+    // returns false on failure
+    typedef std::function<bool(const void *in, void *out, size_t offset, size_t size)> cpu_fn;
+
+    struct worker_stats
+    {
+        std::string name;
+        size_t chunks;
+        size_t bytes;
+        double seconds;
+    };
+
+protected:
+    friend class opencl_context;
+
+    struct device_worker
+    {
+        std::string name;
+        opencl_pipeline_ptr pipeline;
+        opencl_kernel_ptr kernel;
+        size_t item_size;
+        size_t local_size;
+        opencl_pipeline::set_args_fn set_args;
+    };
+
+    size_t grain;
+    size_t cpu_threads;
+    std::vector<device_worker> devices;
+    std::vector<worker_stats> stats;
+
+    opencl_splitter(size_t grain, size_t cpu_threads);
+
+public:
+    virtual ~opencl_splitter();
+
+    size_t getGrain() { return grain; }
+    size_t getCpuThreads() { return cpu_threads; }
+    const std::vector<worker_stats>& getStats() { return stats; }
+    void addDevice(opencl_device_ptr device, opencl_pipeline_ptr pipeline, opencl_kernel_ptr kernel,
+                   size_t item_size, size_t local_size, opencl_pipeline::set_args_fn set_args);
+    bool run(const void *in, void *out, size_t size, cpu_fn cpu);
+};
+
+
 /* opencl */
 
 class opencl